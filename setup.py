@@ -18,18 +18,20 @@ setup(
     # and nowhere else
     package_dir={'':'src'},
     # add an extension module named 'python_cpp_example' to the package
-    headers=["src/glassviewer/atom.h", "src/glassviewer/system.h", "lib/voro++/voro++.hh","lib/wignerSymbols/include/wignerSymbols.h",'lib/fftw3/fftw3.h'],
+    headers=["src/glassviewer/atom.h", "src/glassviewer/system.h", "src/glassviewer/atomstore.h", "src/glassviewer/neighborlist.h", "src/glassviewer/parallel.h", "src/glassviewer/distance.h", "lib/voro++/voro++.hh","lib/wignerSymbols/include/wignerSymbols.h",'lib/fftw3/fftw3.h'],
     ext_modules=[
         Pybind11Extension(
             "glassviewer.catom",
             ["src/glassviewer/atom.cpp", "src/glassviewer/atom_binding.cpp"],
             language='c++',
+            cxx_std=17,
             include_dirs=['lib/voro++']
         ),
         Pybind11Extension(
             "glassviewer.csystem",
-            ["src/glassviewer/system.cpp", "src/glassviewer/system_binding.cpp", "src/glassviewer/atom.cpp", "lib/voro++/voro++.cc","lib/wignerSymbols/src/wignerSymbols-cpp.cpp"],
+            ["src/glassviewer/system.cpp", "src/glassviewer/system_binding.cpp", "src/glassviewer/atom.cpp", "src/glassviewer/neighborlist.cpp", "lib/voro++/voro++.cc","lib/wignerSymbols/src/wignerSymbols-cpp.cpp"],
             language='c++',
+            cxx_std=17,
             include_dirs=['lib/voro++','lib/wignerSymbols/include','lib/fftw3'],
             library_dirs=['lib/fftw3'],
             libraries=['libfftw3-3'],
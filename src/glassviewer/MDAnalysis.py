@@ -565,23 +565,32 @@ class MDAnalysis:
                         cutoffv=self.cut2d[0]+cut2*(self.cut2d[1]-self.cut2d[0])/pdfbintemp
                         
                         sys.find_neighbors(method='cutoff',cutoff=cutoffv)
+                if self.pdfon or self.sfon:
+                    binnings=[]
+                    if self.pdfon:
+                        binnings.append((self.pdfBins,0,self.pdfcut))
+                    if self.sfon:
+                        binnings.append((self.sfpdfBins,0,self.sfpdfcut))
+                    pdfs=sys.calculate_partial_pdfs(binnings,threadnum=self.pdfthreadnum if self.pdfon else self.sfpdfthreadnum)
+                    if self.pdfon:
+                        totalpdf, partialpdfs, self.pdfr=pdfs[0]
+                    if self.sfon:
+                        sftotalpdf, sfpartialpdfs, sfpdfr=pdfs[-1]
                 for j,x in enumerate(self.partial):
                     if self.pdfon:
-                        partialpdf, self.pdfr=sys.calculate_pdf(histobins=self.pdfBins,histomin=0,cut=self.pdfcut,threadnum=self.pdfthreadnum,partial=True,centertype=x[0],secondtype=x[1])
+                        partialpdf=partialpdfs.get(tuple(x),np.zeros(self.pdfBins))
                         #self.partialpdfs[j][XDATCARNo]=partialpdf
                     if self.sfon:
-                        sfpartialpdf, sfpdfr=sys.calculate_pdf(histobins=self.sfpdfBins,histomin=0,cut=self.sfpdfcut,threadnum=self.sfpdfthreadnum,partial=True,centertype=x[0],secondtype=x[1])
+                        sfpartialpdf=sfpartialpdfs.get(tuple(x),np.zeros(self.sfpdfBins))
                         sfpartial,self.sfr=sys.calculate_sf(sfpartialpdf, sfpdfr,0);
                         #self.sfpartials[j][XDATCARNo]=np.array(sfpartial)
                    # if self.SROon:
                         #self.SRO_Cowleys[j][XDATCARNo]=sys.calculate_pmsro(reference_type=x[0],compare_type=x[1])[0]
                         #self.SRO_CS_unnorms[j][XDATCARNo]=sys.calculate_pmsro_CS(reference_type=x[0],compare_type=x[1],normalization=False)
                         #self.SRO_CS_norms[j][XDATCARNo]=sys.calculate_pmsro_CS(reference_type=x[0],compare_type=x[1],normalization=True)
-                if self.pdfon:
-                    totalpdf, self.pdfr=sys.calculate_pdf(histobins=self.pdfBins,histomin=0,cut=self.pdfcut,threadnum=self.pdfthreadnum)
+                #if self.pdfon:
                     #self.totalpdfs[XDATCARNo]=totalpdf
                 if self.sfon:
-                    sftotalpdf, sfpdfr=sys.calculate_pdf(histobins=self.sfpdfBins,histomin=0,cut=self.sfpdfcut,threadnum=self.sfpdfthreadnum)
                     sftotal,self.sfr=sys.calculate_sf(sftotalpdf, sfpdfr,0);
                     #self.sftotals[XDATCARNo]=np.array(sftotal)
                 if self.badon:
@@ -874,13 +883,24 @@ def calculate_thread(para):
             clustertemp=np.zeros(len(MD.filelist))
             clustertemp[XDATCARNo]=maxcluster(sys,clusterneimethod=MD.clusterneimethod,clustercutoff=MD.clustercutoff,clusterq6threshold=MD.clusterq6threshold,onlyreturnsolidatomsnum=MD.onlyreturnsolidatomsnum,qaverage=MD.clusterqaverage)
 
+        #total and partial pdfs of both binnings from one pass over the pairs
+        if MD.pdfon or MD.sfon:
+            binnings=[]
+            if MD.pdfon:
+                binnings.append((MD.pdfBins,0,MD.pdfcut))
+            if MD.sfon:
+                binnings.append((MD.sfpdfBins,0,MD.sfpdfcut))
+            pdfs=sys.calculate_partial_pdfs(binnings,threadnum=MD.pdfthreadnum if MD.pdfon else MD.sfpdfthreadnum)
+            if MD.pdfon:
+                totalpdf, partialpdfs, pdfr=pdfs[0]
+            if MD.sfon:
+                sftotalpdf, sfpartialpdfs, sfpdfr=pdfs[-1]
         for j,x in enumerate(MD.partial):
             if MD.pdfon:
-                partialpdf, pdfr=sys.calculate_pdf(histobins=MD.pdfBins,histomin=0,cut=MD.pdfcut,threadnum=MD.pdfthreadnum,partial=True,centertype=x[0],secondtype=x[1])
-                MD.partialpdfs[j][XDATCARNo]=partialpdf
+                MD.partialpdfs[j][XDATCARNo]=partialpdfs.get(tuple(x),np.zeros(MD.pdfBins))
 
             if MD.sfon:
-                sfpartialpdf, sfpdfr=sys.calculate_pdf(histobins=MD.sfpdfBins,histomin=0,cut=MD.sfpdfcut,threadnum=MD.sfpdfthreadnum,partial=True,centertype=x[0],secondtype=x[1])
+                sfpartialpdf=sfpartialpdfs.get(tuple(x),np.zeros(MD.sfpdfBins))
                 sfpartial,sfr=sys.calculate_sf(sfpartialpdf, sfpdfr,0);
                 MD.sfpartials[j][XDATCARNo]=np.array(sfpartial)
 
@@ -889,11 +909,9 @@ def calculate_thread(para):
                 MD.SRO_CS_unnorms[j][XDATCARNo]=sys.calculate_pmsro_CS(reference_type=x[0],compare_type=x[1],normalization=False)
                 MD.SRO_CS_norms[j][XDATCARNo]=sys.calculate_pmsro_CS(reference_type=x[0],compare_type=x[1],normalization=True)
         if MD.pdfon:
-            totalpdf, pdfr=sys.calculate_pdf(histobins=MD.pdfBins,histomin=0,cut=MD.pdfcut,threadnum=MD.pdfthreadnum)
             MD.totalpdfs[XDATCARNo]=totalpdf
 
         if MD.sfon:
-            sftotalpdf, sfpdfr=sys.calculate_pdf(histobins=MD.sfpdfBins,histomin=0,cut=MD.sfpdfcut,threadnum=MD.sfpdfthreadnum)
             sftotal,sfr=sys.calculate_sf(sftotalpdf, sfpdfr,0);
             MD.sftotals[XDATCARNo]=np.array(sftotal)
 
@@ -25,10 +25,23 @@ Atom::Atom( vector<double> pos, int idd, int typ){
     issolid = 0;
     issurface = 0;
     loc = 0;
-    isneighborset = 0;
     n_neighbors = 0;
+    cutoff = 0;
     lcluster = 0;
-    head = -1;
+    condition = 0;
+    mask = 0;
+    structure = 0;
+    frenkelnumber = 0;
+    avq6q6 = 0;
+    sii = 0;
+    disorder = 0;
+    avgdisorder = 0;
+    volume = 0;
+    avgvolume = 0;
+    n3 = n4 = n5 = n6 = 0;
+    angular = 0;
+    avg_angular = 0;
+    centrosymmetry = 0;
     entropy = 0;
     avg_entropy = 0;
     energy = 0;
@@ -38,19 +51,6 @@ Atom::Atom( vector<double> pos, int idd, int typ){
     w.resize(11);
     aw.resize(11);
 
-    for (int tn = 0; tn<MAXNUMBEROFNEIGHBORS; tn++){
-        neighbors[tn] = -1;
-        neighbordist[tn] = -1.0;
-        neighborweight[tn] = -1.0;
-        facevertices[tn] = -1;
-        faceverticenumbers[tn] = -1;
-        faceperimeters[tn] = -1.0;
-        sij[tn] = -1.0;
-        masks[tn] = -1;
-        //edgelengths[tn] = -1.0;
-
-    }
-
     for (int tn = 0; tn<11; tn++){
         q[tn] = -1;
         aq[tn] = -1;
@@ -95,58 +95,55 @@ void Atom::sx(vector<double> rls){
 //-------------------------------------------------------
 // Neighbor related properties
 //-------------------------------------------------------
+void Atom::resize_neighbors(int nn){
+    //all per neighbor values are kept at the same length
+    n_neighbors = nn;
+    neighbors.resize(nn, NILVALUE);
+    neighbordist.resize(nn, -1.0);
+    neighborweight.resize(nn, 1.00);
+    n_diffx.resize(nn, 0.0);
+    n_diffy.resize(nn, 0.0);
+    n_diffz.resize(nn, 0.0);
+    n_r.resize(nn, 0.0);
+    n_phi.resize(nn, 0.0);
+    n_theta.resize(nn, 0.0);
+    sij.resize(nn, -1.0);
+}
+
 vector<int> Atom::gneighbors(){
-    vector<int> nn;
-    nn.reserve(n_neighbors);
-    for(int i=0;i<n_neighbors;i++){
-        nn.emplace_back(neighbors[i]);
-    }
-    return nn;
+    return neighbors;
 }
 
 void Atom::sneighdist(vector<double> dd){
 }
 
 vector<double> Atom::gneighdist(){
-  vector<double> neighdist;
-  for(int i=0; i<n_neighbors; i++){
-    neighdist.emplace_back(neighbordist[i]);
-  }
-  return neighdist;
+    return neighbordist;
 }
 
 void Atom::sneighbors(vector<int> nns){
 
     //first reset all neighbors
-    for (int i = 0;i<MAXNUMBEROFNEIGHBORS;i++){
-        neighbors[i] = NILVALUE;
-        neighbordist[i] = -1.0;
-    }
+    neighbors.clear();
+    neighbordist.clear();
+    neighborweight.clear();
+    resize_neighbors(nns.size());
 
-    //now assign the neighbors
+    //now assign the neighbors, weight is auto assigned to 1
     for(int i=0; i<nns.size(); i++){
         neighbors[i] = nns[i];
-        //auto assign weight to 1
-        neighborweight[i] = 1.00;
     }
 
-    n_neighbors = nns.size();
-    isneighborset = 1;
-
 }
 
 void Atom::sneighborweights(vector<double> nss){
-    for(int i=0; i<nss.size(); i++){
+    for(int i=0; (i<nss.size()) && (i<n_neighbors); i++){
         neighborweight[i] = nss[i];
     }
 }
 
 vector<double> Atom::gneighborweights(){
-    vector <double> rqlms;
-    for(int i=0; i<n_neighbors; i++){
-        rqlms.emplace_back(neighborweight[i]);
-    }
-    return rqlms;
+    return neighborweight;
 }
 
 void Atom::sdistvecs(vector<vector<double>> nss){
@@ -193,11 +190,7 @@ void Atom::ssij(vector<double> dd){
 }
 
 vector<double> Atom::gsij(){
-  vector<double> ss;
-  for(int i=0; i<n_neighbors; i++){
-    ss.emplace_back(sij[i]);
-  }
-  return ss;
+  return sij;
 }
 
 vector<double> Atom::gallq(){
@@ -332,31 +325,19 @@ vector<complex<double>> Atom::get_qcomps(int qq, bool averaged){
 // Voronoi related properties
 //-------------------------------------------------------
 void Atom::sfacevertices(vector<int> nss){
-    for(int i=0; i<nss.size(); i++){
-        facevertices[i] = nss[i];
-    }
+    facevertices = nss;
 }
 
 vector<int> Atom::gfacevertices(){
-    vector <int> rqlms;
-    for(int i=0; i<n_neighbors; i++){
-        rqlms.emplace_back(facevertices[i]);
-    }
-    return rqlms;
+    return facevertices;
 }
 
 void Atom::sfaceperimeters(vector<double> nss){
-    for(int i=0; i<nss.size(); i++){
-        faceperimeters[i] = nss[i];
-    }
+    faceperimeters = nss;
 }
 
 vector<double> Atom::gfaceperimeters(){
-    vector <double> rqlms;
-    for(int i=0; i<n_neighbors; i++){
-        rqlms.emplace_back(faceperimeters[i]);
-    }
-    return rqlms;
+    return faceperimeters;
 }
 
 void Atom::sedgelengths(vector<vector<double>> nss){
@@ -397,63 +378,3 @@ void Atom::svorovector(vector<int> voro){
 //-------------------------------------------------------
 // Angle related properties
 //-------------------------------------------------------
-
-
-//-------------------------------------------------------
-// Other order parameters
-//-------------------------------------------------------
-
-double Atom::gmr(double r)
-{
-        double g = 0.00;
-        double rij,r2;
-        double sigma2 = sigma*sigma;
-        double frho = 4.00*PI*rho*r*r;
-        double fsigma = sqrt(2.00*PI*sigma2);
-        double factor = (1.00/frho)*(1.00/fsigma);
-
-        for(int i=0; i<n_neighbors; i++)
-        {
-                rij = neighbordist[i];
-                r2 = (r-rij)*(r-rij);
-                g+=exp((-1.00*r2)/(2.00*sigma2));
-        }
-
-        return factor*g;
-}
-
-//function which is to be integrated
-double Atom::entropy_integrand(double r)
-{
-        double g = gmr(r);
-        return ((g*log(g)-g +1.00)*r*r);
-}
-
-
-void Atom::trapezoid_integration()
-{
-
-        int nsteps = (rstop - rstart)/h;
-        double summ;
-        double xstart, xend;
-        summ=0.00;
-        double rloop;
-        double integral;
-
-        xstart = entropy_integrand(rstart);
-
-        for(int j=1; j<nsteps-1; j++)
-        {
-
-                rloop = rstart + j*h;
-                summ += entropy_integrand(rloop);
-
-        }
-
-        xend = entropy_integrand(rstart + nsteps*h);
-        integral = (h/2.00)*(xstart + 2.00*summ + xend);
-        //cout<<xstart<<endl;
-        integral = -1.*rho*kb*integral;
-        entropy = integral;
-}
-
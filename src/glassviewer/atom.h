@@ -1,3 +1,6 @@
+#ifndef GLASSVIEWER_ATOM_H
+#define GLASSVIEWER_ATOM_H
+
 #include <iostream>
 #include <exception>
 #include <math.h>
@@ -12,19 +15,22 @@
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include <complex>
+#include <map>
+#include <variant>
 
 namespace py = pybind11;
 using namespace std;
 
 
 const double PI = 3.141592653589793;
-const int MAXNUMBEROFNEIGHBORS = 300;
 const int NILVALUE = 333333;
 
-//create a structure for sorting
+//create a structure for sorting, dx, dy, dz are the vector
+//to the neighbor, which picks the periodic image
 struct datom{
     double dist;
     int  index;
+    double dx, dy, dz;
 };
 
 //create another for the sorting algorithm
@@ -34,6 +40,10 @@ struct by_dist{
     }
 };
 
+//a custom value of an atom, the order of the types is the
+//order of the kinds of a CustomColumn
+typedef variant<long long, double, string, vector<double>> customvalue;
+
 
 class Atom{
     /*
@@ -86,7 +96,7 @@ class Atom{
         vector<double> gx();
         void sx(vector<double>);
 
-        py::dict custom;
+        map<string, customvalue> custom;
         int type;
         int condition;
 
@@ -100,23 +110,22 @@ class Atom{
         //-------------------------------------------------------
         // Neighbor related properties
         //-------------------------------------------------------
-        int neighbors[MAXNUMBEROFNEIGHBORS];
-        int masks[MAXNUMBEROFNEIGHBORS];
-        double neighbordist[MAXNUMBEROFNEIGHBORS];
-        double neighborweight[MAXNUMBEROFNEIGHBORS];
-        double n_diffx[MAXNUMBEROFNEIGHBORS];
-        double n_diffy[MAXNUMBEROFNEIGHBORS];
-        double n_diffz[MAXNUMBEROFNEIGHBORS];
-        double n_r[MAXNUMBEROFNEIGHBORS];
-        double n_phi[MAXNUMBEROFNEIGHBORS];
-        double n_theta[MAXNUMBEROFNEIGHBORS];
-
-        vector<datom> temp_neighbors;
+        //per neighbor values, all of length n_neighbors
+        vector<int> neighbors;
+        vector<double> neighbordist;
+        vector<double> neighborweight;
+        vector<double> n_diffx;
+        vector<double> n_diffy;
+        vector<double> n_diffz;
+        vector<double> n_r;
+        vector<double> n_phi;
+        vector<double> n_theta;
+
         double cutoff;
         int n_neighbors;
-        int isneighborset;
 
         //function to set neighbors
+        void resize_neighbors(int);
         void sneighdist(vector<double>);
         vector<double> gneighdist();
         void sneighbors(vector<int> nns);
@@ -127,18 +136,14 @@ class Atom{
         vector<vector<double>> gdistvecs();
         void slocalangles(vector<vector<double>>);
         vector<vector<double>> glocalangles();
-        void find_filtered_neighbors(double);
         vector<vector<int>> next_neighbors;
-        vector<vector<int>> next_neighbor_masks;
         vector<vector<double>> next_neighbor_distances;
         vector<int> next_neighbor_counts;
-        int head;
  
         //-------------------------------------------------------
         // Q parameter properties
         //-------------------------------------------------------
-        double sij[MAXNUMBEROFNEIGHBORS];
-        double realQ6[13],imgQ6[13];
+        vector<double> sij;
         void ssij(vector<double>);
         vector<double> gsij();
         vector<double> wnorm;//11atomʼгʼ
@@ -183,9 +188,8 @@ class Atom{
         //-------------------------------------------------------
         // Voronoi related properties
         //-------------------------------------------------------
-        int facevertices[MAXNUMBEROFNEIGHBORS];
-        int faceverticenumbers[MAXNUMBEROFNEIGHBORS];
-        double faceperimeters[MAXNUMBEROFNEIGHBORS];
+        vector<int> facevertices;
+        vector<double> faceperimeters;
         int n3, n4, n5, n6;
         vector<vector<double>> edgelengths;
         vector<vector<double>> vertex_positions;
@@ -218,7 +222,6 @@ class Atom{
         vector<vector<int>> cna;
         vector<vector<int>> common;
         vector<vector<int>> bonds;
-        int nn1[4];
 
         //-------------------------------------------------------
         // Other order parameters
@@ -226,20 +229,6 @@ class Atom{
         vector<double> sro;
         double centrosymmetry;
 
-        //these are the cutoffs for cna
-        double lcutsmall;
-        double lcutlarge;
-        int lneigh;
-
-        double sigma;
-        double rho;
-        double rstart;
-        double rstop;
-        double h;
-        double kb;
-        double gmr(double);
-        double entropy_integrand(double);
-        void trapezoid_integration();
         //results
         double entropy;
         double avg_entropy;
@@ -249,3 +238,5 @@ class Atom{
 
 
 };
+
+#endif
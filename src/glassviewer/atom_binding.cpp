@@ -18,10 +18,81 @@ using namespace std;
 
 vector<double> vv{0,0,0};
 
+//live view on the custom values of an Atom, so that changes made through
+//the view end up in the Atom. owner keeps the Atom alive while the view is.
+struct CustomView{
+    py::object owner;
+    Atom *atom;
+};
+
 PYBIND11_MODULE(catom, m) {
     py::options options;
     options.disable_function_signatures();
 
+//bindings for the view on the custom values of an Atom
+//------------------------------------------------------------------
+py::class_<CustomView>(m, "CustomView", R"mydelimiter(
+        Dictionary like view on the custom values of an `Atom`. Values set or
+        deleted through the view are changed in the `Atom` itself.
+    )mydelimiter")
+    .def("__getitem__", [](CustomView &v, const string &key){
+        auto it = v.atom->custom.find(key);
+        if (it == v.atom->custom.end()) throw py::key_error(key);
+        return py::cast(it->second);
+    })
+    .def("__setitem__", [](CustomView &v, const string &key, customvalue val){
+        v.atom->custom[key] = val;
+    })
+    .def("__delitem__", [](CustomView &v, const string &key){
+        if (v.atom->custom.erase(key) == 0) throw py::key_error(key);
+    })
+    .def("__contains__", [](CustomView &v, py::object key){
+        if (!py::isinstance<py::str>(key)) return false;
+        return v.atom->custom.count(key.cast<string>()) > 0;
+    })
+    .def("__len__", [](CustomView &v){
+        return v.atom->custom.size();
+    })
+    .def("__iter__", [](CustomView &v){
+        return py::make_key_iterator(v.atom->custom.begin(), v.atom->custom.end());
+    }, py::keep_alive<0, 1>())
+    .def("__eq__", [](CustomView &v, py::object other){
+        return py::cast(v.atom->custom).equal(other);
+    })
+    .def("__repr__", [](CustomView &v){
+        return py::repr(py::cast(v.atom->custom));
+    })
+    .def("keys", [](CustomView &v){
+        vector<string> keys;
+        for(auto &c : v.atom->custom) keys.emplace_back(c.first);
+        return keys;
+    })
+    .def("values", [](CustomView &v){
+        py::list vals;
+        for(auto &c : v.atom->custom) vals.append(py::cast(c.second));
+        return vals;
+    })
+    .def("items", [](CustomView &v){
+        py::list items;
+        for(auto &c : v.atom->custom) items.append(py::make_tuple(c.first, c.second));
+        return items;
+    })
+    .def("get", [](CustomView &v, const string &key, py::object dflt){
+        auto it = v.atom->custom.find(key);
+        if (it == v.atom->custom.end()) return dflt;
+        return py::cast(it->second);
+    }, py::arg("key"), py::arg("default") = py::none())
+    .def("update", [](CustomView &v, map<string, customvalue> vals){
+        for(auto &c : vals) v.atom->custom[c.first] = c.second;
+    })
+    .def("copy", [](CustomView &v){
+        return py::dict(py::cast(v.atom->custom));
+    })
+    ;
+
+//register the view as a mapping, so that it can be used like a dict
+py::module_::import("collections.abc").attr("MutableMapping").attr("register")(m.attr("CustomView"));
+
 //bindings for Atom class
 //------------------------------------------------------------------
 py::class_<Atom>(m,"Atom", R"mydelimiter(
@@ -115,12 +186,19 @@ py::class_<Atom>(m,"Atom", R"mydelimiter(
         int specifying ghost status of the atom.
     )mydelimiter")
 
-    .def_readwrite("custom", &Atom::custom, R"mydelimiter(
+    .def_property("custom", [](py::object self){
+            return CustomView{self, self.cast<Atom*>()};
+        }, [](Atom &atom1, py::object vals){
+            if (py::isinstance<CustomView>(vals)) atom1.custom = vals.cast<CustomView&>().atom->custom;
+            else atom1.custom = vals.cast<map<string, customvalue>>();
+        }, R"mydelimiter(
         *dict*.
         dictionary specfying custom values for an atom. The module only stores the id, type and
         position of the atom. If any extra values need to be stored, they can be stored in custom
         using `atom.custom = {"velocity":12}`. :func:`~glassviewer.core.System.read_inputfile` can also
-        read in extra atom information. By default, custom values are treated as string.
+        read in extra atom information. Values can be ints, floats, strings or lists of floats.
+        A view on the values of the atom is returned, so that `atom.custom["velocity"] = 12`
+        changes the atom. Use `atom.custom.copy()` for a plain dictionary.
     )mydelimiter")
 
     //-------------------------------------------------------
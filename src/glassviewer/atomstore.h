@@ -0,0 +1,415 @@
+#ifndef GLASSVIEWER_ATOMSTORE_H
+#define GLASSVIEWER_ATOMSTORE_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <memory>
+#include <cstring>
+#include <stdint.h>
+#include <pybind11/pybind11.h>
+#include "atom.h"
+
+namespace py = pybind11;
+using namespace std;
+
+/*
+A named custom per atom value, stored with one type for all atoms. Strings
+are interned so that each atom only holds an index into the string table.
+Values are promoted when needed, an int column becomes a double column once
+a double value is set and any number column becomes a string column once a
+string is set. has marks the atoms which carry a value.
+*/
+class CustomColumn{
+
+    public:
+
+        //same order as the types of customvalue
+        enum { INT = 0, DOUBLE = 1, STRING = 2, LIST = 3 };
+
+        int kind = INT;
+        vector<char> has;
+        vector<long long> ivals;
+        vector<double> dvals;
+        vector<int> svals;
+        vector<vector<double>> lvals;
+        vector<string> strings;
+        unordered_map<string, int> lookup;
+
+        void resize(int n, int k){
+            kind = k;
+            has.assign(n, 0);
+            ivals.clear();
+            dvals.clear();
+            svals.clear();
+            lvals.clear();
+            strings.clear();
+            lookup.clear();
+            if (kind == INT) ivals.assign(n, 0);
+            else if (kind == DOUBLE) dvals.assign(n, 0.0);
+            else if (kind == STRING) svals.assign(n, intern(""));
+            else lvals.assign(n, vector<double>());
+        }
+
+        int intern(const string &val){
+            auto it = lookup.find(val);
+            if (it != lookup.end()) return it->second;
+            strings.emplace_back(val);
+            lookup[val] = strings.size()-1;
+            return strings.size()-1;
+        }
+
+        string to_string(int ti) const {
+            ostringstream ss;
+            if (kind == INT) ss << ivals[ti];
+            else if (kind == DOUBLE) ss << dvals[ti];
+            else if (kind == STRING) return strings[svals[ti]];
+            return ss.str();
+        }
+
+        void promote(int k){
+            int n = has.size();
+            if ((k == kind) || ((kind == DOUBLE) && (k == INT))) return;
+            if ((kind == LIST) || (k == LIST))
+                throw invalid_argument("custom values of a key should all be lists or all be scalars");
+            if ((kind == STRING) || (k == INT)) return;
+            if (k == DOUBLE){
+                //int to double
+                dvals.resize(n);
+                for(int ti=0; ti<n; ti++) dvals[ti] = double(ivals[ti]);
+                ivals.clear();
+            }
+            else{
+                //number to string
+                svals.resize(n);
+                for(int ti=0; ti<n; ti++) svals[ti] = intern(has[ti] ? to_string(ti) : "");
+                ivals.clear();
+                dvals.clear();
+            }
+            kind = k;
+        }
+
+        void set(int ti, const customvalue &val){
+            promote(val.index());
+            has[ti] = 1;
+            if (kind == INT) ivals[ti] = get<long long>(val);
+            else if (kind == DOUBLE){
+                if (val.index() == INT) dvals[ti] = double(get<long long>(val));
+                else dvals[ti] = get<double>(val);
+            }
+            else if (kind == STRING){
+                if (val.index() == INT) svals[ti] = intern(std::to_string(get<long long>(val)));
+                else if (val.index() == DOUBLE){
+                    ostringstream ss;
+                    ss << get<double>(val);
+                    svals[ti] = intern(ss.str());
+                }
+                else svals[ti] = intern(get<string>(val));
+            }
+            else lvals[ti] = get<vector<double>>(val);
+        }
+
+        //whether a value of type k changes the kind, and so the storage, of the column
+        bool promotes(int k) const {
+            if ((k == kind) || (kind == LIST) || (k == LIST)) return false;
+            return (kind != STRING) && (k != INT);
+        }
+
+        customvalue value(int ti) const {
+            if (kind == INT) return ivals[ti];
+            else if (kind == DOUBLE) return dvals[ti];
+            else if (kind == STRING) return strings[svals[ti]];
+            return lvals[ti];
+        }
+
+        //numeric value used by C++ kernels, for example as condition
+        double number(int ti) const {
+            if (kind == INT) return double(ivals[ti]);
+            else if (kind == DOUBLE) return dvals[ti];
+            throw invalid_argument("custom value is not a number");
+        }
+};
+
+/*
+Structure of arrays store for all per atom values of a System.
+
+Every column is indexed by the location of the atom in the system. Columns
+that hold one value per atom are allocated together in resize. The large
+columns of the steinhardt parameters (q, qlm ...) are kept per l value and
+are only allocated once that l value is calculated, see ensure_q. Variable
+length values that are only set from python (sro, chiparams ...) are left
+empty until an atom actually carries a value. Custom values are kept as typed
+columns by name, see CustomColumn.
+
+The numpy views on the one value per atom columns, the q values and the custom
+values point into the columns. Each view holds a copy of columnviews, qviews or
+customviews, and operations which would move or free a column that is viewed
+throw instead, see reallocate and erase_custom. generation counts the times the columns
+were set up for a new set of atoms.
+*/
+class AtomStore{
+
+    public:
+
+        int nop = 0;
+
+        //-------------------------------------------------------
+        // Basic Atom properties
+        //-------------------------------------------------------
+        vector<double> posx, posy, posz;
+        vector<int> id;
+        vector<int> type;
+        vector<int> ghost;
+        vector<int> condition;
+        vector<char> mask;
+        map<string, CustomColumn> custom;
+
+        //-------------------------------------------------------
+        // Neighbor related properties
+        //-------------------------------------------------------
+        vector<double> cutoff;
+
+        //-------------------------------------------------------
+        // Q parameter properties
+        //-------------------------------------------------------
+        //indexed as [q-2][ti] and [q-2][ti*(2q+1) + mi] respectively
+        vector<vector<double>> q, aq;
+        vector<vector<double>> w, aw, wnorm, awnorm;
+        vector<vector<double>> realq, imgq, arealq, aimgq;
+        vector<double> sii;
+        vector<double> disorder;
+        vector<double> avgdisorder;
+
+        //-------------------------------------------------------
+        // Solid related properties
+        //-------------------------------------------------------
+        vector<int> frenkelnumber;
+        vector<double> avq6q6;
+        vector<int> belongsto;
+        vector<char> lcluster;
+        vector<char> issurface;
+        vector<char> issolid;
+        vector<int> structure;
+
+        //-------------------------------------------------------
+        // Voronoi related properties
+        //-------------------------------------------------------
+        vector<double> volume;
+        vector<double> avgvolume;
+        vector<int> vorovector;     //n3, n4, n5, n6 for each atom
+        vector<vector<double>> vertex_vectors;
+        vector<vector<int>> vertex_numbers;
+        vector<vector<vector<double>>> edgelengths;
+        vector<vector<vector<double>>> vertex_positions;
+
+        //-------------------------------------------------------
+        // Angle related properties
+        //-------------------------------------------------------
+        vector<double> angular;
+        vector<double> avg_angular;
+        vector<vector<int>> chiparams;
+
+        //-------------------------------------------------------
+        // CNA parameters
+        //-------------------------------------------------------
+        vector<int> nn1;            //four closest neighbors, diamond only
+        //per neighbor of an atom, the common neighbors as atom indices and the
+        //number of bonds of each of them, kept from the last cna pass on the atom
+        vector<vector<vector<int>>> common, bonds;
+
+        //-------------------------------------------------------
+        // Other order parameters
+        //-------------------------------------------------------
+        vector<vector<double>> sro;
+        vector<double> centrosymmetry;
+        vector<double> entropy;
+        vector<double> avg_entropy;
+        vector<double> energy;
+        vector<double> avg_energy;
+
+        //-------------------------------------------------------
+        // Views
+        //-------------------------------------------------------
+        unsigned long generation = 0;
+        shared_ptr<int> columnviews = make_shared<int>(0);
+        shared_ptr<int> qviews = make_shared<int>(0);
+        shared_ptr<int> customviews = make_shared<int>(0);
+
+        //-------------------------------------------------------
+        // Methods
+        //-------------------------------------------------------
+        //check that the columns can be set up for n atoms. The one value per
+        //atom columns are always assigned together, so that they share their
+        //capacity and are only moved if n is above it. While q values are
+        //viewed their columns are emptied but kept, so the same holds for
+        //them once they are calculated again. Custom columns are always freed.
+        void reallocate(int n){
+            if ((columnviews.use_count() > 1) && (n > posx.capacity()))
+                throw invalid_argument("atoms can not be set while views on per atom values exist, delete the views first");
+            if (qviews.use_count() > 1){
+                for(int l=0; l<q.size(); l++){
+                    if (((q[l].capacity() > 0) && (n > q[l].capacity())) || ((aq[l].capacity() > 0) && (n > aq[l].capacity())))
+                        throw invalid_argument("atoms can not be set while views on q values exist, delete the views first");
+                }
+            }
+            if ((customviews.use_count() > 1) && (custom.size() > 0))
+                throw invalid_argument("atoms can not be set while views on custom values exist, delete the views first");
+        }
+
+        //check that a value of type k can be set for key, which is not allowed
+        //while the column is viewed and would change its kind
+        void check_custom(const string &key, int k){
+            auto it = custom.find(key);
+            if ((customviews.use_count() > 1) && (it != custom.end()) && it->second.promotes(k))
+                throw invalid_argument("custom values can not change their type while views on them exist, delete the views first");
+        }
+
+        //checksum of the positions of the first n atoms, so that values worked
+        //out from the positions can tell if they still hold, however the
+        //positions were changed
+        uint64_t position_checksum(int n) const {
+            uint64_t sum = 14695981039346656037ULL;
+            uint64_t bits;
+            for(int ti=0; ti<n; ti++){
+                memcpy(&bits, &posx[ti], sizeof(bits));
+                sum = (sum ^ bits)*1099511628211ULL;
+                memcpy(&bits, &posy[ti], sizeof(bits));
+                sum = (sum ^ bits)*1099511628211ULL;
+                memcpy(&bits, &posz[ti], sizeof(bits));
+                sum = (sum ^ bits)*1099511628211ULL;
+            }
+            return sum;
+        }
+
+        //remove a custom column, which is not allowed while it may be viewed
+        void erase_custom(const string &key){
+            if ((customviews.use_count() > 1) && (custom.count(key) > 0))
+                throw invalid_argument("custom values can not be replaced while views on them exist, delete the views first");
+            custom.erase(key);
+        }
+
+        void resize(int n){
+            //(re)allocate the one value per atom columns with the
+            //same defaults as the Atom constructor
+            reallocate(n);
+            generation++;
+            nop = n;
+            posx.assign(n, 0.0); posy.assign(n, 0.0); posz.assign(n, 0.0);
+            id.assign(n, 0);
+            type.assign(n, 0);
+            ghost.assign(n, 0);
+            condition.assign(n, 0);
+            mask.assign(n, 0);
+            custom.clear();
+            cutoff.assign(n, 0.0);
+
+            if ((qviews.use_count() > 1) && (q.size() == 11)){
+                for(int l=0; l<11; l++){
+                    q[l].clear();
+                    aq[l].clear();
+                }
+            }
+            else{
+                q.assign(11, vector<double>());
+                aq.assign(11, vector<double>());
+            }
+            w.assign(11, vector<double>());
+            aw.assign(11, vector<double>());
+            wnorm.assign(11, vector<double>());
+            awnorm.assign(11, vector<double>());
+            realq.assign(11, vector<double>());
+            imgq.assign(11, vector<double>());
+            arealq.assign(11, vector<double>());
+            aimgq.assign(11, vector<double>());
+            sii.assign(n, 0.0);
+            disorder.assign(n, 0.0);
+            avgdisorder.assign(n, 0.0);
+
+            frenkelnumber.assign(n, 0);
+            avq6q6.assign(n, 0.0);
+            belongsto.assign(n, -1);
+            lcluster.assign(n, 0);
+            issurface.assign(n, 0);
+            issolid.assign(n, 0);
+            structure.assign(n, 0);
+
+            volume.assign(n, 0.0);
+            avgvolume.assign(n, 0.0);
+            vorovector.assign(4*n, 0);
+            vertex_vectors.clear();
+            vertex_numbers.clear();
+            edgelengths.clear();
+            vertex_positions.clear();
+
+            angular.assign(n, 0.0);
+            avg_angular.assign(n, 0.0);
+            chiparams.clear();
+
+            nn1.clear();
+            common.clear();
+            bonds.clear();
+
+            sro.clear();
+            centrosymmetry.assign(n, 0.0);
+            entropy.assign(n, 0.0);
+            avg_entropy.assign(n, 0.0);
+            energy.assign(n, 0.0);
+            avg_energy.assign(n, 0.0);
+        }
+
+        //allocate the columns of a steinhardt parameter on first use
+        void ensure_q(int qq){
+            int l = qq-2;
+            if (q[l].size() != nop){
+                q[l].assign(nop, -1.0);
+                realq[l].assign(nop*(2*qq+1), -1.0);
+                imgq[l].assign(nop*(2*qq+1), -1.0);
+            }
+        }
+
+        void ensure_aq(int qq){
+            int l = qq-2;
+            ensure_q(qq);
+            if (aq[l].size() != nop){
+                aq[l].assign(nop, -1.0);
+                arealq[l].assign(nop*(2*qq+1), -1.0);
+                aimgq[l].assign(nop*(2*qq+1), -1.0);
+            }
+        }
+
+        void ensure_w(int qq, bool averaged){
+            int l = qq-2;
+            vector<double> &ww = averaged ? aw[l] : w[l];
+            vector<double> &wn = averaged ? awnorm[l] : wnorm[l];
+            if (ww.size() != nop){
+                ww.assign(nop, -1.0);
+                wn.assign(nop, -1.0);
+            }
+        }
+
+        //custom column of a key, created with the given kind if it does not exist
+        CustomColumn& custom_column(const string &key, int kind){
+            auto it = custom.find(key);
+            if (it == custom.end()){
+                it = custom.emplace(key, CustomColumn()).first;
+                it->second.resize(nop, kind);
+            }
+            return it->second;
+        }
+
+        //variable length columns are only allocated once they are needed
+        template <typename T>
+        static void ensure_column(vector<T> &col, int n){
+            if (col.size() != n) col.resize(n);
+        }
+
+        //location of the m component of atom ti in a qlm column
+        static int qlm_index(int ti, int qq, int mi){
+            return ti*(2*qq+1) + mi;
+        }
+};
+
+#endif
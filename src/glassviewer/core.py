@@ -66,6 +66,17 @@ class System(pc.System):
 
     atoms : list of :class:`~glassviewer.catom.Atom` objects
 
+    periodic : list of bools of size 3
+        Whether the box is periodic along each of its vectors, default
+        `[True, True, True]`. Along a direction which is not periodic atoms
+        are not wrapped and have no images, as for a cluster or a slab with
+        free surfaces.
+
+    skin : float
+        Distance added to the cutoff for a Verlet list which is kept over
+        the frames of a trajectory, see :func:`~glassviewer.core.System.find_neighbors`.
+        Default 0, no Verlet list.
+
     Notes
     -----
     A `System` consists of two
@@ -79,6 +90,19 @@ class System(pc.System):
         :func:`~glassviewer.core.System.get_atom` method. An atom can be assigned
         to the atom using the :func:`~glassviewer.core.System.set_atom` method.
 
+    .. note::
+
+        For large systems, per atom values can be read without creating any
+        :class:`~glassviewer.catom.Atom` objects using the `view_*` methods, for example
+        ``x, y, z = sys.view_positions()``, ``sys.view_types()``, ``sys.view_qvals(6)`` or
+        ``offsets, indices, distances = sys.view_neighbors()``. These return read only numpy
+        arrays that share memory with the system. Positions are changed with
+        ``sys.set_positions(x, y, z)`` or ``sys.update_positions(positions)``, which copy the
+        values in and keep the neighbor caches consistent. While a view is alive, setting atoms
+        or finding neighbors in a way which would move the memory it points to raises an error,
+        so that views should be deleted or requested again once the atoms are set. Views on
+        neighbors and q values should be requested again after they are recalculated.
+
     Examples
     --------
     >>> sys = System()
@@ -150,54 +174,8 @@ class System(pc.System):
         """
         Set atoms
         """
-        number_extendto=100
-        if(len(atoms) < number_extendto):\
-            #对于三斜和正交晶胞一起扩胞，尽可能使三个高相同。把内切球中的原子数扩到number_extendto
-            height1=abs(np.dot(self.box[0],np.cross(self.box[1],self.box[2])))/np.linalg.norm(np.cross(self.box[1],self.box[2]))
-            height2=abs(np.dot(self.box[1],np.cross(self.box[0],self.box[2])))/np.linalg.norm(np.cross(self.box[0],self.box[2]))
-            height3=abs(np.dot(self.box[2],np.cross(self.box[0],self.box[1])))/np.linalg.norm(np.cross(self.box[0],self.box[1]))
-            boxvecs = self.box
-            vol0 = abs(np.dot(np.cross(boxvecs[0], boxvecs[1]), boxvecs[2]))
-            rho=vol0/len(atoms)
-            ball_vol=rho*number_extendto
-            ball_d=2*((3/4*ball_vol/np.pi)**(1/3))
-            nx=int(np.ceil((ball_d/height1-1)/2))
-            ny=int(np.ceil((ball_d/height2-1)/2))
-            nz=int(np.ceil((ball_d/height3-1)/2))
-            if np.sum(self.box) == 0:
-                raise ValueError("Simulation box should be initialized before atoms")
-            atoms = self.repeat((nx, ny, nz), atoms=atoms, ghost=True, scale_box=True)
-            ''' #原来这么扩胞没有意义，对于很扁细的晶胞扩胞后还是很扁很细的,对于三斜我不知道怎么处理，还按照他的吧
-            if(self.triclinic==1):
-                #we need to estimate a rough idea
-                needed_atoms = 200 - len(atoms)
-                #get a rough cell
-                needed_cells = np.ceil(needed_atoms/len(atoms))
-                nx = int(needed_cells**(1/3))
-                nx = int(np.ceil(nx/2))
-
-                if np.sum(self.box) == 0:
-                    raise ValueError("Simulation box should be initialized before atoms")
-                atoms = self.repeat((nx, nx, nx), atoms=atoms, ghost=True, scale_box=True)
-                
-
-
-            else:
-                boxvecs = self.box
-                vol0 = abs(np.dot(np.cross(boxvecs[0], boxvecs[1]), boxvecs[2]))
-                rho=vol0/len(atoms)
-                vol=rho*number_extendto
-                egde=vol**(1/3)
-                nx=int(np.ceil((egde/np.sum(self.box[0])-1)/2))
-                ny=int(np.ceil((egde/np.sum(self.box[1])-1)/2))
-                nz=int(np.ceil((egde/np.sum(self.box[2])-1)/2))
-                if np.sum(self.box) == 0:
-                    raise ValueError("Simulation box should be initialized before atoms")
-                atoms = self.repeat((nx, ny, nz), atoms=atoms, ghost=True, scale_box=True)
-            
-            '''
-            
-
+        #small boxes need no ghost atoms, the neighbor searches
+        #go through the periodic images themselves
         self.set_atoms(atoms)#把real和ghost都塞进去，cpp会自动归类
 
     def add_atoms(self, atoms):
@@ -255,16 +233,90 @@ class System(pc.System):
         Triclinic simulation boxes can also be read in.
 
         If `custom_keys` are provided, this extra information is read in from input files if
-        available. This information is not passed to the C++ instance of atom, and is stored
-        as a dictionary. It can be accessed directly as `atom.custom['customval']`
+        available. The values are stored in typed columns of the system, as ints or floats if
+        possible and as strings otherwise. They can be accessed for all atoms with
+        :func:`~glassviewer.core.System.get_custom_values` or for a single atom as `atom.custom['customval']`
 
 
         """
-        atoms, box = ptp.read_file(filename, format=format, 
+        data, box = ptp.read_arrays(filename, format=format, 
                                     compressed=compressed, customkeys=customkeys,
                                         )
         self.box = box
-        self.atoms = atoms
+        self.set_arrays(data["positions"], data["types"], ids=data["ids"], custom=data["custom"])
+
+    @classmethod
+    def from_arrays(cls, positions, types, box, ids=None, custom=None):
+        """
+        Create a system directly from arrays.
+
+        Parameters
+        ----------
+        positions : array like of shape natoms x 3
+            positions of the atoms
+
+        types : array like of ints
+            type of each atom
+
+        box : list of list of floats
+            the box vectors
+
+        ids : array like of ints, optional
+            id of each atom, default 1 to natoms
+
+        custom : dict, optional
+            dict of custom key : array like of length natoms, the values
+            are stored in :attr:`~glassviewer.catom.Atom.custom`
+
+        Returns
+        -------
+        sys : System
+
+        Examples
+        --------
+        >>> sys = System.from_arrays(positions, types, box)
+        """
+        sys = cls()
+        sys.box = box
+        sys.set_arrays(positions, types, ids=ids, custom=custom)
+        return sys
+
+    def set_arrays(self, positions, types, ids=None, custom=None):
+        """
+        Set the atoms of the system from arrays.
+
+        Parameters
+        ----------
+        positions : array like of shape natoms x 3
+            positions of the atoms
+
+        types : array like of ints
+            type of each atom
+
+        ids : array like of ints, optional
+            id of each atom, default 1 to natoms
+
+        custom : dict, optional
+            dict of custom key : array like of length natoms
+
+        Returns
+        -------
+        None
+
+        Notes
+        -----
+        The box should be set before the atoms. The arrays are copied into the
+        C++ storage without creating any :class:`~glassviewer.catom.Atom` objects.
+        """
+        positions = np.ascontiguousarray(positions, dtype=float)
+        types = np.ascontiguousarray(types, dtype=np.intc)
+        if ids is None:
+            ids = np.arange(1, len(positions)+1)
+        ids = np.ascontiguousarray(ids, dtype=np.intc)
+        if custom is None:
+            custom = {}
+
+        self.cset_atoms_arrays(positions, types, ids, custom)
 
 
     def get_atom(self, index):
@@ -322,6 +374,11 @@ class System(pc.System):
         对于方晶胞，且cut小于_box三个边的0.5倍，经过反复优化，速度很快。
         Calculate the radial distribution function.
 
+        The cut may be larger than half the box, the pairs with all periodic
+        images within it are then found with cells whose stencils reach over
+        the images, so that the time grows with the number of pairs within
+        the cut and not with the number of images.
+
         Parameters
         ----------
         histobins : int
@@ -333,6 +390,10 @@ class System(pc.System):
             maximum value of the distance histogram. Default, the maximum value
             in all pair distances is used.
 
+        threadnum : int, optional
+            number of threads taken from the shared thread pool. If 0,
+            :attr:`~glassviewer.core.System.nthreads` is used. Default 10.
+
         Returns
         -------
         pdf : array of ints
@@ -350,20 +411,17 @@ class System(pc.System):
         hist=np.array(hist,dtype='int64')
         
         #get box density
-        boxvecs = self.box #返回realbox
+        boxvecs = self.box
         vol = abs(np.dot(np.cross(boxvecs[0], boxvecs[1]), boxvecs[2]))
-        nallatom = self.ntotal#real+ghost
-        nrealatom=self.natoms#real
+        nrealatom=self.natoms
         rho = nrealatom/vol
         
-        hist=hist*(nrealatom/nallatom)# 由于cpp采取扩胞的原子（real+ghost）进行运算，这里将缩放回最开始的原胞（real原子）
-        
         delta=(cut-histomin)/histobins
         r=np.arange(histobins)*delta+histomin
         
         
         if self.pdf_halftimes==1:
-            distri=hist/float(delta)*2 # 未扩胞进行半数优化
+            distri=hist/float(delta)*2 #each pair was counted once
         else:
             distri=hist/float(delta)
             
@@ -372,10 +430,10 @@ class System(pc.System):
         
         
         
-        #Ncentertype=np.sum([1 for n in self.atoms if n.type == centertype])*nallatom/nrealatom
-        #Nsecondtype=np.sum([1 for n in self.atoms if n.type == secondtype])*nallatom/nrealatom
-        Ncentertype=np.sum([1 for n in self.atoms if n.type == centertype])
-        Nsecondtype=np.sum([1 for n in self.atoms if n.type == secondtype])
+        types = self.view_types()
+        Ncentertype=np.count_nonzero(types == centertype)
+        Nsecondtype=np.count_nonzero(types == secondtype)
+        del types
         #now divide to get final value
         np.seterr(divide='ignore',invalid='ignore')
         if partial==False:
@@ -384,6 +442,69 @@ class System(pc.System):
             pdf = distri*nrealatom/(Ncentertype*Nsecondtype*4*np.pi*r*r*rho)
         pdf=np.nan_to_num(pdf)
         return pdf, r
+    def calculate_partial_pdfs(self, binnings=((100, 0.0, 10),), threadnum=10):
+        """
+        Calculate the total and all partial radial distribution functions
+        in one pass over the pairs of atoms.
+
+        Parameters
+        ----------
+        binnings : list of tuples, optional
+            each tuple is (histobins, histomin, cut) as taken by
+            :func:`~glassviewer.core.System.calculate_pdf`. Pairs are found
+            once up to the largest cut and put into every binning.
+            Default one binning of 100 bins up to 10.
+
+        threadnum : int, optional
+            number of threads taken from the shared thread pool. If 0,
+            :attr:`~glassviewer.core.System.nthreads` is used. Default 10.
+
+        Returns
+        -------
+        res : list of tuples
+            one tuple (pdf, partials, r) for each binning. pdf is the total
+            radial distribution function, partials a dict with the partial
+            one of types a and b at key (a, b), for all types present, and
+            r the radius in distance units.
+
+        """
+        cuts, lows, bins = [], [], []
+        for histobins, histomin, cut in binnings:
+            if(histomin>=cut):
+                raise ValueError("value of histomin should be less than value of cut(which serves as histomax)")
+            if histomin <0:
+                raise ValueError("value of histomin should be not be negative")
+            cuts.append(cut)
+            lows.append(histomin)
+            bins.append(histobins)
+
+        hists = self.get_pair_histograms(cuts, lows, bins, threadnum)
+
+        boxvecs = self.box
+        vol = abs(np.dot(np.cross(boxvecs[0], boxvecs[1]), boxvecs[2]))
+        nrealatom = self.natoms
+        rho = nrealatom/vol
+
+        types, counts = np.unique(self.view_types(), return_counts=True)
+        ntypes = int(round(np.sqrt(len(hists[0])//bins[0])))
+
+        res = []
+        np.seterr(divide='ignore',invalid='ignore')
+        for b, hist in enumerate(hists):
+            #pairs are ordered, both ends are counted already
+            hist = np.array(hist, dtype='int64').reshape(ntypes, ntypes, bins[b])
+            delta = (cuts[b]-lows[b])/bins[b]
+            r = np.arange(bins[b])*delta+lows[b]
+            shell = 4*np.pi*r*r*rho
+            distri = hist/float(delta)
+            pdf = np.nan_to_num(distri.sum(axis=(0, 1))/(nrealatom*shell))
+            partials = {}
+            for ta, na in zip(types, counts):
+                for tb, nb in zip(types, counts):
+                    partials[(int(ta), int(tb))] = np.nan_to_num(distri[ta][tb]*nrealatom/(na*nb*shell))
+            res.append((pdf, partials, r))
+        return res
+
     def calculate_sf(self, pdf, r,precise): #precise=0 采用fft precise>0 在fft 的基础上更加细分q值，采用积分的方式，后者验证前者
 
         if(precise==0):
@@ -396,21 +517,87 @@ class System(pc.System):
             sf=(1-2*self.rho*T*T/N*np.imag(fft(r*(pdf-1)))/k)
             q=2*np.pi*k/T
         else:  
-            pdf=np.nan_to_num(np.array(pdf).reshape(len(pdf),1))
-            r=np.array(r).reshape(len(r),1)
+            pdf=np.nan_to_num(np.array(pdf,dtype=float).ravel())
+            r=np.array(r,dtype=float).ravel()
             self.get_rho_vol()
             N=len(r)
             dr=(r[2]-r[1])
             T=N*dr
             k=np.arange(N*precise)
-            k=np.array(k).reshape(len(k),1)
             q=2*np.pi*k/T/precise
             #sf=(1-2*self.rho*T*T/N*np.imag(fft(r*(pdf-1)))/k)
+            #the sine transform is summed in cpp, without the matrix of sin(q r)
             np.seterr(divide='ignore',invalid='ignore')
-            sf=1+4*np.pi*self.rho/q*(np.sin(q.dot(r.T)).dot(r*(pdf-1))*dr)
-            sf=sf
-            q=q
+            tr=np.array(self.get_sine_transform([list(r*(pdf-1)*dr)],r[0],dr,list(q),0)[0])
+            sf=(1+4*np.pi*self.rho/q*tr).reshape(len(q),1)
+            q=q.reshape(len(q),1)
         return sf,q
+
+    def calculate_structure_factors(self, q, histobins=1000, histomin=0.0, cut=10, window='lorch', weighting='fz', threadnum=10):
+        """
+        Calculate the total and partial structure factors from the partial
+        pair distributions, on any grid of wave numbers.
+
+        Parameters
+        ----------
+        q : list of floats
+            wave numbers, in inverse distance units
+
+        histobins : int, optional
+            number of bins of the pair histogram. Default 1000.
+
+        histomin : float, optional
+            lower end of the pair histogram, below which g(r) is taken
+            as zero. Default 0.0.
+
+        cut : float, optional
+            upper end of the pair histogram, and of the transform. It may be
+            larger than half the box. Default 10.
+
+        window : {'none', 'lorch', 'cosine'}, optional
+            window applied to g(r) - 1 before the transform, which damps
+            the ripples from the end of the range at cut. Default 'lorch'.
+
+        weighting : {'fz', 'bt'}, optional
+            'fz' gives the Faber-Ziman partials, 'bt' the Bhatia-Thornton
+            number and concentration ones, for systems with two types of
+            atoms. Default 'fz'.
+
+        threadnum : int, optional
+            number of threads taken from the shared thread pool. If 0,
+            :attr:`~glassviewer.core.System.nthreads` is used. Default 10.
+
+        Returns
+        -------
+        sf : array of floats
+            total structure factor, the sum of the Faber-Ziman partials
+            weighted with the products of the concentrations. For 'bt'
+            this is S_NN.
+        partials : dict or tuple
+            for 'fz' a dict with the partial of types a and b at key
+            (a, b), for all types present. For 'bt' the tuple (S_NC, S_CC).
+
+        """
+        if(histomin>=cut):
+            raise ValueError("value of histomin should be less than value of cut(which serves as histomax)")
+        if histomin <0:
+            raise ValueError("value of histomin should be not be negative")
+
+        q = np.array(q, dtype=float).ravel()
+        hist = self.get_pair_histograms([cut], [histomin], [histobins], threadnum)[0]
+        res = self.get_structure_factors(hist, histobins, histomin, cut, list(q), window, weighting, threadnum)
+        res = [np.array(x) for x in res]
+
+        if weighting == 'bt':
+            return res[0], (res[1], res[2])
+
+        ntypes = int(round(np.sqrt(len(hist)//histobins)))
+        types = np.unique(self.view_types())
+        partials = {}
+        for ta in types:
+            for tb in types:
+                partials[(int(ta), int(tb))] = res[1 + ta*ntypes + tb]
+        return res[0], partials
     
     def calculate_bad(self, histobins=100, histomin=0, histomax=np.pi):
         """
@@ -445,10 +632,6 @@ class System(pc.System):
         theta=np.arange(histobins)*delta+histomin
         distri=hist/float(delta)
         
-        nallatom = self.ntotal# 由于cpp采取扩胞的原子（real+ghost）进行运算，这里将缩放回最开始的原胞（real原子）
-        nrealatom=self.natoms#real
-        distri=distri/nallatom*nrealatom# 
-        
         Nisum=0
         for i in self.atoms:
             Ni=len(i.neighbors)
@@ -539,7 +722,7 @@ class System(pc.System):
             raise ValueError("value of threshold should be at least 1.00")
         if atomlist==[]:
             raise ValueError("atomlist could not be empty, if you want to calculate all atoms, please use 'find_neighbors'")
-        self.usecells =  (len(self.atoms) > 4000)
+        self.usecells =  (self.natoms > 4000)
         self.reset_allneighbors(atomlist)
         finished = self.get_all_neighbors_bynumber(threshold, nmax, True,atomlist)
         if not finished:
@@ -547,7 +730,7 @@ class System(pc.System):
 
     def find_neighbors(self, method='cutoff', cutoff=None, threshold=2, filter=None,
                                             voroexp=1, padding=1.2, nlimit=6, cells=False,
-                                                nmax=12, assign_neighbor=True):
+                                                nmax=12, assign_neighbor=True, half=False):
         """
 
         Find neighbors of all atoms in the :class:`~glassviewer.core.System`.
@@ -560,10 +743,12 @@ class System(pc.System):
             `number` method finds a specified number of closest neighbors to the given atom. Number only populates
             
 
-        cutoff : { float, 'sann', 'adaptive'}
+        cutoff : { float, 'sann', 'adaptive', array like}
             the cutoff distance to be used for the `cutoff` based neighbor calculation method described above.
             If the value is specified as 0 or `adaptive`, adaptive method is used.
             If the value is specified as `sann`, sann algorithm is used.
+            If the value is a symmetric matrix of size number of types x number of types, element `[a-1][b-1]`
+            is used as the cutoff between atoms of type `a` and `b`.
 
         threshold : float, optional
             only used if ``cutoff=adaptive``. A threshold which is used as safe limit for calculation of cutoff.
@@ -586,6 +771,10 @@ class System(pc.System):
 
         nmax : int, optional
             only used if ``cutoff=number``. The number of closest neighbors to be found for each atom. Default 12
+
+        half : bool, optional
+            only used if ``method=cutoff`` with a cutoff distance or matrix. Store every pair once in a compact
+            half list instead of the neighbor table of each atom. Default False.
         
 
         Returns
@@ -631,11 +820,31 @@ class System(pc.System):
         can be used to set this weight.
         
         If method os `number`, instead of using a cutoff value for finding neighbors, a specified number of closest atoms are
-        found. This number can be set through the argument `nmax`.
+        found. This number can be set through the argument `nmax`. The closest atoms are found exactly by searching
+        cells in growing shells around each atom, so `threshold` has no effect for this method.
+
+        The neighbor search runs on :attr:`~glassviewer.core.System.nthreads` threads, by default the number of
+        available cores. The result does not depend on the number of threads.
+
+        With ``half=True`` the neighbors take several times less memory, which is meant for very large systems. Only
+        the pair histogram, the bonds of the global bond order, solid bond counts and clustering can use the half
+        list, so the Steinhardt parameters have to be calculated with a full neighbor search before.
+
+        The `number`, `sann` and `adaptive` methods read their candidates from a neighbor index, which holds the
+        closest atoms of every atom sorted by distance. It is built once and only grows as needed, so that calling
+        several of these methods, or the cutoff method with a smaller cutoff, on the same configuration does not search
+        again. The index is thrown away when the positions or the box change.
+
+        For the frames of a trajectory, :attr:`~glassviewer.core.System.skin` can be set above zero. The cutoff method
+        then keeps a Verlet list of all atoms within cutoff + skin, and on later frames only the distances in it are
+        checked again. The list is built again only once an atom has moved more than half the skin, the number of
+        builds is in :attr:`~glassviewer.core.System.verlet_builds`. New positions of the same atoms are set with
+        ``sys.update_positions(positions)``, which keeps the lists, while a change of the box or of the number of
+        atoms throws them away. The half list is not affected by the skin.
 
         .. warning::
 
-            Adaptive and number cutoff uses a padding over the intial guessed "neighbor distance". By default it is 2. In case
+            Adaptive cutoff uses a padding over the intial guessed "neighbor distance". By default it is 2. In case
             of a warning that ``threshold`` is inadequate, this parameter should be further increased. High/low value
             of this parameter will correspond to the time taken for finding neighbors.
 
@@ -648,6 +857,8 @@ class System(pc.System):
         """
         #first reset all neighbors
         self.reset_allneighbors([])
+        self.set_pair_cutoffs([])
+        self.usehalf = 0
         self.filter = 0
 
         if filter == 'type':
@@ -658,10 +869,21 @@ class System(pc.System):
             self.filter = 2
 
         if method == 'cutoff':
-            if cutoff=='sann':
+            if (not isinstance(cutoff, str)) and (np.ndim(cutoff) == 2):
+                #one cutoff for every pair of types, the search
+                #goes up to the largest one
+                self.set_pair_cutoffs(np.asarray(cutoff, dtype=float).tolist())
+                if half:
+                    self.usehalf = 1
+                    self.get_half_neighbors_cells()
+                elif self.natoms > 2300:
+                    self.get_all_neighbors_cells()
+                else:
+                    self.get_all_neighbors_normal()
+            elif cutoff=='sann':
                 if threshold < 1:
                     raise ValueError("value of threshold should be at least 1.00")
-                self.usecells = (len(self.atoms) > 4000)
+                self.usecells = (self.natoms > 4000)
                 finished = self.get_all_neighbors_sann(threshold)
                 #if it finished without finding neighbors
                 if not finished:
@@ -692,7 +914,10 @@ class System(pc.System):
             else:
                 #warnings.warn("THIS RAN")
                 self.set_neighbordistance(cutoff)
-                if len(self.atoms) > 2300:
+                if half:
+                    self.usehalf = 1
+                    self.get_half_neighbors_cells()
+                elif self.natoms > 2300:
                 #if cells:
                     self.get_all_neighbors_cells()
                 else:
@@ -702,7 +927,7 @@ class System(pc.System):
             if threshold < 1:
                 raise ValueError("value of threshold should be at least 1.00")
 
-            self.usecells =  (len(self.atoms) > 4000)
+            self.usecells =  (self.natoms > 4000)
             finished = self.get_all_neighbors_bynumber(threshold, nmax, assign_neighbor,[])
             if not finished:
                 raise RuntimeError("Could not find enough neighbors - try increasing threshold")
@@ -1004,16 +1229,20 @@ class System(pc.System):
                     raise RuntimeError("condition did not work")
             
             #now loop
-            atoms = self.atoms
-
-            if isatomattr:
-                for atom in atoms:
-                    atom.condition = self.get_custom(atom, [condition])[0]
+            if isatomattr and (condition in self.custom_keys()):
+                #custom values are set in C++ directly
+                self.cset_condition_custom(condition)
             else:
-                for atom in atoms:
-                    cval = condition(atom)
-                    atom.condition = cval
-            self.atoms = atoms
+                atoms = self.atoms
+
+                if isatomattr:
+                    for atom in atoms:
+                        atom.condition = self.get_custom(atom, [condition])[0]
+                else:
+                    for atom in atoms:
+                        cval = condition(atom)
+                        atom.condition = cval
+                self.atoms = atoms
 
         if clear_condition:
             atoms = self.atoms
@@ -1249,17 +1478,21 @@ class System(pc.System):
                 raise RuntimeError("condition did not work")
         
         #now loop
-        atoms = self.atoms
-
-        if isatomattr:
-            for atom in atoms:
-                atom.condition = self.get_custom(atom, [condition])[0]
+        if isatomattr and (condition in self.custom_keys()):
+            #custom values are set in C++ directly
+            self.cset_condition_custom(condition)
         else:
-            for atom in atoms:
-                cval = condition(atom)
-                atom.condition = cval
-        
-        self.atoms = atoms
+            atoms = self.atoms
+
+            if isatomattr:
+                for atom in atoms:
+                    atom.condition = self.get_custom(atom, [condition])[0]
+            else:
+                for atom in atoms:
+                    cval = condition(atom)
+                    atom.condition = cval
+            
+            self.atoms = atoms
         self.cfind_clusters_recursive(cutoff)
 
         #done!
@@ -1945,6 +2178,42 @@ class System(pc.System):
             return etaAB_normalized
 
 
+    def get_custom_values(self, key):
+        """
+        Get a custom value of all atoms
+
+        Parameters
+        ----------
+        key : string
+            custom key
+
+        Returns
+        -------
+        vals : numpy array or list
+            custom values of all atoms. Int and float values are returned as a read only numpy
+            array which shares memory with the system, strings and lists as a list. Use
+            :func:`~glassviewer.core.System.set_custom_values` to change them.
+        """
+        return self.cget_custom(key)
+
+    def set_custom_values(self, key, vals):
+        """
+        Set a custom value for all atoms
+
+        Parameters
+        ----------
+        key : string
+            custom key
+
+        vals : array like
+            values of length natoms, ints, floats or strings
+
+        Returns
+        -------
+        None
+        """
+        self.cset_custom(key, np.asarray(vals))
+
     def get_custom(self, atom, customkeys):
         """
         Get a custom attribute from Atom
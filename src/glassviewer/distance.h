@@ -0,0 +1,216 @@
+#ifndef GLASSVIEWER_DISTANCE_H
+#define GLASSVIEWER_DISTANCE_H
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+/*
+Batched distance kernels for the pair loops. One center is compared with a
+contiguous block of positions. The squared distances of the whole block are
+worked out first in a loop without branches, which the compiler turns into
+vector instructions, and the members closer than the cutoff are then picked
+out with a branch free compaction. No sqrt is taken, that is left to the
+caller for the pairs which are kept.
+*/
+
+//largest block handled in one call, callers keep buffers of this size
+const int DIST_BLOCK = 64;
+
+/*
+Squared distances of the points x[i]+tx, y[i]+ty, z[i]+tz for i in [0, n)
+into dsq. The indices of the points with dsq below cutsq are written in
+order to hit, and their number is returned.
+*/
+inline int block_within(const double *x, const double *y, const double *z, int n,
+    double tx, double ty, double tz, double cutsq, double *dsq, int *hit){
+
+    double dx, dy, dz;
+    int m = 0;
+
+    for(int i=0; i<n; i++){
+        dx = x[i] + tx;
+        dy = y[i] + ty;
+        dz = z[i] + tz;
+        dsq[i] = dx*dx + dy*dy + dz*dz;
+    }
+    for(int i=0; i<n; i++){
+        hit[m] = i;
+        m += (dsq[i] < cutsq);
+    }
+    return m;
+}
+
+/*
+Box policies for the pair kernels. A kernel works on coordinates given by
+the policy, coords converts a position to them once per call, and image
+turns the difference of two such coordinates into the vector to the
+nearest periodic image. Kernels are written once as templates on the
+policy, and the policy is picked once per call, see System::with_box, so
+that the loops over pairs do not branch on the shape of the box.
+*/
+
+//orthogonal box, the coordinates are cartesian and each
+//component is wrapped with rint, il is zero along directions
+//which are not periodic so that they are never wrapped
+struct OrthogonalBox{
+    double l[3];
+    double il[3];
+
+    void coords(double x, double y, double z, double &u, double &v, double &w) const {
+        u = x;
+        v = y;
+        w = z;
+    }
+    void image(double &dx, double &dy, double &dz) const {
+        dx -= l[0]*rint(dx*il[0]);
+        dy -= l[1]*rint(dy*il[1]);
+        dz -= l[2]*rint(dz*il[2]);
+    }
+};
+
+/*
+Triclinic box, the coordinates are fractional. h[i] is box vector i, best
+a reduced basis of the box lattice, and hinv the inverse of the matrix with
+the box vectors as columns. wrap is 1 along periodic directions and 0 along
+the others, which should be normal to the periodic ones. A difference is
+wrapped in fractional space, taken back with the box vectors and then
+compared with its shifts by the lattice vectors in shift. set keeps only
+the shifts which can give a shorter vector for some wrapped difference,
+so that the result is always the nearest image, however sheared the
+box is.
+*/
+struct TriclinicBox{
+    double h[3][3];
+    double hinv[3][3];
+    double wrap[3] = {1, 1, 1};
+    vector<double> shift;
+    int nshift = 0;
+
+    void set(const double lat[3][3], const double inv[3][3], const double heights[3], const bool periodic[3]){
+
+        double corner[8][3], v[3];
+        double wmax = 0, vv, pv, lowest;
+        int lim[3];
+
+        for(int i=0; i<3; i++){
+            for(int j=0; j<3; j++){
+                h[i][j] = lat[i][j];
+                hinv[i][j] = inv[i][j];
+            }
+            wrap[i] = (periodic[i]) ? 1 : 0;
+        }
+
+        //a wrapped difference lies in the cell spanned by the periodic box
+        //vectors around the origin, the corners are the longest ones. The
+        //other directions are normal to it and do not change which image
+        //is nearest
+        for(int c=0; c<8; c++){
+            for(int a=0; a<3; a++){
+                corner[c][a] = 0.5*(((c&1) ? 1 : -1)*wrap[0]*h[0][a] + ((c&2) ? 1 : -1)*wrap[1]*h[1][a]
+                    + ((c&4) ? 1 : -1)*wrap[2]*h[2][a]);
+            }
+            wmax = max(wmax, sqrt(corner[c][0]*corner[c][0] + corner[c][1]*corner[c][1] + corner[c][2]*corner[c][2]));
+        }
+
+        //the nearest image is no longer than the wrapped one, which
+        //bounds the number of box vectors it can be away along each
+        //direction
+        shift.clear();
+        nshift = 0;
+        for(int a=0; a<3; a++){
+            lim[a] = (periodic[a] && (heights[a] > 0)) ? (int)floor(wmax/heights[a] + 0.5) : 0;
+        }
+        for(int ni=-lim[0]; ni<=lim[0]; ni++){
+            for(int nj=-lim[1]; nj<=lim[1]; nj++){
+                for(int nk=-lim[2]; nk<=lim[2]; nk++){
+                    if ((ni == 0) && (nj == 0) && (nk == 0)) continue;
+                    for(int a=0; a<3; a++){
+                        v[a] = ni*h[0][a] + nj*h[1][a] + nk*h[2][a];
+                    }
+                    //w + v is shorter than w where 2 w.v + v.v < 0, which
+                    //is smallest at one of the corners of the cell
+                    vv = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+                    lowest = vv;
+                    for(int c=0; c<8; c++){
+                        pv = corner[c][0]*v[0] + corner[c][1]*v[1] + corner[c][2]*v[2];
+                        lowest = min(lowest, 2.0*pv + vv);
+                    }
+                    if (lowest < -1E-12*vv){
+                        shift.push_back(v[0]);
+                        shift.push_back(v[1]);
+                        shift.push_back(v[2]);
+                        nshift++;
+                    }
+                }
+            }
+        }
+    }
+
+    void coords(double x, double y, double z, double &u, double &v, double &w) const {
+        u = hinv[0][0]*x + hinv[0][1]*y + hinv[0][2]*z;
+        v = hinv[1][0]*x + hinv[1][1]*y + hinv[1][2]*z;
+        w = hinv[2][0]*x + hinv[2][1]*y + hinv[2][2]*z;
+    }
+    void image(double &dx, double &dy, double &dz) const {
+        double fx = dx - wrap[0]*rint(dx);
+        double fy = dy - wrap[1]*rint(dy);
+        double fz = dz - wrap[2]*rint(dz);
+        double wx, wy, wz, x, y, z, dsq, best;
+        wx = fx*h[0][0] + fy*h[1][0] + fz*h[2][0];
+        wy = fx*h[0][1] + fy*h[1][1] + fz*h[2][1];
+        wz = fx*h[0][2] + fy*h[1][2] + fz*h[2][2];
+        dx = wx;
+        dy = wy;
+        dz = wz;
+        best = wx*wx + wy*wy + wz*wz;
+        for(int k=0; k<nshift; k++){
+            x = wx + shift[3*k];
+            y = wy + shift[3*k+1];
+            z = wz + shift[3*k+2];
+            dsq = x*x + y*y + z*z;
+            if (dsq < best){
+                best = dsq;
+                dx = x;
+                dy = y;
+                dz = z;
+            }
+        }
+    }
+};
+
+/*
+Same as block_within for a periodic box. u, v, w are coordinates of the
+box policy and cu, cv, cw those of the center. The vectors to the nearest
+images are kept in dx, dy, dz. Every pair is seen once, so only one image
+of each may be within the cutoff, which holds if the cutoff is below half
+of every height of a reduced box.
+*/
+template <typename Box>
+inline int block_within_box(const Box &box, const double *u, const double *v, const double *w, int n,
+    double cu, double cv, double cw, double cutsq,
+    double *dx, double *dy, double *dz, double *dsq, int *hit){
+
+    double x, y, z;
+    int m = 0;
+
+    for(int i=0; i<n; i++){
+        x = u[i] - cu;
+        y = v[i] - cv;
+        z = w[i] - cw;
+        box.image(x, y, z);
+        dx[i] = x;
+        dy[i] = y;
+        dz[i] = z;
+        dsq[i] = x*x + y*y + z*z;
+    }
+    for(int i=0; i<n; i++){
+        hit[m] = i;
+        m += (dsq[i] < cutsq);
+    }
+    return m;
+}
+
+#endif
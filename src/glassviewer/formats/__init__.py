@@ -0,0 +1,31 @@
+import numpy as np
+import glassviewer.catom as pca
+
+def arrays_to_atoms(data, locstart=0):
+    """
+    Create a list of `Atom` objects from the arrays returned by the `read_arrays`
+    functions of the format modules.
+
+    Parameters
+    ----------
+    data : dict
+        dict with keys `positions`, `types`, `ids` and `custom`
+
+    locstart : int, optional
+        loc value of the first atom, default 0
+
+    Returns
+    -------
+    atoms : list of `Atom` objects
+    """
+    atoms = []
+    custom = data["custom"]
+    for count, position in enumerate(data["positions"]):
+        atom = pca.Atom()
+        atom.pos = list(position)
+        atom.id = int(data["ids"][count])
+        atom.type = int(data["types"][count])
+        atom.loc = count + locstart
+        atom.custom = { key:val[count] for key, val in custom.items() }
+        atoms.append(atom)
+    return atoms
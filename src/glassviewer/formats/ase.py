@@ -1,24 +1,30 @@
 import numpy as np
 import gzip
 import glassviewer.catom as pca
+from glassviewer.formats import arrays_to_atoms
 from ase import Atom, Atoms
 import gzip
 import io
 import os
 
 #new function to wrap over ase objects
-def read_snap(aseobject, check_triclinic=False):
+def read_arrays(aseobject):
     """
-    Function to read from a ASE atoms objects
+    Function to read from a ASE atoms objects into arrays
 
     Parameters
     ----------
     aseobject : ASE Atoms object
         name of the ASE atoms object
 
-    triclinic : bool, optional
-        True if the configuration is triclinic
+    Returns
+    -------
+    data : dict
+        dict with the keys `positions` (natoms x 3 array), `types`, `ids` and `custom`. The
+        chemical symbols are stored as custom key `species`.
 
+    box : list of list of floats
+        the box vectors
     """
     #We have to process atoms and atomic objects from ase
     #Known issues lammps -dump modified format
@@ -31,24 +37,29 @@ def read_snap(aseobject, check_triclinic=False):
 
     #box and box dims are set. Now handle atoms
     chems = np.array(aseobject.get_chemical_symbols())
-    atomsymbols = np.unique(aseobject.get_chemical_symbols())
-    atomtypes = np.array(range(1, len(atomsymbols)+1))
-    typedict = dict(zip(atomsymbols, atomtypes))
-
-    #now start parsing atoms
-    atoms = []
-    positions = aseobject.positions
-    for count, position in enumerate(positions):
-        atom = pca.Atom()
-        atom.pos = list(position)
-        atom.id = (count+1)
-        atom.type = typedict[chems[count]]
-        atom.loc = count
-
-        customdict = {'species': chems[count]}
-        atom.custom = customdict
-        atoms.append(atom)
+    atomsymbols, types = np.unique(chems, return_inverse=True)
 
+    positions = np.array(aseobject.positions, dtype=float)
+    data = {"positions": positions, "types": types+1, 
+            "ids": np.arange(1, len(positions)+1), "custom": {'species': chems}}
+
+    return data, box
+
+def read_snap(aseobject, check_triclinic=False):
+    """
+    Function to read from a ASE atoms objects
+
+    Parameters
+    ----------
+    aseobject : ASE Atoms object
+        name of the ASE atoms object
+
+    triclinic : bool, optional
+        True if the configuration is triclinic
+
+    """
+    data, box = read_arrays(aseobject)
+    atoms = arrays_to_atoms(data)
     return atoms, box
 
 def write_snap(**kwargs):
@@ -2,15 +2,28 @@ from multiprocessing.sharedctypes import Value
 import numpy as np
 import gzip
 import glassviewer.catom as pca
+from glassviewer.formats import arrays_to_atoms
 from ase import Atom, Atoms
 import gzip
 import io
 import os
+import itertools
 
 #functions that are not wrapped from C++
-def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None):
+def typed_column(col):
     """
-    Function to read a lammps dump file format - single time slice.
+    Convert a column of strings to ints or floats if possible
+    """
+    for dtype in (int, float):
+        try:
+            return col.astype(dtype)
+        except ValueError:
+            pass
+    return col
+
+def read_arrays(infile, compressed = False, customkeys=None):
+    """
+    Function to read a lammps dump file format - single time slice - into arrays.
 
     Parameters
     ----------
@@ -21,51 +34,30 @@ def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None
         force to read a `gz` zipped file. If the filename ends with `.gz`, use of this keyword is not
         necessary. Default True.
 
-    check_triclinic : bool, optional
-        If true check if the sim box is triclinic. Default False.
-
     customkeys : list of strings, optional
         A list of extra keywords to read from trajectory file.
 
     Returns
     -------
-    atoms : list of `Atom` objects
-        list of all atoms as created by user input
-
-    boxdims : list of list of floats
-        The dimensions of the box. This is of the form `[[xlo, xhi],[ylo, yhi],[zlo, zhi]]` where `lo` and `hi` are
-        the upper and lower bounds of the simulation box along each axes. For triclinic boxes, this is scaled to
-        `[0, scalar length of the vector]`.
+    data : dict
+        dict with the keys `positions` (natoms x 3 array), `types`, `ids` and `custom`, which is
+        a dict of customkey : array of values. Custom columns are read as ints or floats if possible,
+        otherwise as strings.
 
     box : list of list of floats
-        list of the type `[[x1, x2, x3], [y1, y2, y3], [zz1, z2, z3]]` which are the box vectors. Only returned if
-        `box_vectors` is set to True.
+        list of the type `[[x1, x2, x3], [y1, y2, y3], [zz1, z2, z3]]` which are the box vectors.
 
     triclinic : bool
-        True if the box is triclinic. Only returned if `check_triclinic` is set to True
-
-    .. note::
-
-        Values are always returned in the order `atoms, boxdims, box, triclinic` if all
-        return keywords are selected. For example, ff `check_triclinic` is not selected, the return
-        values would still preserve the order and fall back to  `atoms, boxdims, box`.
+        True if the box is triclinic.
 
     Notes
     -----
-    Read a lammps-dump style snapshot that can have variable headers, reads in type and so on.
-    Zipped files which end with a `.gz` can also be read automatically. However, if the file does not
-    end with a `.gz` extension, keyword `compressed = True` can also be used.
-
-    Examples
-    --------
-    >>> atoms, box = read_lammps_dump('conf.dump')
-    >>> atoms, box = read_lammps_dump('conf.dump.gz')
-    >>> atoms, box = read_lammps_dump('conf.d', compressed=True)
-
+    No `Atom` objects are created, the arrays can be passed to
+    :func:`~glassviewer.core.System.from_arrays` directly.
     """
     if isinstance(infile, list):
         islist = True
-        f = infile
+        f = iter(infile)
     else:
         islist = False
 
@@ -82,11 +74,9 @@ def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None
     if customkeys == None:
         customkeys = []
 
-    #now go through the file line by line
+    #now go through the header line by line
     paramsread = False
-    atoms = []
     triclinic = False
-    volume_fraction = 1.00
 
     #now if custokeys are provided - read those in too
     customread = False
@@ -94,14 +84,12 @@ def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None
     if customlength > 0:
         customread = True
 
-    nblock = 0
     for count, line in enumerate(f):
         #print(count, line)
         if not paramsread:
             #atom numer is at line 3
             if count == 3:
                 natoms = int(line.strip())
-                nblock = natoms+9
             #box dims in lines 5,6,7
             elif count == 5:
                 raw = line.strip().split()
@@ -140,37 +128,28 @@ def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None
                     headerdict["z"] = headerdict.pop("zs")
                 else:
                     raise ValueError("only x/xs, y/ys andz/zs keys are allowed for traj file")
-
-
-        else:
-            if count == nblock:
                 break
-            raw = line.strip().split()
-            idd = int(raw[headerdict["id"]])
-            typ = int(raw[headerdict["type"]])
-            x = float(raw[headerdict["x"]])
-            y = float(raw[headerdict["y"]])
-            z = float(raw[headerdict["z"]])
-
-            atom = pca.Atom()
-            atom.pos = [x, y, z]
-            atom.id = idd
-            atom.type = typ
-            atom.loc = count-8
-
-            customdict = {}
-            #if customkeys need to be read, do it
-            if customread:
-                for cc, kk in enumerate(customkeys):
-                    customdict[kk] = raw[headerdict[kk]]
-
-            atom.custom = customdict
-            atoms.append(atom)
+
+    #the atom block follows the header, it is parsed column wise by numpy
+    lines = list(itertools.islice(f, natoms))
 
     #close files
     if not islist:
         f.close()
 
+    if len(lines) == 0:
+        ids = np.zeros(0, dtype=int)
+        types = np.zeros(0, dtype=int)
+        positions = np.zeros((0, 3))
+        custom = { kk:np.zeros(0) for kk in customkeys }
+    else:
+        ids, types = np.loadtxt(lines, dtype=int, usecols=(headerdict["id"], headerdict["type"]),
+                                    ndmin=2, unpack=True)
+        positions = np.loadtxt(lines, dtype=float, usecols=(headerdict["x"], headerdict["y"],
+                                    headerdict["z"]), ndmin=2)
+        custom = { kk:typed_column(np.loadtxt(lines, dtype=str, usecols=(headerdict[kk],), ndmin=1))
+                    for kk in customkeys }
+
     if triclinic:
         #process triclinic box
         amin = min([0.0, tilts[0], tilts[1] ,tilts[0]+tilts[1]])
@@ -189,14 +168,10 @@ def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None
         b = np.array([tilts[0], yhi-ylo, 0])
         c = np.array([tilts[1], tilts[2], zhi-zlo])
 
-        rot = np.array([a, b, c]).T
-        rotinv = np.linalg.inv(rot)
         ortho_origin = np.array([boxx[0], boxy[0], boxz[0]])
 
-        for atom in atoms:
-            #correct zero of the atomic positions (shift box to origin)
-            dist = np.array(atom.pos) - ortho_origin
-            atom.pos = dist
+        #correct zero of the atomic positions (shift box to origin)
+        positions = positions - ortho_origin
 
         #finally change boxdims - to triclinic box size
         box = np.array([a, b, c])
@@ -205,10 +180,70 @@ def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None
 
     #adjust for scled coordinates
     if scaled:
-        for atom in atoms:
-            dist = atom.pos
-            ndist = dist[0]*box[0] + dist[1]*box[1] + dist[2]*box[2]
-            atom.pos = ndist
+        positions = np.dot(positions, box)
+
+    data = {"positions": positions, "types": types, "ids": ids, "custom": custom}
+    return data, box, triclinic
+
+
+def read_snap(infile, compressed = False, check_triclinic=False, customkeys=None):
+    """
+    Function to read a lammps dump file format - single time slice.
+
+    Parameters
+    ----------
+    infile : string
+        name of the input file
+
+    compressed : bool, optional
+        force to read a `gz` zipped file. If the filename ends with `.gz`, use of this keyword is not
+        necessary. Default True.
+
+    check_triclinic : bool, optional
+        If true check if the sim box is triclinic. Default False.
+
+    customkeys : list of strings, optional
+        A list of extra keywords to read from trajectory file.
+
+    Returns
+    -------
+    atoms : list of `Atom` objects
+        list of all atoms as created by user input
+
+    boxdims : list of list of floats
+        The dimensions of the box. This is of the form `[[xlo, xhi],[ylo, yhi],[zlo, zhi]]` where `lo` and `hi` are
+        the upper and lower bounds of the simulation box along each axes. For triclinic boxes, this is scaled to
+        `[0, scalar length of the vector]`.
+
+    box : list of list of floats
+        list of the type `[[x1, x2, x3], [y1, y2, y3], [zz1, z2, z3]]` which are the box vectors. Only returned if
+        `box_vectors` is set to True.
+
+    triclinic : bool
+        True if the box is triclinic. Only returned if `check_triclinic` is set to True
+
+    .. note::
+
+        Values are always returned in the order `atoms, boxdims, box, triclinic` if all
+        return keywords are selected. For example, ff `check_triclinic` is not selected, the return
+        values would still preserve the order and fall back to  `atoms, boxdims, box`.
+
+    Notes
+    -----
+    Read a lammps-dump style snapshot that can have variable headers, reads in type and so on.
+    Zipped files which end with a `.gz` can also be read automatically. However, if the file does not
+    end with a `.gz` extension, keyword `compressed = True` can also be used. This is a wrapper
+    around :func:`read_arrays` which creates an `Atom` for each row.
+
+    Examples
+    --------
+    >>> atoms, box = read_lammps_dump('conf.dump')
+    >>> atoms, box = read_lammps_dump('conf.dump.gz')
+    >>> atoms, box = read_lammps_dump('conf.d', compressed=True)
+
+    """
+    data, box, triclinic = read_arrays(infile, compressed=compressed, customkeys=customkeys)
+    atoms = arrays_to_atoms(data, locstart=1)
 
     if check_triclinic:
         return atoms, box, triclinic
@@ -1,24 +1,30 @@
 import numpy as np
 import gzip
 import glassviewer.catom as pca
+from glassviewer.formats import arrays_to_atoms
 from ase import Atom, Atoms
 import gzip
 import io
 import os
 
 #new function to wrap over mdtraj objects
-def read_snap(mdobject, check_triclinic=False):
+def read_arrays(mdobject):
     """
-    Function to read from an MDTraj atoms objects
+    Function to read from an MDTraj atoms objects into arrays
 
     Parameters
     ----------
     mdobject : MDTraj Atoms object
         name of the MDTraj atoms object
 
-    triclinic : bool, optional
-        True if the configuration is triclinic
+    Returns
+    -------
+    data : dict
+        dict with the keys `positions` (natoms x 3 array), `types`, `ids` and `custom`. The
+        atom names are stored as custom key `species`.
 
+    box : list of list of floats
+        the box vectors
     """
     #We have to process atoms and atomic objects from ase
     #Known issues lammps -dump modified format
@@ -31,24 +37,29 @@ def read_snap(mdobject, check_triclinic=False):
 
     #box and box dims are set. Now handle atoms
     chems = np.array([atom.name for atom in mdobject.topology.atoms])
-    atomsymbols = np.unique(chems)
-    atomtypes = np.array(range(1, len(atomsymbols)+1))
-    typedict = dict(zip(atomsymbols, atomtypes))
-
-    #now start parsing atoms
-    atoms = []
-    positions = mdobject.xyz[0]
-    for count, position in enumerate(positions):
-        atom = pca.Atom()
-        atom.pos = list(position)
-        atom.id = count+1
-        atom.type = typedict[chems[count]]
-        atom.loc = count
-
-        customdict = {'species': chems[count]}
-        atom.custom = customdict
-        atoms.append(atom)
+    atomsymbols, types = np.unique(chems, return_inverse=True)
+
+    positions = np.array(mdobject.xyz[0], dtype=float)
+    data = {"positions": positions, "types": types+1, 
+            "ids": np.arange(1, len(positions)+1), "custom": {'species': chems}}
+
+    return data, box
+
+def read_snap(mdobject, check_triclinic=False):
+    """
+    Function to read from an MDTraj atoms objects
 
+    Parameters
+    ----------
+    mdobject : MDTraj Atoms object
+        name of the MDTraj atoms object
+
+    triclinic : bool, optional
+        True if the configuration is triclinic
+
+    """
+    data, box = read_arrays(mdobject)
+    atoms = arrays_to_atoms(data)
     return atoms, box
 
 def write_snap(**kwargs):
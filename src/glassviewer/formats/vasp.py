@@ -12,6 +12,31 @@ import warnings
 
  
 
+def read_arrays(infile, compressed = False):
+    """
+    Function to read a POSCAR format into arrays.
+
+    Parameters
+    ----------
+    infile : string
+        name of the input file
+
+    compressed : bool, optional
+        force to read a `gz` zipped file. If the filename ends with `.gz`, use of this keyword is not
+        necessary, Default False
+
+    Returns
+    -------
+    data : dict
+        dict with the keys `positions` (natoms x 3 array), `types`, `ids` and `custom`
+
+    box : list of list of floats
+        the box vectors
+    """
+    aseobj = read(infile, format="vasp",parallel=False)
+    return ptase.read_arrays(aseobj)
+
+
 def read_snap(infile, compressed = False):
     """
     Function to read a POSCAR format.
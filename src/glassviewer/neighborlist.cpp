@@ -0,0 +1,603 @@
+#include "neighborlist.h"
+#include "parallel.h"
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+
+//-----------------------------------------------------
+// Neighbor list
+//-----------------------------------------------------
+void NeighborList::check_views(int nop, int nb) const {
+    //offsets, index and dist are only moved if they have to grow
+    //beyond their capacity
+    if (views.use_count() == 1) return;
+    if ((nop+1 > offsets.capacity()) || (nb > index.capacity()) || (nb > dist.capacity()))
+        throw invalid_argument("neighbors can not be changed while views on them exist, delete the views first");
+}
+
+void NeighborList::reset(int nop){
+    check_views(nop, 0);
+    offsets.assign(nop+1, 0);
+    index.clear();
+    dist.clear();
+    weight.clear();
+    diffx.clear();
+    diffy.clear();
+    diffz.clear();
+    r.clear();
+    phi.clear();
+    theta.clear();
+    sij.clear();
+    facevertices.clear();
+    faceperimeters.clear();
+    cna.clear();
+}
+
+void NeighborList::reserve(int nb){
+    check_views(offsets.size()-1, nb);
+    index.reserve(nb);
+    dist.reserve(nb);
+    weight.reserve(nb);
+    diffx.reserve(nb);
+    diffy.reserve(nb);
+    diffz.reserve(nb);
+    sij.reserve(nb);
+}
+
+//splice template used by replace_row for every per bond array
+template <typename T>
+static void splice_row(vector<T> &col, int start, int oldn, const vector<T> &vals, int newn, T fill){
+    vector<T> row(newn, fill);
+    for(int i=0; (i<newn) && (i<vals.size()); i++){
+        row[i] = vals[i];
+    }
+    col.erase(col.begin()+start, col.begin()+start+oldn);
+    col.insert(col.begin()+start, row.begin(), row.end());
+}
+
+void NeighborList::replace_row(int ti, const vector<int> &nidx, const vector<double> &nd,
+    const vector<double> &nw, const vector<double> &dx, const vector<double> &dy,
+    const vector<double> &dz, const vector<double> &nsij){
+    /*
+    Replace the neighbors of a single atom. If the number of neighbors is
+    unchanged, the values are overwritten in place, otherwise the row is
+    spliced in and all later offsets are shifted.
+    */
+    int start = offsets[ti];
+    int oldn = count(ti);
+    int newn = nidx.size();
+    bool angles = has_angles();
+    double rr, pp, tt;
+
+    if (oldn != newn){
+        check_views(offsets.size()-1, nbonds()-oldn+newn);
+        splice_row(index, start, oldn, nidx, newn, int(NILVALUE));
+        splice_row(dist, start, oldn, nd, newn, -1.0);
+        splice_row(weight, start, oldn, nw, newn, 1.00);
+        splice_row(diffx, start, oldn, dx, newn, 0.0);
+        splice_row(diffy, start, oldn, dy, newn, 0.0);
+        splice_row(diffz, start, oldn, dz, newn, 0.0);
+        if (angles){
+            splice_row(r, start, oldn, vector<double>(), newn, 0.0);
+            splice_row(phi, start, oldn, vector<double>(), newn, 0.0);
+            splice_row(theta, start, oldn, vector<double>(), newn, 0.0);
+        }
+        splice_row(sij, start, oldn, nsij, newn, -1.0);
+        //face and cna values can not be kept consistent for a single row
+        facevertices.clear();
+        faceperimeters.clear();
+        cna.clear();
+        for(int i=ti+1; i<offsets.size(); i++){
+            offsets[i] += newn - oldn;
+        }
+    }
+    else{
+        for(int i=0; i<newn; i++){
+            index[start+i] = nidx[i];
+            if (i < nd.size()) dist[start+i] = nd[i];
+            if (i < nw.size()) weight[start+i] = nw[i];
+            if (i < dx.size()) diffx[start+i] = dx[i];
+            if (i < dy.size()) diffy[start+i] = dy[i];
+            if (i < dz.size()) diffz[start+i] = dz[i];
+            if (i < nsij.size()) sij[start+i] = nsij[i];
+        }
+    }
+
+    //spherical coordinates always follow the distance vectors,
+    //if they are not there yet they are left for ensure_angles
+    if (!angles) return;
+    for(int i=start; i<start+newn; i++){
+        rr = sqrt(diffx[i]*diffx[i] + diffy[i]*diffy[i] + diffz[i]*diffz[i]);
+        tt = (rr > 0) ? acos(diffz[i]/rr) : 0.0;
+        pp = atan2(diffy[i], diffx[i]);
+        r[i] = rr;
+        phi[i] = pp;
+        theta[i] = tt;
+    }
+}
+
+void NeighborList::ensure_angles(int nthreads){
+    /*
+    Fill r, phi, theta from the distance vectors of all bonds. Nothing
+    is done if they are already there, every change of the vectors
+    through build or reset drops them again.
+    */
+    if (has_angles()) return;
+    int nb = nbonds();
+    r.resize(nb);
+    phi.resize(nb);
+    theta.resize(nb);
+
+    parallel_for(nb, nthreads, [&](int start, int stop, int tid){
+        double rr;
+        for(int i=start; i<stop; i++){
+            rr = sqrt(diffx[i]*diffx[i] + diffy[i]*diffy[i] + diffz[i]*diffz[i]);
+            r[i] = rr;
+            theta[i] = (rr > 0) ? acos(diffz[i]/rr) : 0.0;
+            phi[i] = atan2(diffy[i], diffx[i]);
+        }
+    });
+}
+
+//-----------------------------------------------------
+// Neighbor builder
+//-----------------------------------------------------
+void NeighborBuilder::clear(){
+    bonds.clear();
+    faces = false;
+}
+
+void NeighborBuilder::seed(const NeighborList &nl, const vector<char> &skip){
+    /*
+    Start from an existing list so that new neighbors are appended
+    to the existing ones, rows marked in skip are dropped.
+    */
+    clear();
+    int nop = int(nl.offsets.size()) - 1;
+    bool hasfaces = nl.has_faces() && (nl.nbonds() > 0);
+    bonds.reserve(nl.nbonds());
+    for(int ti=0; ti<nop; ti++){
+        if ((skip.size() > 0) && skip[ti]) continue;
+        for(int i=nl.begin(ti); i<nl.end(ti); i++){
+            if (hasfaces)
+                add_face(ti, nl.index[i], nl.dist[i], nl.diffx[i], nl.diffy[i], nl.diffz[i], nl.weight[i], nl.facevertices[i], nl.faceperimeters[i]);
+            else
+                add(ti, nl.index[i], nl.dist[i], nl.diffx[i], nl.diffy[i], nl.diffz[i], nl.weight[i]);
+        }
+    }
+}
+
+void NeighborBuilder::merge(vector<NeighborBuilder> &parts){
+    /*
+    Append the pairs collected by several builders, for example one per
+    thread, in the order of the parts. The parts are cleared.
+    */
+    size_t nb = bonds.size();
+    for(int i=0; i<parts.size(); i++){
+        nb += parts[i].bonds.size();
+    }
+    bonds.reserve(nb);
+    for(int i=0; i<parts.size(); i++){
+        bonds.insert(bonds.end(), parts[i].bonds.begin(), parts[i].bonds.end());
+        faces = faces || parts[i].faces;
+        parts[i].clear();
+    }
+}
+
+void NeighborBuilder::build(NeighborList &nl, int nop){
+
+    int nb = bonds.size();
+    int pos;
+
+    //count the neighbors of each atom, then prefix sum
+    vector<int> offsets(nop+1, 0);
+    for(int i=0; i<nb; i++){
+        offsets[bonds[i].ti+1]++;
+    }
+    for(int ti=0; ti<nop; ti++){
+        offsets[ti+1] += offsets[ti];
+    }
+
+    nl.check_views(nop, nb);
+    nl.reset(nop);
+    nl.offsets = offsets;
+    nl.index.resize(nb);
+    nl.dist.resize(nb);
+    nl.weight.resize(nb);
+    nl.diffx.resize(nb);
+    nl.diffy.resize(nb);
+    nl.diffz.resize(nb);
+    nl.sij.assign(nb, -1.0);
+    if (faces){
+        nl.facevertices.resize(nb);
+        nl.faceperimeters.resize(nb);
+    }
+
+    //scatter, the running offsets keep the insertion order per atom
+    for(int i=0; i<nb; i++){
+        const bond &b = bonds[i];
+        pos = offsets[b.ti]++;
+        nl.index[pos] = b.tj;
+        nl.dist[pos] = b.d;
+        nl.weight[pos] = b.w;
+        nl.diffx[pos] = b.dx;
+        nl.diffy[pos] = b.dy;
+        nl.diffz[pos] = b.dz;
+        if (faces){
+            nl.facevertices[pos] = b.fv;
+            nl.faceperimeters[pos] = b.fp;
+        }
+    }
+
+    clear();
+}
+
+//-----------------------------------------------------
+// Candidate list
+//-----------------------------------------------------
+void CandidateList::reset(int nop){
+    offsets.assign(nop+1, 0);
+    items.clear();
+}
+
+void CandidateList::remove_rows(const vector<char> &skip){
+
+    int nop = int(offsets.size()) - 1;
+    vector<int> noffsets(nop+1, 0);
+    vector<datom> nitems;
+    nitems.reserve(items.size());
+
+    for(int ti=0; ti<nop; ti++){
+        if (!skip[ti]){
+            for(int i=offsets[ti]; i<offsets[ti+1]; i++){
+                nitems.emplace_back(items[i]);
+            }
+        }
+        noffsets[ti+1] = nitems.size();
+    }
+    offsets.swap(noffsets);
+    items.swap(nitems);
+}
+
+void CandidateList::merge(const vector<int> &hosts, const vector<datom> &cands, int nop, int nthreads){
+    /*
+    Append candidates to the rows of their hosts and sort every row
+    by distance.
+    */
+    if (offsets.size() != nop+1) reset(nop);
+
+    vector<int> noffsets(nop+1, 0);
+    for(int ti=0; ti<nop; ti++){
+        noffsets[ti+1] = offsets[ti+1] - offsets[ti];
+    }
+    for(int i=0; i<hosts.size(); i++){
+        noffsets[hosts[i]+1]++;
+    }
+    for(int ti=0; ti<nop; ti++){
+        noffsets[ti+1] += noffsets[ti];
+    }
+
+    vector<datom> nitems(noffsets[nop]);
+    vector<int> fill(noffsets.begin(), noffsets.end()-1);
+    for(int ti=0; ti<nop; ti++){
+        for(int i=offsets[ti]; i<offsets[ti+1]; i++){
+            nitems[fill[ti]++] = items[i];
+        }
+    }
+    for(int i=0; i<hosts.size(); i++){
+        nitems[fill[hosts[i]]++] = cands[i];
+    }
+    //rows are independent, so they can be sorted in parallel
+    parallel_for(nop, nthreads, [&](int start, int stop, int tid){
+        for(int ti=start; ti<stop; ti++){
+            stable_sort(nitems.begin()+noffsets[ti], nitems.begin()+noffsets[ti+1], by_dist());
+        }
+    });
+
+    offsets.swap(noffsets);
+    items.swap(nitems);
+}
+
+//-----------------------------------------------------
+// Half neighbor list
+//-----------------------------------------------------
+void HalfNeighborList::clear(){
+    //give the memory back, these lists can be large
+    vector<int>().swap(order);
+    vector<int>().swap(slot);
+    vector<int>().swap(degree);
+    vector<long long>().swap(offsets);
+    vector<long long>().swap(coffsets);
+    vector<uint16_t>().swap(code);
+    vector<float>().swap(dist);
+    vector<float>().swap(diffx);
+    vector<float>().swap(diffy);
+    vector<float>().swap(diffz);
+}
+
+void HalfNeighborList::begin_rows(){
+    clear();
+    offsets.assign(1, 0);
+    coffsets.assign(1, 0);
+}
+
+void HalfNeighborList::add_row(int s, vector<bond> &row){
+    /*
+    Append the row of slot s, rows have to be added in order of slot.
+    The bonds are sorted by slot first.
+    */
+    sort(row.begin(), row.end(), [](const bond &a, const bond &b){ return a.t < b.t; });
+    int prev = s;
+    for(int i=0; i<row.size(); i++){
+        unsigned int delta = row[i].t - prev;
+        if (delta < ESCAPE){
+            code.push_back(uint16_t(delta));
+        }
+        else{
+            code.push_back(ESCAPE);
+            code.push_back(uint16_t(delta >> 16));
+            code.push_back(uint16_t(delta & 0xFFFF));
+        }
+        prev = row[i].t;
+        dist.push_back(row[i].d);
+        diffx.push_back(row[i].dx);
+        diffy.push_back(row[i].dy);
+        diffz.push_back(row[i].dz);
+    }
+    offsets.push_back(dist.size());
+    coffsets.push_back(code.size());
+}
+
+void HalfNeighborList::append(HalfNeighborList &part){
+    /*
+    Append the rows of a list built for the following slots, the
+    part is emptied on the way to keep the peak memory low.
+    */
+    long long nb = dist.size();
+    long long nc = code.size();
+    for(int s=1; s<part.offsets.size(); s++){
+        offsets.push_back(part.offsets[s] + nb);
+        coffsets.push_back(part.coffsets[s] + nc);
+    }
+    code.insert(code.end(), part.code.begin(), part.code.end());
+    vector<uint16_t>().swap(part.code);
+    dist.insert(dist.end(), part.dist.begin(), part.dist.end());
+    vector<float>().swap(part.dist);
+    diffx.insert(diffx.end(), part.diffx.begin(), part.diffx.end());
+    vector<float>().swap(part.diffx);
+    diffy.insert(diffy.end(), part.diffy.begin(), part.diffy.end());
+    vector<float>().swap(part.diffy);
+    diffz.insert(diffz.end(), part.diffz.begin(), part.diffz.end());
+    vector<float>().swap(part.diffz);
+    part.clear();
+}
+
+void HalfNeighborList::count_degrees(){
+    degree.assign(order.size(), 0);
+    for(int s=0; s<nslots(); s++){
+        int ti = order[s];
+        for_row(s, [&](int t, long long b){
+            //an image of the atom itself stands for both opposite images
+            if (t == s){
+                degree[ti] += 2;
+            }
+            else{
+                degree[ti]++;
+                degree[order[t]]++;
+            }
+        });
+    }
+}
+
+//-----------------------------------------------------
+// Cell list
+//-----------------------------------------------------
+//spread the lowest 21 bits of x so that there are two zero bits
+//between each of them
+static unsigned long long spread_bits(unsigned long long x){
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+static unsigned long long morton_key(int cx, int cy, int cz){
+    return spread_bits(cx) | (spread_bits(cy) << 1) | (spread_bits(cz) << 2);
+}
+
+void CellList::set_grid(int mx, int my, int mz, const int *mreach, const double *mwidth, double rc, bool ortho, const bool *mperiodic, const double medge[3][3]){
+    /*
+    Set the number of cells in each direction and their widths, number
+    the cells along a Morton curve and find the stencil of every cell, the
+    cells within mreach cells along each direction which are not further
+    than rc from the cell. medge are the edge vectors of a cell. Along
+    directions which are not periodic, cells beyond the ends of the grid
+    are left out. Nothing is done if the grid is unchanged, so that
+    repeated neighbor calculations only redo the binning.
+    */
+    bool same = (mx == nx) && (my == ny) && (mz == nz) && (ncells > 0)
+        && (rc == cutoff) && (ortho == orthogonal);
+    for(int a=0; a<3; a++){
+        same = same && (mreach[a] == reach[a]) && (mwidth[a] == width[a]) && (mperiodic[a] == periodic[a]);
+        width[a] = mwidth[a];
+        periodic[a] = mperiodic[a];
+        for(int b=0; b<3; b++){
+            same = same && (medge[a][b] == edge[a][b]);
+            edge[a][b] = medge[a][b];
+        }
+    }
+    if (same) return;
+
+    nx = mx;
+    ny = my;
+    nz = mz;
+    ncells = nx*ny*nz;
+    cutoff = rc;
+    orthogonal = ortho;
+    int n[3] = {nx, ny, nz};
+    for(int a=0; a<3; a++){
+        reach[a] = mreach[a];
+        //largest number of box lengths a stencil entry can wrap
+        nimage[a] = (periodic[a]) ? (reach[a] + n[a] - 1)/n[a] : 0;
+    }
+
+    //offsets of the stencil, cells that are further than the cutoff
+    //are left out. Between cells d apart along a direction, there are
+    //at least |d|-1 cell widths. This gives the distance for orthogonal
+    //boxes, otherwise only the largest of the three is a safe bound.
+    //Differences of points in two cells of a sheared grid lie within
+    //the longest diagonal of a cell of the vector between the cells,
+    //which also bounds the distance, and is the tighter bound when the
+    //stencil reaches far
+    double diag = 0, c[3];
+    for(int k=0; k<8; k++){
+        for(int b=0; b<3; b++){
+            c[b] = ((k&1) ? 1 : -1)*edge[0][b] + ((k&2) ? 1 : -1)*edge[1][b] + ((k&4) ? 1 : -1)*edge[2][b];
+        }
+        diag = max(diag, sqrt(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]));
+    }
+    vector<int> offs;
+    for(int di=-reach[0]; di<=reach[0]; di++){
+        for(int dj=-reach[1]; dj<=reach[1]; dj++){
+            for(int dk=-reach[2]; dk<=reach[2]; dk++){
+                double gi = max(0, abs(di)-1)*width[0];
+                double gj = max(0, abs(dj)-1)*width[1];
+                double gk = max(0, abs(dk)-1)*width[2];
+                double gap = (orthogonal) ? sqrt(gi*gi + gj*gj + gk*gk) : max(gi, max(gj, gk));
+                if (!orthogonal){
+                    for(int b=0; b<3; b++){
+                        c[b] = di*edge[0][b] + dj*edge[1][b] + dk*edge[2][b];
+                    }
+                    gap = max(gap, sqrt(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]) - diag);
+                }
+                if (gap >= rc) continue;
+                offs.push_back(di);
+                offs.push_back(dj);
+                offs.push_back(dk);
+            }
+        }
+    }
+
+    //sort the grid positions by their Morton key
+    vector<pair<unsigned long long, int>> keys(ncells);
+    for(int i=0; i<nx; i++){
+        for(int j=0; j<ny; j++){
+            for(int k=0; k<nz; k++){
+                int g = (i*ny + j)*nz + k;
+                keys[g] = make_pair(morton_key(i, j, k), g);
+            }
+        }
+    }
+    sort(keys.begin(), keys.end());
+    number.assign(ncells, 0);
+    grid.assign(ncells, 0);
+    for(int c=0; c<ncells; c++){
+        number[keys[c].second] = c;
+        grid[c] = keys[c].second;
+    }
+
+    //now the stencils, in cell order
+    int ns = offs.size()/3;
+    int ni[3] = {2*nimage[0]+1, 2*nimage[1]+1, 2*nimage[2]+1};
+    zero_image = (nimage[0]*ni[1] + nimage[1])*ni[2] + nimage[2];
+    int si, sj, sk, qi, qj, qk;
+    auto inside = [&](int i, int j, int k, int o){
+        return !(outside(0, i + offs[3*o]) || outside(1, j + offs[3*o+1]) || outside(2, k + offs[3*o+2]));
+    };
+
+    //count the entries of every stencil, then fill them
+    stencil_offsets.assign(ncells+1, 0);
+    for(int i=0; i<nx; i++){
+        for(int j=0; j<ny; j++){
+            for(int k=0; k<nz; k++){
+                int c = cell_index(i, j, k);
+                for(int o=0; o<ns; o++){
+                    if (inside(i, j, k, o)) stencil_offsets[c+1]++;
+                }
+            }
+        }
+    }
+    for(int c=0; c<ncells; c++){
+        stencil_offsets[c+1] += stencil_offsets[c];
+    }
+    stencil.resize(stencil_offsets[ncells]);
+    stencil_image.resize(stencil_offsets[ncells]);
+    for(int i=0; i<nx; i++){
+        for(int j=0; j<ny; j++){
+            for(int k=0; k<nz; k++){
+                int c = cell_index(i, j, k);
+                int m = stencil_offsets[c];
+                for(int o=0; o<ns; o++){
+                    if (!inside(i, j, k, o)) continue;
+                    si = wrap(0, i + offs[3*o], qi);
+                    sj = wrap(1, j + offs[3*o+1], qj);
+                    sk = wrap(2, k + offs[3*o+2], qk);
+                    stencil[m] = cell_index(si, sj, sk);
+                    stencil_image[m] = ((qi + nimage[0])*ni[1] + (qj + nimage[1]))*ni[2] + (qk + nimage[2]);
+                    m++;
+                }
+            }
+        }
+    }
+}
+
+void CellList::set_images(const double box[3][3]){
+    /*
+    Lattice translations of the images a stencil can refer to,
+    the box vectors are the rows of box.
+    */
+    int ni[3] = {2*nimage[0]+1, 2*nimage[1]+1, 2*nimage[2]+1};
+    int nt = ni[0]*ni[1]*ni[2];
+    imagex.resize(nt);
+    imagey.resize(nt);
+    imagez.resize(nt);
+    for(int qi=-nimage[0]; qi<=nimage[0]; qi++){
+        for(int qj=-nimage[1]; qj<=nimage[1]; qj++){
+            for(int qk=-nimage[2]; qk<=nimage[2]; qk++){
+                int t = ((qi + nimage[0])*ni[1] + (qj + nimage[1]))*ni[2] + (qk + nimage[2]);
+                imagex[t] = qi*box[0][0] + qj*box[1][0] + qk*box[2][0];
+                imagey[t] = qi*box[0][1] + qj*box[1][1] + qk*box[2][1];
+                imagez[t] = qi*box[0][2] + qj*box[1][2] + qk*box[2][2];
+            }
+        }
+    }
+}
+
+void CellList::bin(const vector<double> &x, const vector<double> &y, const vector<double> &z, int nthreads){
+    /*
+    Sort the atoms into cells. cellof must hold the cell of every atom.
+    A counting sort keeps atoms of the same cell in increasing order,
+    then the positions, wrapped into the box, are copied in the sorted order.
+    */
+    int nop = cellof.size();
+
+    offsets.assign(ncells+1, 0);
+    for(int ti=0; ti<nop; ti++){
+        offsets[cellof[ti]+1]++;
+    }
+    for(int c=0; c<ncells; c++){
+        offsets[c+1] += offsets[c];
+    }
+
+    vector<int> fill(offsets.begin(), offsets.end()-1);
+    index.resize(nop);
+    for(int ti=0; ti<nop; ti++){
+        index[fill[cellof[ti]]++] = ti;
+    }
+
+    posx.resize(nop);
+    posy.resize(nop);
+    posz.resize(nop);
+    slot.resize(nop);
+    parallel_for(nop, nthreads, [&](int start, int stop, int tid){
+        for(int s=start; s<stop; s++){
+            posx[s] = x[index[s]];
+            posy[s] = y[index[s]];
+            posz[s] = z[index[s]];
+            slot[index[s]] = s;
+        }
+    });
+}
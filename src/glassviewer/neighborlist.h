@@ -0,0 +1,301 @@
+#ifndef GLASSVIEWER_NEIGHBORLIST_H
+#define GLASSVIEWER_NEIGHBORLIST_H
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "atom.h"
+
+using namespace std;
+
+/*
+Neighbor table of a System in compressed sparse row form.
+
+The neighbors of the atom at location ti are stored in the flat arrays
+between offsets[ti] and offsets[ti+1]. All per bond arrays have the same
+length, except facevertices, faceperimeters which are only filled by the
+voronoi method and cna which holds four values per bond once a cna
+calculation has been done. The spherical coordinates r, phi, theta are
+not filled when the list is built, only the distance vectors are. They
+are worked out from the vectors for all bonds at once by ensure_angles,
+which the angular calculations call before using them.
+
+The numpy views on offsets, index and dist hold a copy of views. While one
+is alive the list keeps these columns where they are, an operation which
+would have to move them throws instead, see check_views.
+*/
+class NeighborList{
+
+    public:
+
+        vector<int> offsets;
+        vector<int> index;
+        vector<double> dist;
+        vector<double> weight;
+        vector<double> diffx, diffy, diffz;
+        vector<double> r, phi, theta;
+        vector<double> sij;
+        vector<int> facevertices;
+        vector<double> faceperimeters;
+        vector<int> cna;
+        shared_ptr<int> views = make_shared<int>(0);
+
+        void check_views(int, int) const;
+        void reset(int);
+        void reserve(int);
+        int nbonds() const { return index.size(); }
+        int count(int ti) const { return offsets[ti+1] - offsets[ti]; }
+        int begin(int ti) const { return offsets[ti]; }
+        int end(int ti) const { return offsets[ti+1]; }
+        bool has_faces() const { return facevertices.size() == index.size(); }
+        bool has_cna() const { return cna.size() == 4*index.size(); }
+        bool has_angles() const { return theta.size() == index.size(); }
+        void ensure_angles(int nthreads = 1);
+        void replace_row(int, const vector<int>&, const vector<double>&, const vector<double>&,
+            const vector<double>&, const vector<double>&, const vector<double>&,
+            const vector<double>&);
+};
+
+/*
+Collects neighbor pairs in any order and turns them into a NeighborList.
+Pairs are grouped by host atom with a stable counting sort, so that the
+neighbors of every atom keep the order in which they were added.
+*/
+class NeighborBuilder{
+
+    public:
+
+        struct bond{
+            int ti, tj;
+            double d;
+            double dx, dy, dz;
+            double w;
+            int fv;
+            double fp;
+        };
+
+        vector<bond> bonds;
+        bool faces = false;
+
+        void clear();
+        void seed(const NeighborList&, const vector<char> &skip = vector<char>());
+        void add(int ti, int tj, double d, double dx, double dy, double dz, double w = 1.00){
+            bonds.push_back({ti, tj, d, dx, dy, dz, w, -1, -1.0});
+        }
+        void add_face(int ti, int tj, double d, double dx, double dy, double dz, double w, int fv, double fp){
+            bonds.push_back({ti, tj, d, dx, dy, dz, w, fv, fp});
+            faces = true;
+        }
+        void merge(vector<NeighborBuilder>&);
+        void build(NeighborList&, int);
+};
+
+/*
+Candidate neighbors used by the number based and adaptive methods, stored
+in the same compressed row form. Each row is sorted by distance.
+*/
+class CandidateList{
+
+    public:
+
+        vector<int> offsets;
+        vector<datom> items;
+
+        void reset(int);
+        int count(int ti) const { return offsets[ti+1] - offsets[ti]; }
+        const datom& at(int ti, int i) const { return items[offsets[ti]+i]; }
+        void remove_rows(const vector<char>&);
+        void merge(const vector<int>&, const vector<datom>&, int, int nthreads = 1);
+};
+
+/*
+Neighbor index of one frame. rows holds, for every atom, all atoms closer
+than reach[ti] sorted by distance, so that the cutoff, number, adaptive and
+SANN neighbors can all be read from it without searching again. radius is
+the smallest reach and k the smallest row length, every atom has at least
+that much. nearest marks an index of exactly the k nearest atoms and their
+ties. The index is invalidated when the box changes and is only used
+for positions with the checksum it was built for, see
+AtomStore::position_checksum.
+*/
+class NeighborIndex{
+
+    public:
+
+        CandidateList rows;
+        vector<double> reach;
+        double radius = 0;
+        int k = 0;
+        uint64_t checksum = 0;
+        bool nearest = false;
+        bool valid = false;
+
+        void invalidate(){ valid = false; }
+        bool holds(int nop, uint64_t sum) const {
+            return valid && (rows.offsets.size() == nop+1) && (sum == checksum);
+        }
+        bool covers(double r, int n, int nop, uint64_t sum) const {
+            return holds(nop, sum) && (r <= radius) && (n <= k);
+        }
+};
+
+/*
+Verlet list kept over the frames of a trajectory. rows holds, for every
+atom, all atoms closer than cutoff + skin at the positions x0, y0, z0 of
+the frame it was built on, with the bond vectors of that frame. While no
+atom has moved more than half the skin, every pair within the cutoff is
+in it, and the bond vectors of a later frame are those of the rows moved
+along with the two atoms. builds counts how often it was built. It is
+invalidated when the box or the number of atoms change.
+*/
+class VerletList{
+
+    public:
+
+        CandidateList rows;
+        vector<double> x0, y0, z0;
+        double cutoff = 0;
+        double skin = 0;
+        int builds = 0;
+        bool valid = false;
+
+        void invalidate(){ valid = false; }
+        bool holds(double rc, double s, int nop) const {
+            return valid && (rows.offsets.size() == nop+1) && (rc == cutoff) && (s == skin);
+        }
+};
+
+/*
+Half neighbor list for very large systems, every pair is stored once.
+Atoms are taken in the spatial order of the cell list: order[s] is the atom
+at slot s and slot its inverse. The row of slot s holds the neighbors at
+slots t >= s, an atom and its own image are kept once for each pair of
+opposite images. Neighbors are stored as slots sorted along the row, the
+first as the difference to s and the rest as differences to the previous
+one, in 16 bit words; a difference that does not fit is marked by ESCAPE
+and follows in two words. Distances and bond vectors are stored as float.
+degree is the number of neighbors of each atom as in a full list.
+*/
+class HalfNeighborList{
+
+    public:
+
+        static constexpr uint16_t ESCAPE = 0xFFFF;
+
+        struct bond{
+            int t;
+            float d;
+            float dx, dy, dz;
+        };
+
+        vector<int> order;
+        vector<int> slot;
+        vector<int> degree;
+        vector<long long> offsets;
+        vector<long long> coffsets;
+        vector<uint16_t> code;
+        vector<float> dist;
+        vector<float> diffx, diffy, diffz;
+
+        void clear();
+        void begin_rows();
+        void add_row(int, vector<bond>&);
+        void append(HalfNeighborList&);
+        void count_degrees();
+        long long nbonds() const { return dist.size(); }
+        int nslots() const { return int(offsets.size()) - 1; }
+        //call f(tslot, b) for every bond b of the row of slot s
+        template <typename F>
+        void for_row(int s, F f) const {
+            long long c = coffsets[s];
+            int t = s;
+            for(long long b=offsets[s]; b<offsets[s+1]; b++){
+                uint16_t w = code[c++];
+                if (w == ESCAPE){
+                    t += (int(code[c]) << 16) | int(code[c+1]);
+                    c += 2;
+                }
+                else{
+                    t += w;
+                }
+                f(t, b);
+            }
+        }
+};
+
+/*
+Cell list in compressed row form. The atoms in cell c are
+index[offsets[c]] ... index[offsets[c+1]-1], put in place by a counting
+sort. Cells are numbered along a Morton (Z-order) curve, so that cells
+which are close in space are also close in memory, and posx, posy, posz
+hold a copy of the atom positions, wrapped into the box, in the same order
+as index. The atoms of the System are never moved, index is the
+permutation back to them and slot is its inverse. number maps a grid position
+(cx*ny + cy)*nz + cz to its cell, grid is the inverse.
+
+The stencil of a cell lists the cells within reach cells along each
+direction that can hold an atom closer than cutoff to the cell, stored like
+the atoms in stencil_offsets and stencil. Cells may be thinner than the
+cutoff, the corners of the stencil are then left out. Periodic
+images are not folded onto each other: a stencil entry that wraps around
+the box keeps the lattice translation in stencil_image, an index into
+imagex, imagey, imagez. Every periodic image of an atom is then seen once,
+also when the box is smaller than the cutoff. width is the thickness of a
+cell normal to its faces along each box vector. Along a direction which is
+not periodic the grid only spans the atoms and is not wrapped, stencils of
+cells at its ends are shorter.
+*/
+class CellList{
+
+    public:
+
+        int nx = 0, ny = 0, nz = 0;
+        int ncells = 0;
+        int reach[3] = {0, 0, 0};
+        double width[3] = {0, 0, 0};
+        double edge[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        double cutoff = 0;
+        bool orthogonal = true;
+        bool periodic[3] = {true, true, true};
+        vector<int> number;
+        vector<int> grid;
+        vector<int> offsets;
+        vector<int> index;
+        vector<int> cellof;
+        vector<int> slot;
+        vector<double> posx, posy, posz;
+        vector<int> stencil_offsets;
+        vector<int> stencil;
+        vector<int> stencil_image;
+        int nimage[3] = {0, 0, 0};
+        int zero_image = 0;
+        vector<double> imagex, imagey, imagez;
+
+        void set_grid(int, int, int, const int*, const double*, double, bool, const bool*, const double[3][3]);
+        void set_images(const double[3][3]);
+        void bin(const vector<double>&, const vector<double>&, const vector<double>&, int nthreads = 1);
+        int cell_index(int cx, int cy, int cz) const { return number[(cx*ny + cy)*nz + cz]; }
+        int count(int c) const { return offsets[c+1] - offsets[c]; }
+        int begin(int c) const { return offsets[c]; }
+        int end(int c) const { return offsets[c+1]; }
+        int stencil_begin(int c) const { return stencil_offsets[c]; }
+        int stencil_end(int c) const { return stencil_offsets[c+1]; }
+        //wrap grid position p along direction a into the box, q is the
+        //number of box lengths it was moved by
+        int wrap(int a, int p, int &q) const {
+            int n = (a == 0) ? nx : ((a == 1) ? ny : nz);
+            q = (p >= 0) ? p/n : -((n - 1 - p)/n);
+            return p - q*n;
+        }
+        //grid position p along direction a is beyond the end
+        //of a direction which is not periodic
+        bool outside(int a, int p) const {
+            return (!periodic[a]) && ((p < 0) || (p >= size(a)));
+        }
+        //number of cells along direction a
+        int size(int a) const {
+            return (a == 0) ? nx : ((a == 1) ? ny : nz);
+        }
+};
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef GLASSVIEWER_PARALLEL_H
+#define GLASSVIEWER_PARALLEL_H
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+using namespace std;
+
+/*
+Threads kept for the lifetime of the module and shared by all parallel
+loops, so that no thread is started per call. run(ntasks, f) calls f(t)
+for t in [0, ntasks), the calling thread takes tasks as well, and returns
+once every task is done. An exception thrown by a task is passed on to
+the caller. A loop started from within a task, or while another thread
+is using the pool, is run on the calling thread alone.
+*/
+class ThreadPool{
+
+    public:
+
+        static ThreadPool& shared(){
+            static ThreadPool pool;
+            return pool;
+        }
+
+        ~ThreadPool(){
+            {
+                lock_guard<mutex> lk(m);
+                quit = true;
+            }
+            wake.notify_all();
+            for(auto &w : workers){
+                w.join();
+            }
+        }
+
+        template <typename F>
+        void run(int ntasks, F f){
+
+            if (ntasks <= 0) return;
+            unique_lock<mutex> owner(busy, try_to_lock);
+            if ((ntasks == 1) || inside() || !owner.owns_lock()){
+                for(int t=0; t<ntasks; t++){
+                    f(t);
+                }
+                return;
+            }
+
+            grow(ntasks-1);
+            function<void(int)> task = f;
+            unsigned long gen;
+            {
+                lock_guard<mutex> lk(m);
+                job = &task;
+                njobs = ntasks;
+                next = 0;
+                remaining = ntasks;
+                error = nullptr;
+                gen = ++generation;
+            }
+            wake.notify_all();
+
+            bool was = inside();
+            inside() = true;
+            work(gen);
+            inside() = was;
+
+            unique_lock<mutex> lk(m);
+            finished.wait(lk, [&]{ return remaining == 0; });
+            job = nullptr;
+            if (error){
+                exception_ptr e = error;
+                error = nullptr;
+                rethrow_exception(e);
+            }
+        }
+
+    private:
+
+        vector<thread> workers;
+        mutex m, busy;
+        condition_variable wake, finished;
+        const function<void(int)> *job = nullptr;
+        int njobs = 0;
+        int next = 0;
+        int remaining = 0;
+        unsigned long generation = 0;
+        exception_ptr error;
+        bool quit = false;
+
+        //true on the threads of the pool, and on a caller while it runs tasks
+        static bool& inside(){
+            thread_local bool flag = false;
+            return flag;
+        }
+
+        void grow(int n){
+            while (workers.size() < n){
+                workers.emplace_back([this]{ loop(); });
+            }
+        }
+
+        //take tasks of generation gen until there are none left, a task
+        //is claimed under the lock so that a late thread never takes
+        //one of the next loop
+        void work(unsigned long gen){
+            int t;
+            while (true){
+                {
+                    lock_guard<mutex> lk(m);
+                    if ((gen != generation) || (next >= njobs)) return;
+                    t = next++;
+                }
+                try{
+                    (*job)(t);
+                }
+                catch(...){
+                    lock_guard<mutex> lk(m);
+                    if (!error) error = current_exception();
+                }
+                lock_guard<mutex> lk(m);
+                if (--remaining == 0) finished.notify_all();
+            }
+        }
+
+        void loop(){
+            inside() = true;
+            unsigned long seen = 0;
+            while (true){
+                {
+                    unique_lock<mutex> lk(m);
+                    wake.wait(lk, [&]{ return quit || (generation != seen); });
+                    if (quit) return;
+                    seen = generation;
+                }
+                work(seen);
+            }
+        }
+};
+
+/*
+Split the range [0, n) into contiguous blocks, one per thread, and call
+f(start, stop, threadid) for each block. Blocks are in order of threadid,
+so that results collected per thread can be concatenated to give the same
+order as a serial loop. Returns once all blocks are done.
+*/
+template <typename F>
+void parallel_for(int n, int nthreads, F f){
+
+    nthreads = max(1, min(nthreads, n));
+    if (nthreads == 1){
+        f(0, n, 0);
+        return;
+    }
+
+    int chunk = n/nthreads;
+    int rem = n%nthreads;
+    ThreadPool::shared().run(nthreads, [&](int t){
+        int start = t*chunk + min(t, rem);
+        int stop = start + chunk + ((t < rem) ? 1 : 0);
+        f(start, stop, t);
+    });
+}
+
+/*
+Same as parallel_for for loops whose iterations differ in cost. The range
+is handed out in pieces of chunk iterations to whichever thread is free,
+f(start, stop, threadid) is called once per piece. threadid is below
+nthreads, so results can still be collected per thread, but which pieces
+a thread gets is not fixed.
+*/
+template <typename F>
+void parallel_for_dynamic(int n, int nthreads, int chunk, F f){
+
+    nthreads = max(1, min(nthreads, n));
+    chunk = max(1, chunk);
+    if (nthreads == 1){
+        f(0, n, 0);
+        return;
+    }
+
+    atomic<int> next(0);
+    ThreadPool::shared().run(nthreads, [&](int t){
+        int start;
+        while ((start = next.fetch_add(chunk)) < n){
+            f(start, min(n, start + chunk), t);
+        }
+    });
+}
+
+//number of threads used if the user does not set one
+inline int default_nthreads(){
+    int n = thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+#endif
@@ -3,15 +3,25 @@
 #include <iomanip>
 #include <algorithm>
 #include <stdio.h>
+#include <float.h>
 #include "voro++.hh"
 #include "string.h"
 #include <chrono>
 #include <pybind11/stl.h>
 #include <thread>
 #include <mutex>
+#include <limits>
 
 using namespace voro;
 
+//atoms a half cutoff cell should hold on average before the cells are
+//made smaller than the cutoff, below this the extra cells cost more
+//than the pairs they save
+static const double CELL_FILL = 4.0;
+
+//cells per cutoff of the pair histograms for a cutoff beyond half the box
+static const int LONG_SPLIT = 4;
+
 //-----------------------------------------------------
 // Constructor, Destructor and Access functions
 //-----------------------------------------------------
@@ -22,6 +32,8 @@ System::System(){
     real_nop = 0;
     triclinic = 0;
     usecells = 0;
+    cellsplit = 0;
+    usehalf = 0;
     filter = 0;
     maxclusterid = -1;
     
@@ -32,12 +44,20 @@ System::System(){
     comparecriteria = 0;
     
     neighbordistance = 0;
+    skin = 0;
+    npairtypes = 0;
+    neighbor_info_stored = 0;
+    nthreads = default_nthreads();
     pdf_halftimes=0;
     //set box with zeros
     for(int i=0; i<3; i++){
+        periodic[i] = true;
         for(int j=0; j<3; j++){
             box[i][j] = 0.0;
+            lattice[i][j] = 0.0;
+            latinv[i][j] = 0.0;
         }
+        heights[i] = 0.0;
     }
 
 }
@@ -58,6 +78,8 @@ void System::assign_triclinic_params(vector<vector<double>> drot, vector<vector<
     }
 
     triclinic = 1;
+    nindex.invalidate();
+    verlet.invalidate();
 }
 
 vector<vector<double>> System::get_triclinic_params(){
@@ -95,6 +117,140 @@ void System::sbox(vector<vector <double>> boxd) {
     boxx = boxdims[0][1] - boxdims[0][0];
     boxy = boxdims[1][1] - boxdims[1][0];
     boxz = boxdims[2][1] - boxdims[2][0];
+    reduce_lattice();
+    get_box_heights(heights);
+    tribox.set(lattice, latinv, heights, periodic);
+    nindex.invalidate();
+    verlet.invalidate();
+}
+
+void System::speriodic(vector<bool> pbc){
+    /*
+    Set which box vectors are periodic. Along the others atoms are not
+    wrapped and have no images, as for a cluster or the free surface of
+    a slab.
+    */
+    if (pbc.size() != 3){
+        throw invalid_argument("periodic should have three values");
+    }
+    for(int i=0; i<3; i++){
+        periodic[i] = pbc[i];
+    }
+    reduce_lattice();
+    get_box_heights(heights);
+    tribox.set(lattice, latinv, heights, periodic);
+    nindex.invalidate();
+    verlet.invalidate();
+}
+
+vector<bool> System::gperiodic(){
+    return {periodic[0], periodic[1], periodic[2]};
+}
+
+void System::reduce_lattice(){
+    /*
+    Find a short, nearly orthogonal basis of the lattice spanned by the box
+    vectors. A box sheared by more than half a box length is brought back,
+    so that images are searched along thick directions. Vectors are made
+    shorter by adding or subtracting multiples of the others until none of
+    them gets shorter. An orthogonal box is left as it is. Only periodic
+    vectors are reduced, the others are made normal to the periodic ones,
+    which does not change the lattice of images.
+    */
+    double t[3], e[3][3], tt, bb, m, det, len;
+    bool changed = true;
+    int j, k, ne;
+
+    for(int i=0; i<3; i++){
+        for(int a=0; a<3; a++){
+            lattice[i][a] = box[i][a];
+        }
+    }
+
+    for(int it=0; changed && (it<100); it++){
+        changed = false;
+        for(int i=0; i<3; i++){
+            bb = lattice[i][0]*lattice[i][0] + lattice[i][1]*lattice[i][1] + lattice[i][2]*lattice[i][2];
+            //size reduce against each other vector
+            for(int o=1; o<3; o++){
+                j = (i+o)%3;
+                if (!(periodic[i] && periodic[j])) continue;
+                tt = lattice[j][0]*lattice[j][0] + lattice[j][1]*lattice[j][1] + lattice[j][2]*lattice[j][2];
+                if (tt == 0) continue;
+                m = rint((lattice[i][0]*lattice[j][0] + lattice[i][1]*lattice[j][1] + lattice[i][2]*lattice[j][2])/tt);
+                if (m == 0) continue;
+                for(int a=0; a<3; a++){
+                    t[a] = lattice[i][a] - m*lattice[j][a];
+                }
+                tt = t[0]*t[0] + t[1]*t[1] + t[2]*t[2];
+                if (tt < bb*(1.0 - 1E-12)){
+                    for(int a=0; a<3; a++){
+                        lattice[i][a] = t[a];
+                    }
+                    bb = tt;
+                    changed = true;
+                }
+            }
+            //and against both others at once
+            j = (i+1)%3;
+            k = (i+2)%3;
+            if (!(periodic[i] && periodic[j] && periodic[k])) continue;
+            for(int sj=-1; sj<=1; sj+=2){
+                for(int sk=-1; sk<=1; sk+=2){
+                    for(int a=0; a<3; a++){
+                        t[a] = lattice[i][a] + sj*lattice[j][a] + sk*lattice[k][a];
+                    }
+                    tt = t[0]*t[0] + t[1]*t[1] + t[2]*t[2];
+                    if (tt < bb*(1.0 - 1E-12)){
+                        for(int a=0; a<3; a++){
+                            lattice[i][a] = t[a];
+                        }
+                        bb = tt;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    //orthonormal basis of the periodic vectors, each other vector keeps
+    //its length but only the part normal to those before it
+    ne = 0;
+    for(int pass=0; pass<2; pass++){
+        for(int i=0; i<3; i++){
+            if (periodic[i] != (pass == 0)) continue;
+            len = sqrt(lattice[i][0]*lattice[i][0] + lattice[i][1]*lattice[i][1] + lattice[i][2]*lattice[i][2]);
+            for(int a=0; a<3; a++){
+                t[a] = lattice[i][a];
+            }
+            for(int b=0; b<ne; b++){
+                m = t[0]*e[b][0] + t[1]*e[b][1] + t[2]*e[b][2];
+                for(int a=0; a<3; a++){
+                    t[a] -= m*e[b][a];
+                }
+            }
+            tt = sqrt(t[0]*t[0] + t[1]*t[1] + t[2]*t[2]);
+            if (tt == 0) continue;
+            for(int a=0; a<3; a++){
+                e[ne][a] = t[a]/tt;
+                if (!periodic[i]) lattice[i][a] = len*e[ne][a];
+            }
+            ne++;
+        }
+    }
+
+    //inverse of the matrix with the lattice vectors as columns,
+    //its rows are the cross products over the volume
+    det = lattice[0][0]*(lattice[1][1]*lattice[2][2] - lattice[1][2]*lattice[2][1])
+        - lattice[0][1]*(lattice[1][0]*lattice[2][2] - lattice[1][2]*lattice[2][0])
+        + lattice[0][2]*(lattice[1][0]*lattice[2][1] - lattice[1][1]*lattice[2][0]);
+    for(int i=0; i<3; i++){
+        j = (i+1)%3;
+        k = (i+2)%3;
+        latinv[i][0] = (det != 0) ? (lattice[j][1]*lattice[k][2] - lattice[j][2]*lattice[k][1])/det : 0.0;
+        latinv[i][1] = (det != 0) ? (lattice[j][2]*lattice[k][0] - lattice[j][0]*lattice[k][2])/det : 0.0;
+        latinv[i][2] = (det != 0) ? (lattice[j][0]*lattice[k][1] - lattice[j][1]*lattice[k][0])/det : 0.0;
+    }
 }
 
 vector<vector<double>> System::gbox(){
@@ -118,23 +274,44 @@ vector<vector<double>> System::gbox(){
 //this function allows for handling custom formats of atoms and so on
 void System::set_atoms( vector<Atom> atomitos){
 
-    atoms.clear();
+    //nothing is changed if the columns are viewed and would be moved
+    atoms.reallocate(atomitos.size());
+
+    //the neighbor index only holds while no atom moves
+    bool moved = (atomitos.size() != nop);
+    for(int i=0; (i<atomitos.size()) && (!moved); i++){
+        moved = (atoms.posx[i] != atomitos[i].posx) || (atoms.posy[i] != atomitos[i].posy) || (atoms.posz[i] != atomitos[i].posz);
+    }
+    if (moved){
+        nindex.invalidate();
+    }
+    //the Verlet list follows moving atoms itself
+    if (atomitos.size() != nop){
+        verlet.invalidate();
+    }
+
     nop = atomitos.size();
-    atoms.reserve(nop);
-    atoms.assign(atomitos.begin(), atomitos.end());
+    atoms.resize(nop);
 
     //now assign ghost and real atoms
     int tg = 0;
     int tl = 0;
 
     for(int i=0; i<nop; i++){
-        if(atoms[i].ghost==0){
+        scatter_atom(i, atomitos[i]);
+        if(atoms.ghost[i]==0){
             tl++;
         }
         else{
             tg++;
         }
     }
+    scatter_neighbors(atomitos);
+
+    //candidates are only valid for the same set of atoms
+    if (candidates.offsets.size() != nop+1){
+        candidates.reset(nop);
+    }
 
     ghost_nop = tg;
     real_nop = tl;
@@ -144,12 +321,175 @@ void System::set_atoms( vector<Atom> atomitos){
 }
 
 
+void System::set_atoms_from_arrays(py::array_t<double, py::array::c_style | py::array::forcecast> positions,
+    py::array_t<int, py::array::c_style | py::array::forcecast> types,
+    py::array_t<int, py::array::c_style | py::array::forcecast> ids, py::dict custom){
+    /*
+    Fill the atom columns directly from arrays of positions (n x 3),
+    types and ids. No Atom objects are created and all atoms are real.
+    Custom values are given as a dict of key : array of length n.
+    */
+    if ((positions.ndim() != 2) || (positions.shape(1) != 3))
+        throw invalid_argument("positions should be of shape natoms x 3");
+    int n = positions.shape(0);
+    if ((types.size() != n) || (ids.size() != n))
+        throw invalid_argument("types and ids should be of length natoms");
+
+    auto pos = positions.unchecked<2>();
+    auto typ = types.unchecked<1>();
+    auto idd = ids.unchecked<1>();
+
+    atoms.reallocate(n);
+    if (n != nop){
+        verlet.invalidate();
+    }
+    nop = n;
+    atoms.resize(nop);
+    for(int ti=0; ti<nop; ti++){
+        atoms.posx[ti] = pos(ti, 0);
+        atoms.posy[ti] = pos(ti, 1);
+        atoms.posz[ti] = pos(ti, 2);
+        atoms.type[ti] = typ(ti);
+        atoms.id[ti] = idd(ti);
+    }
+
+    for(auto item : custom){
+        py::array vals = py::array::ensure(item.second);
+        if (!vals)
+            throw invalid_argument("custom values should be an array");
+        set_custom_column(item.first.cast<string>(), vals);
+    }
+
+    neighbors.reset(nop);
+    candidates.reset(nop);
+    nindex.invalidate();
+    neighbor_info_stored = 0;
+
+    ghost_nop = 0;
+    real_nop = nop;
+}
+
+void System::update_positions(py::array_t<double, py::array::c_style | py::array::forcecast> positions){
+    /*
+    Move the atoms to new positions of the same atoms, as for the next
+    frame of a trajectory. Everything else is kept, so that the cell list
+    keeps its storage and the Verlet list can be used again.
+    */
+    if ((positions.ndim() != 2) || (positions.shape(1) != 3))
+        throw invalid_argument("positions should be of shape natoms x 3");
+    if (positions.shape(0) != nop)
+        throw invalid_argument("positions should be given for all atoms of the system");
+
+    auto pos = positions.unchecked<2>();
+    for(int ti=0; ti<nop; ti++){
+        atoms.posx[ti] = pos(ti, 0);
+        atoms.posy[ti] = pos(ti, 1);
+        atoms.posz[ti] = pos(ti, 2);
+    }
+    nindex.invalidate();
+}
+
+void System::set_positions(py::array_t<double, py::array::c_style | py::array::forcecast> x,
+    py::array_t<double, py::array::c_style | py::array::forcecast> y,
+    py::array_t<double, py::array::c_style | py::array::forcecast> z){
+    /*
+    Copy new x, y and z coordinates of all atoms into the system, the
+    counterpart of the read only position views. Like update_positions,
+    the atoms keep everything else.
+    */
+    if ((x.ndim() != 1) || (y.ndim() != 1) || (z.ndim() != 1))
+        throw invalid_argument("x, y and z should be one dimensional");
+    if ((x.shape(0) != nop) || (y.shape(0) != nop) || (z.shape(0) != nop))
+        throw invalid_argument("positions should be given for all atoms of the system");
+
+    auto xx = x.unchecked<1>();
+    auto yy = y.unchecked<1>();
+    auto zz = z.unchecked<1>();
+    for(int ti=0; ti<nop; ti++){
+        atoms.posx[ti] = xx(ti);
+        atoms.posy[ti] = yy(ti);
+        atoms.posz[ti] = zz(ti);
+    }
+    nindex.invalidate();
+}
+
+void System::set_custom_column(string key, py::array values){
+    /*
+    Set a custom value for all atoms. Float arrays are stored as double,
+    integer and bool arrays as int, all other arrays are converted value
+    by value, which allows strings and lists. A number column of the same
+    kind is overwritten in place, so that views on it stay valid.
+    */
+    if ((values.ndim() != 1) || (values.shape(0) != nop))
+        throw invalid_argument("custom values should be of length natoms");
+
+    char kind = values.dtype().kind();
+    int colkind = (kind == 'f') ? CustomColumn::DOUBLE : CustomColumn::INT;
+    auto it = atoms.custom.find(key);
+    bool inplace = (it != atoms.custom.end()) && (it->second.kind == colkind) &&
+        ((kind == 'f') || (kind == 'i') || (kind == 'u') || (kind == 'b'));
+    if (!inplace) atoms.erase_custom(key);
+    if (nop == 0) return;
+
+    if (kind == 'f'){
+        auto vals = py::array_t<double, py::array::forcecast>(values).unchecked<1>();
+        CustomColumn &col = atoms.custom_column(key, CustomColumn::DOUBLE);
+        for(int ti=0; ti<nop; ti++){
+            col.dvals[ti] = vals(ti);
+            col.has[ti] = 1;
+        }
+    }
+    else if ((kind == 'i') || (kind == 'u') || (kind == 'b')){
+        auto vals = py::array_t<long long, py::array::forcecast>(values).unchecked<1>();
+        CustomColumn &col = atoms.custom_column(key, CustomColumn::INT);
+        for(int ti=0; ti<nop; ti++){
+            col.ivals[ti] = vals(ti);
+            col.has[ti] = 1;
+        }
+    }
+    else{
+        py::list vals = values.attr("tolist")();
+        CustomColumn &col = atoms.custom_column(key, vals[0].cast<customvalue>().index());
+        for(int ti=0; ti<nop; ti++){
+            col.set(ti, vals[ti].cast<customvalue>());
+        }
+    }
+}
+
+vector<string> System::get_custom_keys(){
+
+    vector<string> keys;
+    for(auto &col : atoms.custom){
+        keys.emplace_back(col.first);
+    }
+    return keys;
+}
+
+CustomColumn& System::get_custom_column(string key){
+
+    auto it = atoms.custom.find(key);
+    if (it == atoms.custom.end())
+        throw invalid_argument("custom key was not found");
+    return it->second;
+}
+
+void System::set_condition_from_custom(string key){
+    /*
+    Use a numeric custom value as condition of all atoms
+    */
+    CustomColumn &col = get_custom_column(key);
+    for(int ti=0; ti<nop; ti++){
+        atoms.condition[ti] = int(col.number(ti));
+    }
+}
+
 //this function allows for handling custom formats of atoms and so on
 vector<Atom> System::get_atoms( ){
     //here, we have to filter ghost atoms
     vector<Atom> retatoms;
+    retatoms.reserve(real_nop);
     for(int i=0; i<real_nop; i++){
-        retatoms.emplace_back(atoms[i]);
+        retatoms.emplace_back(gatom(i));
     }
     return retatoms;
 
@@ -157,97 +497,378 @@ vector<Atom> System::get_atoms( ){
 
 void System::add_atoms(vector<Atom> atomitos){
 
-    
-
-    //check for ghost atoms
-    int tg = 0;
-    int tl = 0;
+    //gather the current atoms, the new ones are added and
+    //the real atoms are put before the ghost atoms
+    vector<Atom> real_atoms;
+    vector<Atom> ghost_atoms;
 
-    for(int i=0; i<atomitos.size(); i++){
-        if(atomitos[i].ghost==0){
-            tl++;
+    for(int i=0; i<nop; i++){
+        if(atoms.ghost[i]==0){
+            real_atoms.emplace_back(gatom(i));
         }
         else{
-            tg++;
-        }
-    }
-
-    //if there is are no ghosts in system and list, just add and forget
-    if(ghost_nop==0){
-        if(tg==0){
-            for (int i=0; i<atomitos.size(); i++){
-                atoms.emplace_back(atomitos[i]);
-            }            
+            ghost_atoms.emplace_back(gatom(i));
         }
     }
-    else if (ghost_nop>0){
-        //now the atoms need to be reordered
-        vector<Atom> real_atoms;
-        vector<Atom> ghost_atoms;        
-        
-        for(int i=0; i<nop; i++){
-            if(atoms[i].ghost==0){
-                real_atoms.emplace_back(atoms[i]);
-            }
-            else{
-                ghost_atoms.emplace_back(atoms[i]);
-            }
-        }
-        //now also add new atoms to the list
-        for (int i=0; i<atomitos.size(); i++){
-            if(atomitos[i].ghost==0){
-                real_atoms.emplace_back(atomitos[i]);
-            }
-            else{
-                ghost_atoms.emplace_back(atomitos[i]);
-            }            
-        }
-        //now put them all in the big list
-        atoms.clear();
-
-        for(int i=0; i<real_atoms.size(); i++){
-            atoms.emplace_back(real_atoms[i]);
+    for (int i=0; i<atomitos.size(); i++){
+        if(atomitos[i].ghost==0){
+            real_atoms.emplace_back(atomitos[i]);
         }
-        for(int i=0; i<ghost_atoms.size(); i++){
-            atoms.emplace_back(ghost_atoms[i]);
+        else{
+            ghost_atoms.emplace_back(atomitos[i]);
         }
-
-        //we can clear now
-        real_atoms.clear();
-        ghost_atoms.clear();
     }
+    for(int i=0; i<ghost_atoms.size(); i++){
+        real_atoms.emplace_back(ghost_atoms[i]);
+    }
+    ghost_atoms.clear();
 
-    //update 
-    ghost_nop = ghost_nop + tg;
-    real_nop = real_nop + tl;
-    nop = nop + atomitos.size();
+    //now put them all in the store, this updates the counts
+    set_atoms(real_atoms);
 }
 
 
 vector<Atom> System::get_all_atoms( ){
     //here, we have to filter ghost atoms
     vector<Atom> retatoms;
+    retatoms.reserve(nop);
     for(int i=0; i<nop; i++){
-        retatoms.emplace_back(atoms[i]);
+        retatoms.emplace_back(gatom(i));
     }
     return retatoms;
 
 }
 
-Atom System::gatom(int i) { return atoms[i]; }
+Atom System::gatom(int i) {
+    Atom atom1(vector<double>{atoms.posx[i], atoms.posy[i], atoms.posz[i]}, atoms.id[i], atoms.type[i]);
+    gather_atom(i, atom1);
+    return atom1;
+}
+
 void System::satom(Atom atom1) {
     int idd = atom1.loc;
-    atoms[idd] = atom1;
+    //the neighbor index only holds while no atom moves
+    if ((atoms.posx[idd] != atom1.posx) || (atoms.posy[idd] != atom1.posy) || (atoms.posz[idd] != atom1.posz)){
+        nindex.invalidate();
+    }
+    scatter_atom(idd, atom1);
+
+    //neighbors of a single atom, the row is only moved if its size changes
+    neighbors.replace_row(idd, atom1.neighbors, atom1.neighbordist, atom1.neighborweight,
+        atom1.n_diffx, atom1.n_diffy, atom1.n_diffz, atom1.sij);
+}
+
+void System::gather_atom(int ti, Atom &atom1){
+    /*
+    Copy all values of the atom at location ti from the store
+    into an Atom object.
+    */
+    int nn, start, qq;
+
+    atom1.loc = ti;
+    atom1.posx = atoms.posx[ti];
+    atom1.posy = atoms.posy[ti];
+    atom1.posz = atoms.posz[ti];
+    atom1.id = atoms.id[ti];
+    atom1.type = atoms.type[ti];
+    atom1.ghost = atoms.ghost[ti];
+    atom1.condition = atoms.condition[ti];
+    atom1.mask = atoms.mask[ti];
+    atom1.custom.clear();
+    for(auto &col : atoms.custom){
+        if (col.second.has[ti]) atom1.custom[col.first] = col.second.value(ti);
+    }
+    atom1.cutoff = atoms.cutoff[ti];
+
+    //neighbors
+    nn = neighbors.count(ti);
+    start = neighbors.begin(ti);
+    neighbors.ensure_angles(nthreads);
+    atom1.resize_neighbors(nn);
+    for(int i=0; i<nn; i++){
+        atom1.neighbors[i] = neighbors.index[start+i];
+        atom1.neighbordist[i] = neighbors.dist[start+i];
+        atom1.neighborweight[i] = neighbors.weight[start+i];
+        atom1.n_diffx[i] = neighbors.diffx[start+i];
+        atom1.n_diffy[i] = neighbors.diffy[start+i];
+        atom1.n_diffz[i] = neighbors.diffz[start+i];
+        atom1.n_r[i] = neighbors.r[start+i];
+        atom1.n_phi[i] = neighbors.phi[start+i];
+        atom1.n_theta[i] = neighbors.theta[start+i];
+        atom1.sij[i] = neighbors.sij[start+i];
+    }
+    if ((nn > 0) && neighbors.has_faces()){
+        atom1.facevertices.assign(neighbors.facevertices.begin()+start, neighbors.facevertices.begin()+start+nn);
+        atom1.faceperimeters.assign(neighbors.faceperimeters.begin()+start, neighbors.faceperimeters.begin()+start+nn);
+    }
+    if ((nn > 0) && neighbors.has_cna()){
+        atom1.cna.resize(nn);
+        for(int i=0; i<nn; i++){
+            atom1.cna[i].assign(neighbors.cna.begin()+4*(start+i), neighbors.cna.begin()+4*(start+i+1));
+        }
+    }
+    if (atoms.common.size() == nop) atom1.common = atoms.common[ti];
+    if (atoms.bonds.size() == nop) atom1.bonds = atoms.bonds[ti];
+    if (neighbor_info_stored){
+        atom1.next_neighbors.resize(nn);
+        atom1.next_neighbor_distances.resize(nn);
+        atom1.next_neighbor_counts.resize(nn);
+        for(int i=0; i<nn; i++){
+            int tj = neighbors.index[start+i];
+            atom1.next_neighbor_counts[i] = neighbors.count(tj);
+            atom1.next_neighbors[i].assign(neighbors.index.begin()+neighbors.begin(tj), neighbors.index.begin()+neighbors.end(tj));
+            atom1.next_neighbor_distances[i].assign(neighbors.dist.begin()+neighbors.begin(tj), neighbors.dist.begin()+neighbors.end(tj));
+        }
+    }
+
+    //q parameters, only those which are calculated
+    for(int l=0; l<11; l++){
+        qq = l+2;
+        if (atoms.q[l].size() == nop){
+            atom1.q[l] = atoms.q[l][ti];
+            for(int mi=0; mi<2*qq+1; mi++){
+                atom1.realq[l][mi] = atoms.realq[l][AtomStore::qlm_index(ti, qq, mi)];
+                atom1.imgq[l][mi] = atoms.imgq[l][AtomStore::qlm_index(ti, qq, mi)];
+            }
+        }
+        if (atoms.aq[l].size() == nop){
+            atom1.aq[l] = atoms.aq[l][ti];
+            for(int mi=0; mi<2*qq+1; mi++){
+                atom1.arealq[l][mi] = atoms.arealq[l][AtomStore::qlm_index(ti, qq, mi)];
+                atom1.aimgq[l][mi] = atoms.aimgq[l][AtomStore::qlm_index(ti, qq, mi)];
+            }
+        }
+        if (atoms.w[l].size() == nop){
+            atom1.w[l] = atoms.w[l][ti];
+            atom1.wnorm[l] = atoms.wnorm[l][ti];
+        }
+        if (atoms.aw[l].size() == nop){
+            atom1.aw[l] = atoms.aw[l][ti];
+            atom1.awnorm[l] = atoms.awnorm[l][ti];
+        }
+    }
+    atom1.sii = atoms.sii[ti];
+    atom1.disorder = atoms.disorder[ti];
+    atom1.avgdisorder = atoms.avgdisorder[ti];
+
+    //solids
+    atom1.frenkelnumber = atoms.frenkelnumber[ti];
+    atom1.avq6q6 = atoms.avq6q6[ti];
+    atom1.belongsto = atoms.belongsto[ti];
+    atom1.lcluster = atoms.lcluster[ti];
+    atom1.issurface = atoms.issurface[ti];
+    atom1.issolid = atoms.issolid[ti];
+    atom1.structure = atoms.structure[ti];
+
+    //voronoi
+    atom1.volume = atoms.volume[ti];
+    atom1.avgvolume = atoms.avgvolume[ti];
+    atom1.n3 = atoms.vorovector[4*ti];
+    atom1.n4 = atoms.vorovector[4*ti+1];
+    atom1.n5 = atoms.vorovector[4*ti+2];
+    atom1.n6 = atoms.vorovector[4*ti+3];
+    if (atoms.vertex_vectors.size() == nop) atom1.vertex_vectors = atoms.vertex_vectors[ti];
+    if (atoms.vertex_numbers.size() == nop) atom1.vertex_numbers = atoms.vertex_numbers[ti];
+    if (atoms.vertex_positions.size() == nop) atom1.vertex_positions = atoms.vertex_positions[ti];
+    if (atoms.edgelengths.size() == nop) atom1.edgelengths = atoms.edgelengths[ti];
+
+    //others
+    atom1.angular = atoms.angular[ti];
+    atom1.avg_angular = atoms.avg_angular[ti];
+    if (atoms.chiparams.size() == nop) atom1.chiparams = atoms.chiparams[ti];
+    if (atoms.sro.size() == nop) atom1.sro = atoms.sro[ti];
+    atom1.centrosymmetry = atoms.centrosymmetry[ti];
+    atom1.entropy = atoms.entropy[ti];
+    atom1.avg_entropy = atoms.avg_entropy[ti];
+    atom1.energy = atoms.energy[ti];
+    atom1.avg_energy = atoms.avg_energy[ti];
+}
+
+void System::scatter_atom(int ti, Atom &atom1){
+    /*
+    Copy all per atom values of an Atom object into the store at
+    location ti. Neighbors are handled by scatter_neighbors or satom.
+    */
+    int qq;
+
+    atoms.posx[ti] = atom1.posx;
+    atoms.posy[ti] = atom1.posy;
+    atoms.posz[ti] = atom1.posz;
+    atoms.id[ti] = atom1.id;
+    atoms.type[ti] = atom1.type;
+    atoms.ghost[ti] = atom1.ghost;
+    atoms.condition[ti] = atom1.condition;
+    atoms.mask[ti] = atom1.mask;
+    for(auto &col : atoms.custom){
+        col.second.has[ti] = 0;
+    }
+    for(auto &val : atom1.custom){
+        atoms.check_custom(val.first, val.second.index());
+        atoms.custom_column(val.first, val.second.index()).set(ti, val.second);
+    }
+    atoms.cutoff[ti] = atom1.cutoff;
+
+    //q parameters, a column is created once any atom carries a value
+    for(int l=0; l<11; l++){
+        qq = l+2;
+        if ((atoms.q[l].size() == nop) || (atom1.q[l] != -1)){
+            atoms.ensure_q(qq);
+            atoms.q[l][ti] = atom1.q[l];
+            for(int mi=0; mi<2*qq+1; mi++){
+                atoms.realq[l][AtomStore::qlm_index(ti, qq, mi)] = atom1.realq[l][mi];
+                atoms.imgq[l][AtomStore::qlm_index(ti, qq, mi)] = atom1.imgq[l][mi];
+            }
+        }
+        if ((atoms.aq[l].size() == nop) || (atom1.aq[l] != -1)){
+            atoms.ensure_aq(qq);
+            atoms.aq[l][ti] = atom1.aq[l];
+            for(int mi=0; mi<2*qq+1; mi++){
+                atoms.arealq[l][AtomStore::qlm_index(ti, qq, mi)] = atom1.arealq[l][mi];
+                atoms.aimgq[l][AtomStore::qlm_index(ti, qq, mi)] = atom1.aimgq[l][mi];
+            }
+        }
+        if ((atoms.w[l].size() == nop) || (atom1.w[l] != -1)){
+            atoms.ensure_w(qq, false);
+            atoms.w[l][ti] = atom1.w[l];
+            atoms.wnorm[l][ti] = atom1.wnorm[l];
+        }
+        if ((atoms.aw[l].size() == nop) || (atom1.aw[l] != -1)){
+            atoms.ensure_w(qq, true);
+            atoms.aw[l][ti] = atom1.aw[l];
+            atoms.awnorm[l][ti] = atom1.awnorm[l];
+        }
+    }
+    atoms.sii[ti] = atom1.sii;
+    atoms.disorder[ti] = atom1.disorder;
+    atoms.avgdisorder[ti] = atom1.avgdisorder;
+
+    //solids
+    atoms.frenkelnumber[ti] = atom1.frenkelnumber;
+    atoms.avq6q6[ti] = atom1.avq6q6;
+    atoms.belongsto[ti] = atom1.belongsto;
+    atoms.lcluster[ti] = atom1.lcluster;
+    atoms.issurface[ti] = atom1.issurface;
+    atoms.issolid[ti] = atom1.issolid;
+    atoms.structure[ti] = atom1.structure;
+
+    //voronoi
+    atoms.volume[ti] = atom1.volume;
+    atoms.avgvolume[ti] = atom1.avgvolume;
+    atoms.vorovector[4*ti] = atom1.n3;
+    atoms.vorovector[4*ti+1] = atom1.n4;
+    atoms.vorovector[4*ti+2] = atom1.n5;
+    atoms.vorovector[4*ti+3] = atom1.n6;
+    if ((atoms.vertex_vectors.size() == nop) || (atom1.vertex_vectors.size() > 0)){
+        AtomStore::ensure_column(atoms.vertex_vectors, nop);
+        atoms.vertex_vectors[ti] = atom1.vertex_vectors;
+    }
+    if ((atoms.vertex_numbers.size() == nop) || (atom1.vertex_numbers.size() > 0)){
+        AtomStore::ensure_column(atoms.vertex_numbers, nop);
+        atoms.vertex_numbers[ti] = atom1.vertex_numbers;
+    }
+    if ((atoms.vertex_positions.size() == nop) || (atom1.vertex_positions.size() > 0)){
+        AtomStore::ensure_column(atoms.vertex_positions, nop);
+        atoms.vertex_positions[ti] = atom1.vertex_positions;
+    }
+    if ((atoms.edgelengths.size() == nop) || (atom1.edgelengths.size() > 0)){
+        AtomStore::ensure_column(atoms.edgelengths, nop);
+        atoms.edgelengths[ti] = atom1.edgelengths;
+    }
+    if ((atoms.common.size() == nop) || (atom1.common.size() > 0)){
+        AtomStore::ensure_column(atoms.common, nop);
+        atoms.common[ti] = atom1.common;
+    }
+    if ((atoms.bonds.size() == nop) || (atom1.bonds.size() > 0)){
+        AtomStore::ensure_column(atoms.bonds, nop);
+        atoms.bonds[ti] = atom1.bonds;
+    }
+
+    //others
+    atoms.angular[ti] = atom1.angular;
+    atoms.avg_angular[ti] = atom1.avg_angular;
+    if ((atoms.chiparams.size() == nop) || (atom1.chiparams.size() > 0)){
+        AtomStore::ensure_column(atoms.chiparams, nop);
+        atoms.chiparams[ti] = atom1.chiparams;
+    }
+    if ((atoms.sro.size() == nop) || (atom1.sro.size() > 0)){
+        AtomStore::ensure_column(atoms.sro, nop);
+        atoms.sro[ti] = atom1.sro;
+    }
+    atoms.centrosymmetry[ti] = atom1.centrosymmetry;
+    atoms.entropy[ti] = atom1.entropy;
+    atoms.avg_entropy[ti] = atom1.avg_entropy;
+    atoms.energy[ti] = atom1.energy;
+    atoms.avg_energy[ti] = atom1.avg_energy;
+}
+
+void System::scatter_neighbors(vector<Atom> &atomitos){
+    /*
+    Rebuild the neighbor table from the neighbors of a list
+    of Atom objects.
+    */
+    int nn, start, nb;
+    bool faces = true;
+    bool cna = true;
+
+    neighbors.reset(nop);
+    for(int ti=0; ti<nop; ti++){
+        nn = atomitos[ti].neighbors.size();
+        neighbors.offsets[ti+1] = neighbors.offsets[ti] + nn;
+        if ((atomitos[ti].facevertices.size() != nn) || (atomitos[ti].faceperimeters.size() != nn)) faces = false;
+        if (atomitos[ti].cna.size() != nn) cna = false;
+    }
+    nb = neighbors.offsets[nop];
+    if (nb == 0) return;
+
+    neighbors.check_views(nop, nb);
+    neighbors.index.resize(nb);
+    neighbors.dist.resize(nb);
+    neighbors.weight.resize(nb);
+    neighbors.diffx.resize(nb);
+    neighbors.diffy.resize(nb);
+    neighbors.diffz.resize(nb);
+    neighbors.sij.resize(nb);
+    if (faces){
+        neighbors.facevertices.resize(nb);
+        neighbors.faceperimeters.resize(nb);
+    }
+    if (cna) neighbors.cna.resize(4*nb);
+
+    for(int ti=0; ti<nop; ti++){
+        Atom &atom1 = atomitos[ti];
+        nn = neighbors.count(ti);
+        start = neighbors.begin(ti);
+        //all per neighbor vectors of an Atom are of the same length
+        atom1.resize_neighbors(nn);
+        for(int i=0; i<nn; i++){
+            neighbors.index[start+i] = atom1.neighbors[i];
+            neighbors.dist[start+i] = atom1.neighbordist[i];
+            neighbors.weight[start+i] = atom1.neighborweight[i];
+            neighbors.diffx[start+i] = atom1.n_diffx[i];
+            neighbors.diffy[start+i] = atom1.n_diffy[i];
+            neighbors.diffz[start+i] = atom1.n_diffz[i];
+            neighbors.sij[start+i] = atom1.sij[i];
+            if (faces){
+                neighbors.facevertices[start+i] = atom1.facevertices[i];
+                neighbors.faceperimeters[start+i] = atom1.faceperimeters[i];
+            }
+            if (cna){
+                for(int k=0; k<4; k++){
+                    neighbors.cna[4*(start+i)+k] = (k < atom1.cna[i].size()) ? atom1.cna[i][k] : 0;
+                }
+            }
+        }
+    }
 }
 
 //----------------------------------------------------
 // Neighbor methods
 //----------------------------------------------------
 double System::get_angle(int ti ,int tj,int tk){
-    vector<double> a, b;
+    vector<double> a(3), b(3);
     double a_abs, b_abs, adotb, theta;
-    a = get_distance_vector(atoms[tj], atoms[ti]);
-    b = get_distance_vector(atoms[tk], atoms[ti]);
+    get_abs_distance(ti, tj, a[0], a[1], a[2]);
+    get_abs_distance(ti, tk, b[0], b[1], b[2]);
     a_abs = pow((a[0] * a[0] + a[1] * a[1] + a[2] * a[2]), 0.5);
     b_abs = pow((b[0] * b[0] + b[1] * b[1] + b[2] * b[2]), 0.5);
     adotb = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
@@ -256,190 +877,152 @@ double System::get_angle(int ti ,int tj,int tk){
     return a[0];
 }
 double System::get_abs_distance(int ti ,int tj,double &diffx ,double &diffy,double &diffz){
-    //这东西算triclinic 的最短距离是有问题的，有的点即使在八分之一胞内，又可能距离不是最近的，可能平移之后更近
-    //这个函数主要用在两个地方，一个是搜neighbor，一个是算pdf
-    //考虑在他在py读取文件的时候给扩胞了，如果扩的胞与所计算的长度范围相比足够大，则在计算neighbor 的时候不会出现问题
-    //但是在计算pdf 的时候，关于triclinic距离计算不准的问题无论如何都会产生的。
-    //因此在计算pdf的时候如果晶胞是三斜的，则我将包含此函数的算法禁用。
-
-    double abs, ax, ay, az;
-    diffx = atoms[tj].posx - atoms[ti].posx;
-    diffy = atoms[tj].posy - atoms[ti].posy;
-    diffz = atoms[tj].posz - atoms[ti].posz;
+    //nearest image of atom tj seen from atom ti, exact for any shear
+    //of a triclinic box since images are taken along the reduced box
 
-    if (triclinic == 1){
-
-        //convert to the triclinic system
-        ax = rotinv[0][0]*diffx + rotinv[0][1]*diffy + rotinv[0][2]*diffz;
-        ay = rotinv[1][0]*diffx + rotinv[1][1]*diffy + rotinv[1][2]*diffz;
-        az = rotinv[2][0]*diffx + rotinv[2][1]*diffy + rotinv[2][2]*diffz;
-
-        //scale to match the triclinic box size
-        diffx = ax*boxx;
-        diffy = ay*boxy;
-        diffz = az*boxz;
+    diffx = atoms.posx[tj] - atoms.posx[ti];
+    diffy = atoms.posy[tj] - atoms.posy[ti];
+    diffz = atoms.posz[tj] - atoms.posz[ti];
+    return minimum_image(diffx, diffy, diffz);
+}
 
-        //now check pbc
-        //nearest image
-        if (diffx> boxx/2.0) {diffx-=boxx;};
-        if (diffx<-boxx/2.0) {diffx+=boxx;};
-        if (diffy> boxy/2.0) {diffy-=boxy;};
-        if (diffy<-boxy/2.0) {diffy+=boxy;};
-        if (diffz> boxz/2.0) {diffz-=boxz;};
-        if (diffz<-boxz/2.0) {diffz+=boxz;};
+//apply the nearest image convention to a difference vector in place
+//and return its length
+double System::minimum_image(double &diffx, double &diffy, double &diffz){
 
-        //now divide by box vals - scale down the size
-        diffx = diffx/boxx;
-        diffy = diffy/boxy;
-        diffz = diffz/boxz;
+    double abs, ax, ay, az;
 
-        //now transform back to normal system
-        ax = rot[0][0]*diffx + rot[0][1]*diffy + rot[0][2]*diffz;
-        ay = rot[1][0]*diffx + rot[1][1]*diffy + rot[1][2]*diffz;
-        az = rot[2][0]*diffx + rot[2][1]*diffy + rot[2][2]*diffz;
+    if (triclinic == 1){
 
-        //now assign to diffs and calculate distnace
+        //to fractional coordinates of the reduced box, the
+        //box policy then finds the nearest image
+        tribox.coords(diffx, diffy, diffz, ax, ay, az);
+        tribox.image(ax, ay, az);
         diffx = ax;
         diffy = ay;
         diffz = az;
-
-        //finally distance
         abs = sqrt(diffx*diffx + diffy*diffy + diffz*diffz);
 
     }
     else{
-        //nearest image
-        if (diffx> boxx/2.0) {diffx-=boxx;};
-        if (diffx<-boxx/2.0) {diffx+=boxx;};
-        if (diffy> boxy/2.0) {diffy-=boxy;};
-        if (diffy<-boxy/2.0) {diffy+=boxy;};
-        if (diffz> boxz/2.0) {diffz-=boxz;};
-        if (diffz<-boxz/2.0) {diffz+=boxz;};
+        //nearest image, only along periodic directions
+        if (periodic[0]){
+            if (diffx> boxx/2.0) {diffx-=boxx;};
+            if (diffx<-boxx/2.0) {diffx+=boxx;};
+        }
+        if (periodic[1]){
+            if (diffy> boxy/2.0) {diffy-=boxy;};
+            if (diffy<-boxy/2.0) {diffy+=boxy;};
+        }
+        if (periodic[2]){
+            if (diffz> boxz/2.0) {diffz-=boxz;};
+            if (diffz<-boxz/2.0) {diffz+=boxz;};
+        }
         abs = sqrt(diffx*diffx + diffy*diffy + diffz*diffz);
     }
     return abs;
 }
 
-//function for binding
-double System::get_abs_distance(Atom atom1 , Atom atom2 ){
-
-    double abs, ax, ay, az;
-    double diffx = atom1.posx - atom2.posx;
-    double diffy = atom1.posy - atom2.posy;
-    double diffz = atom1.posz - atom2.posz;
-
+//fractional coordinates of a point, in units of the box vectors
+void System::fractional(double x, double y, double z, double &sx, double &sy, double &sz){
     if (triclinic == 1){
+        sx = latinv[0][0]*x + latinv[0][1]*y + latinv[0][2]*z;
+        sy = latinv[1][0]*x + latinv[1][1]*y + latinv[1][2]*z;
+        sz = latinv[2][0]*x + latinv[2][1]*y + latinv[2][2]*z;
+    }
+    else{
+        sx = x/boxx;
+        sy = y/boxy;
+        sz = z/boxz;
+    }
+}
 
-        //convert to the triclinic system
-        ax = rotinv[0][0]*diffx + rotinv[0][1]*diffy + rotinv[0][2]*diffz;
-        ay = rotinv[1][0]*diffx + rotinv[1][1]*diffy + rotinv[1][2]*diffz;
-        az = rotinv[2][0]*diffx + rotinv[2][1]*diffy + rotinv[2][2]*diffz;
-
-        //scale to match the triclinic box size
-        diffx = ax*boxx;
-        diffy = ay*boxy;
-        diffz = az*boxz;
-
-        //now check pbc
-        //nearest image
-        if (diffx> boxx/2.0) {diffx-=boxx;};
-        if (diffx<-boxx/2.0) {diffx+=boxx;};
-        if (diffy> boxy/2.0) {diffy-=boxy;};
-        if (diffy<-boxy/2.0) {diffy+=boxy;};
-        if (diffz> boxz/2.0) {diffz-=boxz;};
-        if (diffz<-boxz/2.0) {diffz+=boxz;};
-
-        //now divide by box vals - scale down the size
-        diffx = diffx/boxx;
-        diffy = diffy/boxy;
-        diffz = diffz/boxz;
-
-        //now transform back to normal system
-        ax = rot[0][0]*diffx + rot[0][1]*diffy + rot[0][2]*diffz;
-        ay = rot[1][0]*diffx + rot[1][1]*diffy + rot[1][2]*diffz;
-        az = rot[2][0]*diffx + rot[2][1]*diffy + rot[2][2]*diffz;
+//fractional coordinates of all atoms, three per atom
+void System::fractional_positions(vector<double> &frac){
+    frac.resize(3*nop);
+    for(int ti=0; ti<nop; ti++){
+        fractional(atoms.posx[ti], atoms.posy[ti], atoms.posz[ti], frac[3*ti], frac[3*ti+1], frac[3*ti+2]);
+    }
+}
 
-        //now assign to diffs and calculate distnace
-        diffx = ax;
-        diffy = ay;
-        diffz = az;
+OrthogonalBox System::orthogonal_box(){
+    OrthogonalBox bx;
+    bx.l[0] = boxx;
+    bx.l[1] = boxy;
+    bx.l[2] = boxz;
+    for(int a=0; a<3; a++){
+        bx.il[a] = (periodic[a]) ? 1.0/bx.l[a] : 0.0;
+    }
+    return bx;
+}
 
-        //finally distance
-        abs = sqrt(diffx*diffx + diffy*diffy + diffz*diffz);
+TriclinicBox System::triclinic_box(){
+    return tribox;
+}
 
+void System::find_images(int ti, int tj, double rc, const vector<double> &frac, vector<datom> &imgs){
+    /*
+    Append every periodic image of atom tj which is closer than rc to atom ti,
+    with the vector from ti to it. An image can only be within rc if its
+    offset along each box vector, measured normal to the opposite faces, is
+    within rc, which limits the images to check for any shape of box and
+    any cutoff. The atom itself is skipped, but not its own images. frac
+    holds the fractional coordinates from fractional_positions. There are
+    no images along directions which are not periodic.
+    */
+    double ds[3];
+    int q0[3], q1[3];
+    double fx, fy, fz, dx, dy, dz, d;
+
+    for(int a=0; a<3; a++){
+        ds[a] = frac[3*tj+a] - frac[3*ti+a];
+        if (!periodic[a]){
+            q0[a] = q1[a] = 0;
+            continue;
+        }
+        ds[a] -= round(ds[a]);
+        q0[a] = (int)ceil(-rc/heights[a] - ds[a]);
+        q1[a] = (int)floor(rc/heights[a] - ds[a]);
     }
-    else{
 
-        //nearest image
-        if (diffx> boxx/2.0) {diffx-=boxx;};
-        if (diffx<-boxx/2.0) {diffx+=boxx;};
-        if (diffy> boxy/2.0) {diffy-=boxy;};
-        if (diffy<-boxy/2.0) {diffy+=boxy;};
-        if (diffz> boxz/2.0) {diffz-=boxz;};
-        if (diffz<-boxz/2.0) {diffz+=boxz;};
-        abs = sqrt(diffx*diffx + diffy*diffy + diffz*diffz);
+    for(int qi=q0[0]; qi<=q1[0]; qi++){
+        for(int qj=q0[1]; qj<=q1[1]; qj++){
+            for(int qk=q0[2]; qk<=q1[2]; qk++){
+                if ((ti == tj) && (qi == 0) && (qj == 0) && (qk == 0)) continue;
+                fx = ds[0] + qi;
+                fy = ds[1] + qj;
+                fz = ds[2] + qk;
+                dx = fx*lattice[0][0] + fy*lattice[1][0] + fz*lattice[2][0];
+                dy = fx*lattice[0][1] + fy*lattice[1][1] + fz*lattice[2][1];
+                dz = fx*lattice[0][2] + fy*lattice[1][2] + fz*lattice[2][2];
+                d = sqrt(dx*dx + dy*dy + dz*dz);
+                if (d < rc){
+                    datom x = {d, tj, dx, dy, dz};
+                    imgs.emplace_back(x);
+                }
+            }
+        }
     }
+}
 
-    return abs;
+//function for binding
+double System::get_abs_distance(Atom atom1 , Atom atom2 ){
+
+    double diffx = atom1.posx - atom2.posx;
+    double diffy = atom1.posy - atom2.posy;
+    double diffz = atom1.posz - atom2.posz;
+
+    return minimum_image(diffx, diffy, diffz);
 }
 
 //function for binding
 vector<double> System::get_distance_vector(Atom atom1 , Atom atom2 ){
 
-    double ax, ay, az;
     double diffx = atom1.posx - atom2.posx;
     double diffy = atom1.posy - atom2.posy;
     double diffz = atom1.posz - atom2.posz;
 
-    if (triclinic == 1){
-
-        //convert to the triclinic system
-        ax = rotinv[0][0]*diffx + rotinv[0][1]*diffy + rotinv[0][2]*diffz;
-        ay = rotinv[1][0]*diffx + rotinv[1][1]*diffy + rotinv[1][2]*diffz;
-        az = rotinv[2][0]*diffx + rotinv[2][1]*diffy + rotinv[2][2]*diffz;
-
-      double dummy;
-        //scale to match the triclinic box size
-        diffx = ax*boxx;
-        diffy = ay*boxy;
-        diffz = az*boxz;
-
-        //now check pbc
-        //nearest image
-        if (diffx> boxx/2.0) {diffx-=boxx;};
-        if (diffx<-boxx/2.0) {diffx+=boxx;};
-        if (diffy> boxy/2.0) {diffy-=boxy;};
-        if (diffy<-boxy/2.0) {diffy+=boxy;};
-        if (diffz> boxz/2.0) {diffz-=boxz;};
-        if (diffz<-boxz/2.0) {diffz+=boxz;};
-
-        //now divide by box vals - scale down the size
-        diffx = diffx/boxx;
-        diffy = diffy/boxy;
-        diffz = diffz/boxz;
-
-        //now transform back to normal system
-        ax = rot[0][0]*diffx + rot[0][1]*diffy + rot[0][2]*diffz;
-        ay = rot[1][0]*diffx + rot[1][1]*diffy + rot[1][2]*diffz;
-        az = rot[2][0]*diffx + rot[2][1]*diffy + rot[2][2]*diffz;
-
-        //now assign to diffs and calculate distnace
-        diffx = ax;
-        diffy = ay;
-        diffz = az;
-
-    }
-    else{
-
-        //nearest image
-        if (diffx> boxx/2.0) {diffx-=boxx;};
-        if (diffx<-boxx/2.0) {diffx+=boxx;};
-        if (diffy> boxy/2.0) {diffy-=boxy;};
-        if (diffy<-boxy/2.0) {diffy+=boxy;};
-        if (diffz> boxz/2.0) {diffz-=boxz;};
-        if (diffz<-boxz/2.0) {diffz+=boxz;};
-
-    }
+    minimum_image(diffx, diffy, diffz);
 
     vector<double> abs;
     abs.emplace_back(diffx);
@@ -451,59 +1034,102 @@ vector<double> System::get_distance_vector(Atom atom1 , Atom atom2 ){
 
 
 void System::reset_all_neighbors(vector<int> atomlist){
-    int ti=0;
+    vector<char> skip(nop, 0);
     if (atomlist.size()==0)
     {
-        atomlist.resize(nop); 
-        for (int i = 0; i < nop; ++i)
-        {
-            atomlist[i] = i; 
-        }
+        skip.assign(nop, 1);
     }
     for (vector<int>::iterator it = atomlist.begin();it != atomlist.end();it++){
-        ti = *it;
-
-        atoms[ti].n_neighbors=0;
-        atoms[ti].temp_neighbors.clear();
-        atoms[ti].condition = 0;
+        skip[*it] = 1;
+    }
 
-        for (int tn = 0;tn<MAXNUMBEROFNEIGHBORS;tn++){
+    for (int ti = 0;ti<nop;ti++){
+        if (skip[ti]) atoms.condition[ti] = 0;
+    }
 
-            atoms[ti].neighbors[tn] = NILVALUE;
-            atoms[ti].neighbordist[tn] = -1.0;
-        }
+    //drop the rows of the neighbor table and the candidates
+    if (neighbors.offsets.size() != nop+1){
+        neighbors.reset(nop);
     }
+    else{
+        nbuilder.seed(neighbors, skip);
+        nbuilder.build(neighbors, nop);
+    }
+    if (candidates.offsets.size() != nop+1){
+        candidates.reset(nop);
+    }
+    else{
+        candidates.remove_rows(skip);
+    }
+    if (atomlist.size()==0){
+        halfneighbors.clear();
+    }
+    neighbor_info_stored = 0;
 }
 
 void System::reset_main_neighbors(){
     for (int ti = 0;ti<nop;ti++){
+        atoms.condition[ti] = 0;
+    }
+    neighbors.reset(nop);
+    neighbor_info_stored = 0;
+}
 
-        atoms[ti].n_neighbors=0;
-        atoms[ti].condition = 0;
-        //atoms[ti].temp_neighbors.clear();
+void System::begin_neighbor_build(){
+    /*
+    Neighbors added with process_neighbor are appended to the
+    existing neighbors of an atom
+    */
+    if (neighbors.offsets.size() != nop+1){
+        neighbors.reset(nop);
+    }
+    nbuilder.seed(neighbors);
+}
 
-        for (int tn = 0;tn<MAXNUMBEROFNEIGHBORS;tn++){
+void System::end_neighbor_build(){
+    nbuilder.build(neighbors, nop);
+}
 
-            atoms[ti].neighbors[tn] = NILVALUE;
-            atoms[ti].neighbordist[tn] = -1.0;
-        }
+void System::add_candidates(vector<int> &hosts, vector<datom> &cands){
+    candidates.merge(hosts, cands, nop, nthreads);
+}
+
+void System::add_candidate_parts(vector<vector<int>> &hosts, vector<vector<datom>> &cands){
+    /*
+    Concatenate the candidates found by several threads in order
+    and add them.
+    */
+    for(int t=1; t<hosts.size(); t++){
+        hosts[0].insert(hosts[0].end(), hosts[t].begin(), hosts[t].end());
+        cands[0].insert(cands[0].end(), cands[t].begin(), cands[t].end());
+        hosts[t].clear();
+        cands[t].clear();
     }
+    add_candidates(hosts[0], cands[0]);
 }
 
 
 vector<int> System::get_pairdistances(double cut,bool partial,int centertype,int secondtype,int histnum,double histlow,int threadnum){
 /*
-
-    1，这整套程序没有考虑一个cutoff球大于晶胞内切球的情况。他是通过在最开始初始化atoms的时候对于太小的晶胞扩到几千原子的晶胞来避免这个问题，对于cutoff搜索neighbor算法，由于一般的cutoff比较小，所以不出问题。
-    但是这里面存在一个问题，初始化atoms的时候对于正交晶胞我改写了一下算法，让他尽可能扩成一个正方的晶胞，但是对于三斜晶胞，这个扩胞方式还应该再写写。
-    2，在计算pdf的时候由于需要考虑长程，用来获得精细的结构因子我在程序中考虑了cutoff球大于晶胞内切球的情况，同时引入多线程：
-        对于非partial情况，同时cutoff球内切晶胞的情况，不扩胞，对原胞进行周期性复用，同时开启halftimes优化
-        对于partial情况，或者cutoff球大于晶胞内切球的情况，扩胞，此时无法采取对原晶胞周期性复用。原则上partial的cutoff球小于晶胞内切球也可以采用原胞复用，只不过不能开启halftimes，这个还没单独写。
+    Histogram of the pair distances between histlow and cut, without any
+    replicated copies of the box. The pairs come from sweep_pairs:
+    if the box is at least three cutoffs high along every periodic
+    direction the atoms are binned into cells of the cutoff and only
+    neighboring cells are searched. Otherwise cells of a fraction of the
+    cutoff are used, whose stencils reach over several periodic images
+    when the cutoff is beyond half the box, so no image loop is needed.
+    If such cells would test more pairs than the whole box, every pair
+    is tested directly in the coordinates of the box instead.
+    Every pair is seen once. A partial histogram counts it from each end of
+    the right types, so pdf_halftimes is only set for the total.
 */
 
 
     
-    //vector<int> threadflag(threadnum,0);
+    
+    //threads come from the shared pool, the user can
+    //ask for fewer or more than the default
+    if (threadnum < 1) threadnum = nthreads;
 
     pdfpara s;
     s.res = vector<int>(histnum, 0);
@@ -517,87 +1143,134 @@ vector<int> System::get_pairdistances(double cut,bool partial,int centertype,int
     s.secondtype=secondtype;
     s.histnum=histnum;
     s.histlow=histlow;
-    //线程相关
-
     s.threadnum=threadnum;
-    if (threadnum>1)
-    {
-        s.threadflag=(bool*)malloc(threadnum*sizeof(bool));
-        memset(s.threadflag, 0, threadnum * sizeof(bool));
-    }
-    int threadatomsper = (nop / threadnum);
-    vector<int> threadatoms(threadnum, threadatomsper);
-    if (threadnum * threadatomsper < nop)
-    {  
-        int t = nop - threadnum * threadatomsper;
-        for (int i = 0; i < t; i++)
-        {  
-            threadatoms[i]++;
+
+    //a pair at the cutoff goes to the last bin. Pairs are seen once, the
+    //partial histogram counts them from each end of the right types
+    auto count = [&](int threadid, int ti, int tj, double d_square){
+        if (d_square < s.histlow_square) return;
+        int k = min(int((sqrt(d_square) - s.histlow) / s.deltacut), s.histnum - 1);
+        if (!s.partial){
+            s.resthread[threadid][k]++;
+            return;
         }
-    }
-    int atomsstart=0;
-    //计算平行六面体的高
+        if ((atoms.type[ti] == s.centertype) && (atoms.type[tj] == s.secondtype)) s.resthread[threadid][k]++;
+        if ((atoms.type[tj] == s.centertype) && (atoms.type[ti] == s.secondtype)) s.resthread[threadid][k]++;
+    };
+    sweep_pairs(s, count);
 
-    if(triclinic==1)
+    for (int i = 0; i < histnum; i++)
     {
-        for(auto &m:s.index)
+        for (int j = 0; j < threadnum; j++)
         {
-            int k= m[0];
-            int i =m[1];
-            int j =m[2];
-            for(auto &m2:s.index)
-            {
-                int k2= m2[0];
-                int i2 =m2[1];
-                int j2 =m2[2];
-                s.iCrossj[k][k2]=box[i][i2]*box[j][j2]-box[i][j2]*box[j][i2];
-            }
+            s.res[i] += s.resthread[j][i];
         }
-        
-        for(int i=0;i<3;i++)
-        {
-            for(int j=0;j<3;j++)
-            {
-            s.iCrossjnorm[i]+= s.iCrossj[i][j]*s.iCrossj[i][j];
-            s.kdotiCrossj[i]+=box[i][j]*s.iCrossj[i][j];
-            }
-            s.iCrossjnorm[i]=pow(s.iCrossjnorm[i],0.5);
-            s.Height[i]=abs(s.kdotiCrossj[i]/s.iCrossjnorm[i]);
+    }
+    pdf_halftimes=!partial;
+    return s.res;
+}
+
+vector<vector<int>> System::get_pair_histograms(vector<double> cuts, vector<double> lows, vector<int> nbins, int threadnum){
+    /*
+    Histograms of the pair distances for every pair of types, for several
+    binnings at once, from one sweep over the pairs up to the largest cut.
+    Binning b has nbins[b] bins from lows[b] to cuts[b]. For each binning a
+    flat array of ntypes*ntypes*nbins[b] counts is returned, where ntypes is
+    one more than the largest type, and the count of bin k for the pairs
+    with center of type a and neighbor of type c is at (a*ntypes + c)*nbins[b] + k.
+    Pairs are ordered, a pair of atoms counts once as (a, c) and once as
+    (c, a), so that the counts of all types add up to twice those of
+    get_pairdistances.
+    */
+    int nb = cuts.size();
+    if ((nb == 0) || (lows.size() != nb) || (nbins.size() != nb)){
+        throw invalid_argument("cuts, lows and nbins should be of the same length, and not empty");
+    }
+    for (int b = 0; b < nb; b++){
+        if ((nbins[b] < 1) || (lows[b] < 0) || (lows[b] >= cuts[b])){
+            throw invalid_argument("every binning needs at least one bin and 0 <= low < cut");
         }
     }
-    else if(triclinic==0)
-    {   s.Height[0]=boxx;
-        s.Height[1]=boxy;
-        s.Height[2]=boxz;
+
+    int nt = 0;
+    for (int ti = 0; ti < nop; ti++){
+        if (atoms.type[ti] < 0){
+            throw invalid_argument("types should not be negative");
+        }
+        nt = max(nt, atoms.type[ti] + 1);
     }
-    if(partial==false && (cut/s.Height[0]<0.5) && (cut/s.Height[1]<0.5) &&(cut/s.Height[2]<0.5)){s.halftimes=true;}//开启半数优化
-    
-    
 
-    
-    /*if (s.halftimes == false) {
-        int threadid = 0;
-        for (int ti=0; ti<nop; ti++){
-            if(partial==true && atoms[ti].type!=centertype) { continue; }
-            //计算对于每个中心原子应该扩胞的范围
-            while(true){
-                pdfthreadflaglock.lock();
-                if (s.threadflag[threadid] == 0)
-                {
-                    s.threadflag[threadid] = 1;
-                    pdfthreadflaglock.unlock();
-                    break;
-                }
-                pdfthreadflaglock.unlock();
-                threadid++;
-                if(threadid==s.threadnum){threadid=0;}
-            }
-            thread theadcal(pairditancethread,ti,threadid,this,&s);
-            theadcal.detach();
-        }      
-    }*/
+    if (threadnum < 1) threadnum = nthreads;
 
+    pdfpara s;
+    s.cut = *max_element(cuts.begin(), cuts.end());
+    s.cut_square = s.cut*s.cut;
+    s.partial = false;
+    s.threadnum = threadnum;
+
+    vector<double> lowsq(nb), cutsq(nb), delta(nb);
+    for (int b = 0; b < nb; b++){
+        lowsq[b] = lows[b]*lows[b];
+        cutsq[b] = cuts[b]*cuts[b];
+        delta[b] = (cuts[b] - lows[b])/nbins[b];
+    }
+    //one set of histograms per thread
+    vector<vector<vector<int>>> hist(threadnum, vector<vector<int>>(nb));
+    for (int t = 0; t < threadnum; t++){
+        for (int b = 0; b < nb; b++){
+            hist[t][b].assign(nt*nt*nbins[b], 0);
+        }
+    }
+
+    auto count = [&](int threadid, int ti, int tj, double d_square){
+        int a = atoms.type[ti];
+        int c = atoms.type[tj];
+        double d = sqrt(d_square);
+        int k;
+        for (int b = 0; b < nb; b++){
+            if ((d_square < lowsq[b]) || (d_square > cutsq[b])) continue;
+            k = min(int((d - lows[b]) / delta[b]), nbins[b] - 1);
+            //a pair seen once is counted from both ends
+            hist[threadid][b][(a*nt + c)*nbins[b] + k]++;
+            hist[threadid][b][(c*nt + a)*nbins[b] + k]++;
+        }
+    };
+    sweep_pairs(s, count);
+
+    vector<vector<int>> res(nb);
+    for (int b = 0; b < nb; b++){
+        res[b].assign(nt*nt*nbins[b], 0);
+        for (int t = 0; t < threadnum; t++){
+            for (int i = 0; i < nt*nt*nbins[b]; i++){
+                res[b][i] += hist[t][b][i];
+            }
+        }
+    }
+    pdf_halftimes = false;
+    return res;
+}
 
+template <typename C>
+void System::sweep_pairs(pdfpara &s, C &count){
+    /*
+    Call count(threadid, ti, tj, d_square) for the pairs of atoms closer
+    than s.cut, on s.threadnum threads. Each pair is seen once for every
+    image of it within the cutoff, from one of its two ends, and so is
+    every pair of an atom with an image of itself. Pairs are seen in no
+    particular order.
+    */
+    double cut = s.cut;
+    int threadnum = s.threadnum;
+
+    //开启半数优化. If the cutoff is below half of every height of the
+    //reduced box no two images of an atom are within it, and a pair can be
+    //found from its nearest image. Directions which are not periodic have
+    //no images
+    bool thin = false;
+    for (int a = 0; a < 3; a++){
+        thin = thin || (periodic[a] && (cut/heights[a] >= 0.5));
+    }
+    
     /*
     if(cut==0)
     {
@@ -611,147 +1284,342 @@ vector<int> System::get_pairdistances(double cut,bool partial,int centertype,int
         }
     }
     */
-    if(threadnum>1){
-        for(int threadid=0;threadid<threadnum;threadid++)
-        {
-            s.threadflag[threadid] = 1;
-            thread theadcal(pairditancethread,atomsstart, atomsstart+threadatoms[threadid],threadid,this,&s);
-            atomsstart += threadatoms[threadid];
-            theadcal.detach();
-            
+    //with at least three cells along every periodic direction the
+    //cell list leaves out most pairs beyond the cutoff, in smaller
+    //boxes the direct loop, which sees each pair once, does less work
+    s.usecells = !thin;
+    for (int a = 0; a < 3; a++){
+        s.usecells = s.usecells && (!periodic[a] || (3*cut <= heights[a]));
+    }
+    //otherwise cells of a fraction of the cutoff are used, their stencils
+    //reach over several images of a cell if the cutoff is beyond half the
+    //box. They follow the cutoff sphere closely, so that only pairs up to
+    //about a cell diagonal beyond it are tested, and are kept large enough
+    //to hold a few atoms. Below half the box the direct loop is kept if
+    //the cells would test more than the whole box
+    int split = 0;
+    if (!s.usecells){
+        double boxvol = abs(box[0][0]*(box[1][1]*box[2][2] - box[1][2]*box[2][1])
+                          - box[0][1]*(box[1][0]*box[2][2] - box[1][2]*box[2][0])
+                          + box[0][2]*(box[1][0]*box[2][1] - box[1][1]*box[2][0]));
+        split = LONG_SPLIT;
+        while ((split > 1) && (nop*pow(cut/split, 3)/boxvol < CELL_FILL)){
+            split--;
         }
-        // 等待所有线程结束
+        double tested = cut*(1 + sqrt(3.0)/split);
+        s.longrange = thin || (4.0*PI/3.0*tested*tested*tested < boxvol);
+    }
+    if (s.usecells || s.longrange){
+        //the pair sweep bins into cells of its own, the neighbor
+        //cells of the system and their settings are left alone
+        CellList pcells;
+        set_up_cells(pcells, cut, s.longrange ? split : cellsplit);
+        parallel_for_dynamic(pcells.ncells, threadnum, max(1, pcells.ncells/(16*threadnum)), [&](int start, int stop, int tid){
+            paircellthread(start, stop, tid, this, &s, pcells, count);
+        });
+        return;
+    }
 
-        while (true) {
-            int threadramainnum = 0;
-            pdfthreadflaglock.lock();
-            for (int i = 0; i < s.threadnum; i++)
-            {
-                if (s.threadflag[i] == 1)
-                {
-                    threadramainnum++;
-                }
-            }
-            pdfthreadflaglock.unlock();
-            if (threadramainnum==0) { break; }
+    //positions are converted to the coordinates of the
+    //box policy once, the threads only take differences
+    with_box([&](const auto &bx){
+        s.u.resize(nop);
+        s.v.resize(nop);
+        s.w.resize(nop);
+        for (int ti = 0; ti < nop; ti++){
+            bx.coords(atoms.posx[ti], atoms.posy[ti], atoms.posz[ti], s.u[ti], s.v[ti], s.w[ti]);
         }
-        for (int i = 0; i < histnum; i++)
-        {
-            for (int j = 0; j < threadnum; j++)
-            {
-                s.res[i] += s.resthread[j][i];
+    });
+    //the work of an atom shrinks along the list when pairs are counted
+    //once, so atoms are handed out in small pieces to free threads
+    int chunk = max(1, nop/(16*threadnum));
+    parallel_for_dynamic(nop, threadnum, chunk, [&](int start, int stop, int tid){
+        pairditancethread(start, stop, tid, this, &s, count);
+    });
+}
+
+template <typename C>
+void System::paircellthread(int cellstart, int cellfinish, int threadid, System* sys, pdfpara* s, CellList &cells, C &count){
+    /*
+    Pair distances of the atoms of a block of cells, passed to count. A
+    pair is counted from the atom with the lower slot in the cell list,
+    once for every image of the other cell in the stencil. Atoms of a cell
+    have consecutive slots, so the atoms of the other cell below the slot
+    are not even looked at. An atom and an image of itself are counted
+    from the images on one side of the box only.
+    */
+    double dsq[DIST_BLOCK];
+    int hit[DIST_BLOCK];
+    double x, y, z, tx, ty, tz;
+    int subcell, img, first, n, m;
+
+    for (int i = cellstart; i < cellfinish; i++) {
+        for (int mi = cells.begin(i); mi < cells.end(i); mi++) {
+            x = cells.posx[mi];
+            y = cells.posy[mi];
+            z = cells.posz[mi];
+            for (int j = cells.stencil_begin(i); j < cells.stencil_end(i); j++) {
+                subcell = cells.stencil[j];
+                img = cells.stencil_image[j];
+                tx = cells.imagex[img] - x;
+                ty = cells.imagey[img] - y;
+                tz = cells.imagez[img] - z;
+                //images are numbered symmetrically about zero_image
+                for (first = max(cells.begin(subcell), mi + (img <= cells.zero_image)); first < cells.end(subcell); first += DIST_BLOCK) {
+                    n = min(DIST_BLOCK, cells.end(subcell) - first);
+                    m = block_within(&cells.posx[first], &cells.posy[first], &cells.posz[first], n,
+                        tx, ty, tz, s->cut_square, dsq, hit);
+                    for (int h = 0; h < m; h++) {
+                        count(threadid, cells.index[mi], cells.index[first + hit[h]], dsq[hit[h]]);
+                    }
+                }
             }
         }
-        free(s.threadflag);
-        pdf_halftimes=s.halftimes;
-        return s.res;
-    }
-    else if(threadnum==1)
-    {   
-        int threadid=0;
-        thread theadcal(pairditancethread,atomsstart, atomsstart+threadatoms[threadid],threadid,this,&s);
-        //atomsstart += threadatoms[threadid];
-        theadcal.join();
-        //s.threadflag[threadid] = 1;
-        //free(s.threadflag);
-        pdf_halftimes=s.halftimes;
-        return s.resthread[threadid];
     }
+}
 
+template <typename C>
+void System::pairditancethread(int atomsstart,int atomsfinish, int threadid,System* sys,pdfpara * s, C &count){
+    /*
+    Pair distances of a block of atoms with the atoms after them, passed
+    to count. The cutoff is below half the box, so only the nearest image
+    of a pair can be within it.
+    */
+    //the later atoms are taken in blocks, in the coordinates
+    //of the box policy which wraps them to the nearest image
+    sys->with_box([&](const auto &bx){
+        double dx[DIST_BLOCK], dy[DIST_BLOCK], dz[DIST_BLOCK], dsq[DIST_BLOCK];
+        int hit[DIST_BLOCK];
+        int n, m;
+        for (int ti = atomsstart; ti < atomsfinish; ti++) {
+            for (int first = ti + 1; first < sys->nop; first += DIST_BLOCK) {
+                n = min(DIST_BLOCK, sys->nop - first);
+                m = block_within_box(bx, &s->u[first], &s->v[first], &s->w[first], n,
+                    s->u[ti], s->v[ti], s->w[ti], s->cut_square, dx, dy, dz, dsq, hit);
+                for (int h = 0; h < m; h++) {
+                    count(threadid, ti, first + hit[h], dsq[hit[h]]);
+                }
+            }
+        }
+    });
 }
+//bins between fresh values of sin and cos in get_sine_transform
+static const int SINE_RESEED = 256;
 
-void System::pairditancethread(int atomsstart,int atomsfinish, int threadid,System* sys,pdfpara * s){
+vector<vector<double>> System::get_sine_transform(vector<vector<double>> f, double rlow, double dr, vector<double> q, int threadnum){
+    /*
+    Sums res[p][j] = sum over k of f[p][k] sin(q[j] r_k), with r_k = rlow + k dr,
+    for every row p of f, in O(rows x bins x q) time and without a matrix
+    of the sines. The sines at a bin follow from those at the bin before by
+    a rotation by q dr, which is started again from sin and cos every
+    SINE_RESEED bins so that rounding errors do not build up. The inner
+    loops run over q without branches, and the q grid is split over threads.
+    */
+    int np = f.size();
+    int nr = (np > 0) ? f[0].size() : 0;
+    int nq = q.size();
+    for (int p = 0; p < np; p++){
+        if (f[p].size() != nr){
+            throw invalid_argument("all rows of f should have the same length");
+        }
+    }
+    if (threadnum < 1) threadnum = nthreads;
+
+    vector<vector<double>> res(np, vector<double>(nq, 0.0));
+    parallel_for(nq, threadnum, [&](int start, int stop, int tid){
+        int m = stop - start;
+        vector<double> sn(m), cs(m), sd(m), cd(m);
+        double r, t, fk;
+        double *acc;
+        for (int j = 0; j < m; j++){
+            sd[j] = sin(q[start + j]*dr);
+            cd[j] = cos(q[start + j]*dr);
+        }
+        for (int k = 0; k < nr; k++){
+            if (k % SINE_RESEED == 0){
+                r = rlow + k*dr;
+                for (int j = 0; j < m; j++){
+                    sn[j] = sin(q[start + j]*r);
+                    cs[j] = cos(q[start + j]*r);
+                }
+            }
+            else{
+                for (int j = 0; j < m; j++){
+                    t = sn[j]*cd[j] + cs[j]*sd[j];
+                    cs[j] = cs[j]*cd[j] - sn[j]*sd[j];
+                    sn[j] = t;
+                }
+            }
+            for (int p = 0; p < np; p++){
+                fk = f[p][k];
+                if (fk == 0) continue;
+                acc = &res[p][start];
+                for (int j = 0; j < m; j++){
+                    acc[j] += fk*sn[j];
+                }
+            }
+        }
+    });
+    return res;
+}
 
-    double d_square,d;
-    double diffx,diffy,diffz;
-    int M[3]={0};
-    int N[3]={0};
-    double pointHeight[3]={0};
-    double pdotiCrossj[3]={0};
+vector<vector<double>> System::get_structure_factors(vector<int> hist, int nbins, double histlow, double cut, vector<double> q, string window, string weighting, int threadnum){
+    /*
+    Structure factors at the wave numbers q from a pair histogram of
+    get_pair_histograms with nbins bins from histlow to cut. The partial
+    g_ab(r) of every pair of types is taken at the middle of the bins,
+    with the volume of each shell, and transformed as
+
+        S_ab(q) = 1 + 4 pi rho int r^2 (g_ab(r) - 1) W(r) sin(qr)/(qr) dr
+
+    over the range of the histogram, where rho is the number density of
+    all atoms. W damps the ripples from the end of the range, it is
+    "none", "lorch", sin(pi r/cut)/(pi r/cut), or "cosine",
+    (1 + cos(pi r/cut))/2. With weighting "fz", Faber-Ziman, row 0 is the
+    total sum over a, b of c_a c_b S_ab(q), with c_a the fraction of atoms of
+    type a, and row 1 + a*ntypes + b is S_ab(q), zero if there are no atoms
+    of type a or b. With "bt", for exactly two types, the rows are S_NN,
+    S_NC and S_CC of Bhatia and Thornton. At q = 0 the limit is taken.
+    */
+    if ((nbins < 1) || (histlow < 0) || (cut <= histlow)){
+        throw invalid_argument("there should be at least one bin and 0 <= histlow < cut");
+    }
+    int nt = (int)round(sqrt(double(hist.size()/nbins)));
+    if (nt*nt*nbins != hist.size()){
+        throw invalid_argument("hist should hold ntypes x ntypes x nbins counts");
+    }
+    int win;
+    if (window == "none") win = 0;
+    else if (window == "lorch") win = 1;
+    else if (window == "cosine") win = 2;
+    else throw invalid_argument("window should be none, lorch or cosine");
+    if ((weighting != "fz") && (weighting != "bt")){
+        throw invalid_argument("weighting should be fz or bt");
+    }
 
+    //atoms of every type, counted over all atoms as the pairs are
+    vector<double> natype(nt, 0);
+    for (int ti = 0; ti < nop; ti++){
+        if ((atoms.type[ti] < 0) || (atoms.type[ti] >= nt)){
+            throw invalid_argument("hist does not cover the types of all atoms");
+        }
+        natype[atoms.type[ti]]++;
+    }
+    double boxvol = abs(box[0][0]*(box[1][1]*box[2][2] - box[1][2]*box[2][1])
+                      - box[0][1]*(box[1][0]*box[2][2] - box[1][2]*box[2][0])
+                      + box[0][2]*(box[1][0]*box[2][1] - box[1][1]*box[2][0]));
+    double rho = nop/boxvol;
+
+    //4 pi rho r (g_ab(r) - 1) W(r) dr of every pair of types with atoms,
+    //each pair once as S_ab = S_ba
+    double dr = (cut - histlow)/nbins;
+    double rlow = histlow + 0.5*dr;
+    vector<int> pa, pb;
+    for (int a = 0; a < nt; a++){
+        for (int b = a; b < nt; b++){
+            if ((natype[a] > 0) && (natype[b] > 0)){
+                pa.push_back(a);
+                pb.push_back(b);
+            }
+        }
+    }
+    int np = pa.size();
+    vector<vector<double>> f(np, vector<double>(nbins, 0.0));
+    double r, r0, r1, shell, w, x;
+    for (int k = 0; k < nbins; k++){
+        r0 = histlow + k*dr;
+        r1 = r0 + dr;
+        r = rlow + k*dr;
+        shell = 4.0*PI/3.0*(r1*r1*r1 - r0*r0*r0);
+        x = PI*r/cut;
+        w = (win == 1) ? sin(x)/x : ((win == 2) ? 0.5*(1 + cos(x)) : 1.0);
+        for (int p = 0; p < np; p++){
+            double g = hist[(pa[p]*nt + pb[p])*nbins + k]*boxvol/(natype[pa[p]]*natype[pb[p]]*shell);
+            f[p][k] = 4.0*PI*rho*r*(g - 1)*w*dr;
+        }
+    }
 
-    if (s->halftimes == true) {
-        for (int ti = atomsstart; ti < atomsfinish; ti++) {
-            for (int tj = ti + 1; tj < sys->nop; tj++) {
-                d=sys->get_abs_distance(ti, tj, diffx, diffy, diffz);
-                //d_square = diffx * diffx + diffy * diffy + diffz * diffz;
-                //if (d_square <= s->cut_square && d_square >= s->histlow_square) {
-                if (d <= s->cut && d >= s->histlow) {
-                    //d = pow(d_square, 0.5);
-                    
-                    s->resthread[threadid][floor((d - s->histlow) / s->deltacut)]++;
-                    
+    vector<vector<double>> tr = get_sine_transform(f, rlow, dr, q, threadnum);
+
+    //divide by q, at q = 0 sin(qr)/q is r
+    int nq = q.size();
+    vector<vector<double>> sab(nt*nt, vector<double>(nq, 0.0));
+    for (int p = 0; p < np; p++){
+        for (int j = 0; j < nq; j++){
+            double t = tr[p][j]/q[j];
+            if (q[j] == 0){
+                t = 0;
+                for (int k = 0; k < nbins; k++){
+                    t += f[p][k]*(rlow + k*dr);
                 }
             }
+            sab[pa[p]*nt + pb[p]][j] = 1 + t;
+            sab[pb[p]*nt + pa[p]][j] = 1 + t;
         }
     }
-    if (s->halftimes==false){
-        for (int ti = atomsstart; ti < atomsfinish; ti++) {
-            if (s->partial == true && sys->atoms[ti].type != s->centertype) { continue; }
-            //计算对于每个中心原子应该扩胞的范围
-
-            if (sys->triclinic == 1) {
-                for (int i = 0; i < 3; i++) {
-                    pdotiCrossj[i] += sys->atoms[ti].posx * s->iCrossj[i][0] + sys->atoms[ti].posy * s->iCrossj[i][1] + sys->atoms[ti].posz * s->iCrossj[i][2];
-                    pointHeight[i] = abs(s->pdotiCrossj[i] / s->iCrossjnorm[i]);
-                    M[i] = ceil((pointHeight[i] + s->cut) / s->Height[i] - 1);
-                    N[i] = floor((pointHeight[i] - s->cut) / s->Height[i]);
-                }
-            }
-            else {
-                M[0] = ceil((sys->atoms[ti].posx + s->cut) / s->Height[0] - 1);
-                N[0] = floor((sys->atoms[ti].posx - s->cut) / s->Height[0]);
-                M[1] = ceil((sys->atoms[ti].posy + s->cut) / s->Height[1] - 1);
-                N[1] = floor((sys->atoms[ti].posy - s->cut) / s->Height[1]);
-                M[2] = ceil((sys->atoms[ti].posz + s->cut) / s->Height[2] - 1);
-                N[2] = floor((sys->atoms[ti].posz - s->cut) / s->Height[2]);
-
-            }
-            for (int tj = 0; tj < sys->nop; tj++) {
-                if (s->partial == true && sys->atoms[tj].type != s->secondtype) { continue; }
-                
-                for (int i = N[0]; i <= M[0]; i++) {
-                    for (int j = N[1]; j <= M[1]; j++) {
-                        for (int k = N[2]; k <= M[2]; k++) {
-                            if (ti == tj && i==0 && j==0 && k==0) { continue; }
-                            diffx = sys->atoms[tj].posx + i * sys->box[0][0] + j * sys->box[1][0] + k * sys->box[2][0] - sys->atoms[ti].posx;
-                            diffy = sys->atoms[tj].posy + i * sys->box[0][1] + j * sys->box[1][1] + k * sys->box[2][1] - sys->atoms[ti].posy;
-                            diffz = sys->atoms[tj].posz + i * sys->box[0][2] + j * sys->box[1][2] + k * sys->box[2][2] - sys->atoms[ti].posz;
-
-                            d_square = diffx * diffx + diffy * diffy + diffz * diffz;
-                            //std::cout << s->cut_square;
-                            if (d_square <= s->cut_square && d_square >= s->histlow_square) {
-                                d = pow(d_square, 0.5);
-                                
-                                s->resthread[threadid][floor((d - s->histlow) / s->deltacut)]++;
 
-                            }
-                        }
-                    }
+    vector<double> c(nt);
+    for (int a = 0; a < nt; a++){
+        c[a] = natype[a]/nop;
+    }
+    vector<vector<double>> res;
+    if (weighting == "fz"){
+        res.assign(1 + nt*nt, vector<double>(nq, 0.0));
+        for (int a = 0; a < nt; a++){
+            for (int b = 0; b < nt; b++){
+                for (int j = 0; j < nq; j++){
+                    res[0][j] += c[a]*c[b]*sab[a*nt + b][j];
                 }
+                res[1 + a*nt + b] = sab[a*nt + b];
             }
         }
-             
+        return res;
     }
-    if (s->threadnum>1)
-    {
-        sys->pdfthreadflaglock.lock();
-        s->threadflag[threadid] = 0;
-        sys->pdfthreadflaglock.unlock();
+
+    //Bhatia-Thornton, from the Faber-Ziman partials of the two types
+    vector<int> present;
+    for (int a = 0; a < nt; a++){
+        if (natype[a] > 0) present.push_back(a);
     }
+    if (present.size() != 2){
+        throw invalid_argument("bt weighting needs exactly two types of atoms");
+    }
+    int t1 = present[0];
+    int t2 = present[1];
+    double c1 = c[t1];
+    double c2 = c[t2];
+    res.assign(3, vector<double>(nq, 0.0));
+    for (int j = 0; j < nq; j++){
+        double s11 = sab[t1*nt + t1][j];
+        double s22 = sab[t2*nt + t2][j];
+        double s12 = sab[t1*nt + t2][j];
+        res[0][j] = c1*c1*s11 + c2*c2*s22 + 2*c1*c2*s12;
+        res[1][j] = c1*c2*(c1*(s11 - s12) - c2*(s22 - s12));
+        res[2][j] = c1*c2*(1 + c1*c2*(s11 + s22 - 2*s12));
+    }
+    return res;
 }
+
 vector<int> System::get_pairangle(double histlow,double histhigh,int histnum){
 
     vector<int> res(histnum,0);
     double delta=(histhigh-histlow)/histnum;
-    double d;
+    double d, a_abs, b_abs, adotb;
+    int m, n;
     //double diffx,diffy,diffz;
 
+    //angles are taken between the stored bond vectors, so that
+    //the periodic image of each neighbor is the one in the list
     for (int ti=0; ti<nop; ti++){
-        for (int tj=0; tj<atoms[ti].n_neighbors; tj++)
-            for (int tk=tj; tk<atoms[ti].n_neighbors; tk++){
+        for (int tj=0; tj<neighbors.count(ti); tj++)
+            for (int tk=tj; tk<neighbors.count(ti); tk++){
                 if(tk==tj) { continue; }
-                d = get_angle(ti,atoms[ti].neighbors[tj],atoms[ti].neighbors[tk]);
+                m = neighbors.begin(ti)+tj;
+                n = neighbors.begin(ti)+tk;
+                a_abs = neighbors.dist[m];
+                b_abs = neighbors.dist[n];
+                adotb = neighbors.diffx[m]*neighbors.diffx[n] + neighbors.diffy[m]*neighbors.diffy[n] + neighbors.diffz[m]*neighbors.diffz[n];
+                d = acos(adotb / a_abs / b_abs);
                 if(d>=histlow && d<=histhigh)
                 {
                     res[floor((d-histlow)/delta)]++;
@@ -761,92 +1629,133 @@ vector<int> System::get_pairangle(double histlow,double histhigh,int histnum){
     return res;
 }
 
-//function to create cell lists
-//snmall function that returns cell index when provided with cx, cy, cz
-int System::cell_index(int cx, int cy, int cz){
-    return cx*ny*nz + cy*nz + cz;
+//perpendicular distance between opposite faces of the reduced box
+//for each of its vectors, h_i = |a_i . (a_j x a_k)| / |a_j x a_k|
+//for an orthogonal box this is just the box length
+void System::get_box_heights(double h[3]){
+
+    int j, k;
+    double cross[3];
+    double cnorm, vol;
+
+    for(int i=0; i<3; i++){
+        j = (i+1)%3;
+        k = (i+2)%3;
+        cross[0] = lattice[j][1]*lattice[k][2] - lattice[j][2]*lattice[k][1];
+        cross[1] = lattice[j][2]*lattice[k][0] - lattice[j][0]*lattice[k][2];
+        cross[2] = lattice[j][0]*lattice[k][1] - lattice[j][1]*lattice[k][0];
+        cnorm = sqrt(cross[0]*cross[0] + cross[1]*cross[1] + cross[2]*cross[2]);
+        vol = lattice[i][0]*cross[0] + lattice[i][1]*cross[1] + lattice[i][2]*cross[2];
+        h[i] = (cnorm > 0) ? abs(vol)/cnorm : 0.0;
+    }
 }
 
+//set up cell lists. Atoms are binned in fractional coordinates of the
+//reduced box, so that the same cells work for orthogonal and triclinic boxes.
+//The number of cells along each box vector is set from the perpendicular
+//height of the box in that direction, so every cell is at least
+//neighbordistance thick measured normal to its faces. Then any pair within
+//the cutoff differs by at most one cell index along each box vector, however
+//much the box is sheared. If the box is thinner than neighbordistance, the
+//stencil reaches further and takes in the periodic images of the cell.
+//Along a direction which is not periodic the cells only span the atoms.
+//The cell list keeps its storage between calls, only the binning is redone.
 
-//if number of particles are small, use brute force
-//if box is triclinic, use brute force
 void System::set_up_cells(){
+      set_up_cells(cells, neighbordistance, cellsplit);
+}
 
-      int si,sj,sk, maincell, subcell;
-      vector<int> cc;
-      //find of all find the number of cells in each direction
-      nx = boxx/neighbordistance;
-      ny = boxy/neighbordistance;
-      nz = boxz/neighbordistance;
-      //now use this to find length of cell in each direction
-      double lx = boxx/nx;
-      double ly = boxy/ny;
-      double lz = boxz/nz;
-      //find the total number of cells
-      total_cells = nx*ny*nz;
-      //create a vector of cells
-      cells = new cell[total_cells];
-      //now run over and for each cell create its neighbor cells
-      //all neighbor cells are also added
-      for(int i=0; i<nx; i++){
-         for(int j=0; j<ny; j++){
-           for(int k=0; k<nz; k++){
-              maincell = cell_index(i, j, k);
-              for(int si=i-1; si<=i+1; si++){
-                  for(int sj=j-1; sj<=j+1; sj++){
-                      for(int sk=k-1; sk<=k+1; sk++){
-                         cc = cell_periodic(si, sj, sk);
-                         subcell = cell_index(cc[0], cc[1], cc[2]);
-                         //add this to the list of neighbors
-                         cells[maincell].neighbor_cells.emplace_back(subcell);
+//bin the atoms into the cell list cl for the given cutoff, split is the
+//number of cells per cutoff length, 0 chooses it from the density
+void System::set_up_cells(CellList &cl, double cutoff, int split){
+
+      //cells are half the cutoff if there are enough atoms to fill
+      //them, the stencil then follows the cutoff sphere more closely
+      //and fewer pairs beyond the cutoff are tested
+      if (split <= 0){
+          double boxvol = abs(box[0][0]*(box[1][1]*box[2][2] - box[1][2]*box[2][1])
+                            - box[0][1]*(box[1][0]*box[2][2] - box[1][2]*box[2][0])
+                            + box[0][2]*(box[1][0]*box[2][1] - box[1][1]*box[2][0]));
+          double percell = nop*pow(cutoff, 3)/boxvol;
+          split = (percell/8.0 >= CELL_FILL) ? 2 : 1;
+      }
 
-                      }
-                  }
+      //range of the fractional coordinates along directions which
+      //are not periodic, the grid covers only this
+      double flo[3] = {0, 0, 0};
+      double fspan[3] = {1, 1, 1};
+      if (!(periodic[0] && periodic[1] && periodic[2])){
+          double fhi[3] = {1, 1, 1};
+          double f[3];
+          for(int a=0; a<3; a++){
+              if (!periodic[a]){
+                  flo[a] = DBL_MAX;
+                  fhi[a] = -DBL_MAX;
               }
-           }
-         }
+          }
+          for(int ti=0; ti<nop; ti++){
+              fractional(atoms.posx[ti], atoms.posy[ti], atoms.posz[ti], f[0], f[1], f[2]);
+              for(int a=0; a<3; a++){
+                  if (periodic[a]) continue;
+                  flo[a] = min(flo[a], f[a]);
+                  fhi[a] = max(fhi[a], f[a]);
+              }
+          }
+          for(int a=0; a<3; a++){
+              if (nop == 0) flo[a] = 0;
+              fspan[a] = (nop > 0) ? fhi[a] - flo[a] : 0;
+          }
       }
-      int cx, cy, cz;
-      double dx, dy, dz;
-      double ddx, ddy, ddz;
-      int ind;
-
-      //now loop over all atoms and assign cells
-      for(int ti=0; ti<nop; ti++){
-
-          //calculate c indices for the atom
-          dx = atoms[ti].posx;
-          dy = atoms[ti].posy;
-          dz = atoms[ti].posz;
-          
-          //now apply boxdims
-          if( abs(dx-0) < 1E-6)
-              dx = 0;
-          if( abs(dy-0) < 1E-6)
-              dy = 0;
-          if( abs(dz-0) < 1E-6)
-              dz = 0;
-
-          if (dx < 0) dx+=boxx;
-          else if (dx >= boxx) dx-=boxx;
-          if (dy < 0) dy+=boxy;
-          else if (dy >= boxy) dy-=boxy;
-          if (dz < 0) dz+=boxz;
-          else if (dz >= boxz) dz-=boxz;
-
-          //now find c vals
-          cx = dx/lx;
-          cy = dy/ly;
-          cz = dz/lz;
-
-          //now get cell index
-          ind = cell_index(cx, cy, cz);
-          //got cell index
-          //now add the atom to the corresponding cells
-          cells[ind].members.emplace_back(ti);
 
+      int n[3], reach[3];
+      double width[3], edge[3][3], extent;
+      for(int a=0; a<3; a++){
+          extent = fspan[a]*heights[a];
+          n[a] = max(1, (int)(split*extent/cutoff));
+          width[a] = (extent > 0) ? extent/n[a] : cutoff;
+          reach[a] = max(1, (int)ceil(cutoff/width[a] - 1E-12));
+          if (!periodic[a]) reach[a] = max(1, min(reach[a], n[a]-1));
+          for(int b=0; b<3; b++){
+              edge[a][b] = lattice[a][b]*fspan[a]/n[a];
+          }
       }
-      //end of loop - all cells, the member atoms and neighboring cells are added
+      bool ortho = (lattice[0][1] == 0) && (lattice[0][2] == 0) && (lattice[1][0] == 0)
+          && (lattice[1][2] == 0) && (lattice[2][0] == 0) && (lattice[2][1] == 0);
+      cl.set_grid(n[0], n[1], n[2], reach, width, cutoff, ortho, periodic, edge);
+      cl.set_images(lattice);
+
+      //now find the cell of every atom, and its position in the box
+      vector<double> wx(nop), wy(nop), wz(nop);
+      cl.cellof.resize(nop);
+      parallel_for(nop, nthreads, [&](int start, int stop, int tid){
+          int c[3];
+          double d[3], g;
+
+          for(int ti=start; ti<stop; ti++){
+
+              //fractional coordinates of the atom, wrapped into [0, 1)
+              //along periodic directions
+              fractional(atoms.posx[ti], atoms.posy[ti], atoms.posz[ti], d[0], d[1], d[2]);
+              for(int a=0; a<3; a++){
+                  if (periodic[a]){
+                      d[a] -= floor(d[a]);
+                  }
+              }
+              wx[ti] = d[0]*lattice[0][0] + d[1]*lattice[1][0] + d[2]*lattice[2][0];
+              wy[ti] = d[0]*lattice[0][1] + d[1]*lattice[1][1] + d[2]*lattice[2][1];
+              wz[ti] = d[0]*lattice[0][2] + d[1]*lattice[1][2] + d[2]*lattice[2][2];
+
+              //now find c vals, the min guards against d rounding to 1
+              for(int a=0; a<3; a++){
+                  g = (fspan[a] > 0) ? (d[a] - flo[a])/fspan[a] : 0;
+                  c[a] = max(0, min((int)(g*cl.size(a)), cl.size(a)-1));
+              }
+              cl.cellof[ti] = cl.cell_index(c[0], c[1], c[2]);
+          }
+      });
+
+      //sort the atoms into cells
+      cl.bin(wx, wy, wz, nthreads);
 }
 
 vector<double> System::remap_atom(vector<double> pos){
@@ -870,12 +1779,18 @@ vector<double> System::remap_atom(vector<double> pos){
 
         //now check pbc
         //nearest image
-        if (dx> boxx/2.0) {dx-=boxx;};
-        if (dx<-boxx/2.0) {dx+=boxx;};
-        if (dy> boxy/2.0) {dy-=boxy;};
-        if (dy<-boxy/2.0) {dy+=boxy;};
-        if (dz> boxz/2.0) {dz-=boxz;};
-        if (dz<-boxz/2.0) {dz+=boxz;};
+        if (periodic[0]){
+            if (dx> boxx/2.0) {dx-=boxx;};
+            if (dx<-boxx/2.0) {dx+=boxx;};
+        }
+        if (periodic[1]){
+            if (dy> boxy/2.0) {dy-=boxy;};
+            if (dy<-boxy/2.0) {dy+=boxy;};
+        }
+        if (periodic[2]){
+            if (dz> boxz/2.0) {dz-=boxz;};
+            if (dz<-boxz/2.0) {dz+=boxz;};
+        }
 
         //now divide by box vals - scale down the size
         dx = dx/boxx;
@@ -893,12 +1808,20 @@ vector<double> System::remap_atom(vector<double> pos){
         dz = az;
     }
     else{
-        if (dx < 0) dx+=boxx;
-        else if (dx >= boxx) dx-=boxx;
-        if (dy < 0) dy+=boxy;
-        else if (dy >= boxy) dy-=boxy;
-        if (dz < 0) dz+=boxz;
-        else if (dz >= boxz) dz-=boxz;
+        //atoms are left where they are along directions
+        //which are not periodic
+        if (periodic[0]){
+            if (dx < 0) dx+=boxx;
+            else if (dx >= boxx) dx-=boxx;
+        }
+        if (periodic[1]){
+            if (dy < 0) dy+=boxy;
+            else if (dy >= boxy) dy-=boxy;
+        }
+        if (periodic[2]){
+            if (dz < 0) dz+=boxz;
+            else if (dz >= boxz) dz-=boxz;
+        }
     }
     vector<double> rpos;
     rpos.emplace_back(dx);
@@ -908,160 +1831,293 @@ vector<double> System::remap_atom(vector<double> pos){
 
 }
 
-vector<int> System::cell_periodic(int i, int j, int k){
-    vector<int> ci;
-    //apply periodic conditions
-    if (i<0) i = i + nx;
-    else if (i>nx-1) i = i -nx;
-    ci.emplace_back(i);
-    if (j<0) j = j + ny;
-    else if (j>ny-1) j = j -ny;
-    ci.emplace_back(j);
-    if (k<0) k = k + nz;
-    else if (k>nz-1) k = k -nz;
-    ci.emplace_back(k);
-    return ci;
-
-}
-
 //get all neighbor info but using cell lists
 void System::get_all_neighbors_cells(){
 
     voronoiused = 0;
 
-    double d;
-    double diffx,diffy,diffz;
-    double r,theta,phi;
-    int ti, tj;
+    //with pair cutoffs, neighbordistance is the largest one
+    //and sets the size of the cells
+    check_pair_types();
+
+    if (skin > 0){
+        get_neighbors_verlet();
+        return;
+    }
+
+    //read from the neighbor index if it already reaches the cutoff
+    if (nindex.covers(neighbordistance, 0, nop, atoms.position_checksum(nop))){
+        get_neighbors_from_index();
+        return;
+    }
+
     //first create cells
     set_up_cells();
-    int maincell, subcell;
-
-    //now loop to find distance
-    for(int i=0; i<total_cells; i++){
-        //now go over the neighbor cells
-        //for each member in cell i
-        for(int mi=0; mi<cells[i].members.size(); mi++){
-            //now go through the neighbors
-            ti = cells[i].members[mi];
-            for(int j=0 ; j<cells[i].neighbor_cells.size(); j++){
-               //loop through members of j
-               subcell = cells[i].neighbor_cells[j];
-               for(int mj=0; mj<cells[subcell].members.size(); mj++){
-                  //now we have mj -> members/compare with
-                  tj = cells[subcell].members[mj];
-                  //compare ti and tj and add
-                  if (ti < tj){
-                      d = get_abs_distance(ti,tj,diffx,diffy,diffz);
-                      if (d < neighbordistance){
-
-                        if ((filter == 1) && (atoms[ti].type != atoms[tj].type)){
-                            continue;
-                        }
-                        else if ((filter == 2) && (atoms[ti].type == atoms[tj].type)){
-                            continue;
-                        }
-                        //process_neighbor(ti, tj);
-                        atoms[ti].neighbors[atoms[ti].n_neighbors] = tj;
-                        atoms[ti].neighbordist[atoms[ti].n_neighbors] = d;
-                        //weight is set to 1.0, unless manually reset
-                        atoms[ti].neighborweight[atoms[ti].n_neighbors] = 1.00;
-                        atoms[ti].n_diffx[atoms[ti].n_neighbors] = diffx;
-                        atoms[ti].n_diffy[atoms[ti].n_neighbors] = diffy;
-                        atoms[ti].n_diffz[atoms[ti].n_neighbors] = diffz;
-                        convert_to_spherical_coordinates(diffx, diffy, diffz, r, phi, theta);
-                        atoms[ti].n_r[atoms[ti].n_neighbors] = r;
-                        atoms[ti].n_phi[atoms[ti].n_neighbors] = phi;
-                        atoms[ti].n_theta[atoms[ti].n_neighbors] = theta;
-                        atoms[ti].n_neighbors += 1;
-                        atoms[ti].cutoff = neighbordistance;
-
-                        atoms[tj].neighbors[atoms[tj].n_neighbors] = ti;
-                        atoms[tj].neighbordist[atoms[tj].n_neighbors] = d;
-                        //weight is set to 1.0, unless manually reset
-                        atoms[tj].neighborweight[atoms[tj].n_neighbors] = 1.00;
-                        atoms[tj].n_diffx[atoms[tj].n_neighbors] = -diffx;
-                        atoms[tj].n_diffy[atoms[tj].n_neighbors] = -diffy;
-                        atoms[tj].n_diffz[atoms[tj].n_neighbors] = -diffz;
-                        convert_to_spherical_coordinates(-diffx, -diffy, -diffz, r, phi, theta);
-                        atoms[tj].n_r[atoms[tj].n_neighbors] = r;
-                        atoms[tj].n_phi[atoms[tj].n_neighbors] = phi;
-                        atoms[tj].n_theta[atoms[tj].n_neighbors] = theta;
-                        atoms[tj].n_neighbors +=1;
-                        atoms[tj].cutoff = neighbordistance;
+    begin_neighbor_build();
+
+    //each thread works on a block of cells and keeps its own pairs,
+    //the blocks are merged in order afterwards
+    vector<NeighborBuilder> parts(nthreads);
+    parallel_for(cells.ncells, nthreads, [&](int cstart, int cstop, int tid){
+        NeighborBuilder &nb = parts[tid];
+        double d, rcsq;
+        double diffx,diffy,diffz;
+        double x, y, z, tx, ty, tz;
+        int ti, tj, mj, subcell, img, first, n, m;
+        bool paircut = (npairtypes > 0);
+        double cutsq = neighbordistance*neighbordistance;
+        double dsq[DIST_BLOCK];
+        int hit[DIST_BLOCK];
+
+        //now loop to find distance
+        for(int i=cstart; i<cstop; i++){
+            //now go over the neighbor cells
+            //for each member in cell i
+            for(int mi=cells.begin(i); mi<cells.end(i); mi++){
+                //now go through the neighbors
+                ti = cells.index[mi];
+                x = cells.posx[mi];
+                y = cells.posy[mi];
+                z = cells.posz[mi];
+                for(int j=cells.stencil_begin(i); j<cells.stencil_end(i); j++){
+                   //loop through members of j, shifted to the image
+                   //the stencil entry refers to
+                   subcell = cells.stencil[j];
+                   img = cells.stencil_image[j];
+                   tx = cells.imagex[img] - x;
+                   ty = cells.imagey[img] - y;
+                   tz = cells.imagez[img] - z;
+                   //members of j in blocks, only those within the
+                   //largest cutoff come out of block_within
+                   for(first=cells.begin(subcell); first<cells.end(subcell); first+=DIST_BLOCK){
+                      n = min(DIST_BLOCK, cells.end(subcell)-first);
+                      m = block_within(&cells.posx[first], &cells.posy[first], &cells.posz[first], n,
+                          tx, ty, tz, cutsq, dsq, hit);
+                      for(int h=0; h<m; h++){
+                          //now we have mj -> members/compare with
+                          mj = first + hit[h];
+                          tj = cells.index[mj];
+                          //compare ti and tj and add, an atom and its own
+                          //images are each seen once from both sides
+                          if ((ti > tj) || ((ti == tj) && (img == cells.zero_image))) continue;
+                          //reject on the squared cutoff of the pair
+                          rcsq = (paircut) ? pair_cutoff_sq(ti, tj) : cutsq;
+                          if (dsq[hit[h]] >= rcsq) continue;
+
+                          if ((filter == 1) && (atoms.type[ti] != atoms.type[tj])){
+                              continue;
+                          }
+                          else if ((filter == 2) && (atoms.type[ti] == atoms.type[tj])){
+                              continue;
+                          }
+                          diffx = cells.posx[mj] + tx;
+                          diffy = cells.posy[mj] + ty;
+                          diffz = cells.posz[mj] + tz;
+                          d = sqrt(dsq[hit[h]]);
+                          //weight is set to 1.0, unless manually reset
+                          nb.add(ti, tj, d, diffx, diffy, diffz);
+                          if (ti != tj){
+                              nb.add(tj, ti, d, -diffx, -diffy, -diffz);
+                          }
                       }
-                  }
-               }
+                   }
 
-            }
+                }
 
+            }
         }
-    }
-
+    });
+    add_neighbor_parts(parts, neighbordistance);
+    end_neighbor_build();
 
 }
 
 
 
+void System::get_half_neighbors_cells(){
+    /*
+    Cutoff neighbors in the half list, every pair is found once from
+    the atom that comes first in the order of the cells. The main
+    neighbor table is left alone.
+    */
+    voronoiused = 0;
+    check_pair_types();
+    set_up_cells();
+
+    halfneighbors.begin_rows();
+    halfneighbors.order = cells.index;
+    halfneighbors.slot = cells.slot;
+
+    //threads build the rows of blocks of cells, which are
+    //blocks of slots, and the blocks are put one after the other
+    vector<HalfNeighborList> parts(nthreads);
+    parallel_for(cells.ncells, nthreads, [&](int cstart, int cstop, int tid){
+        HalfNeighborList &hl = parts[tid];
+        vector<HalfNeighborList::bond> row;
+        double rcsq;
+        double diffx,diffy,diffz;
+        double x, y, z, tx, ty, tz;
+        int ti, tj, mj, subcell, img, first, n, m;
+        bool paircut = (npairtypes > 0);
+        double cutsq = neighbordistance*neighbordistance;
+        double dsq[DIST_BLOCK];
+        int hit[DIST_BLOCK];
+
+        hl.begin_rows();
+        for(int i=cstart; i<cstop; i++){
+            for(int mi=cells.begin(i); mi<cells.end(i); mi++){
+                ti = cells.index[mi];
+                x = cells.posx[mi];
+                y = cells.posy[mi];
+                z = cells.posz[mi];
+                row.clear();
+                for(int j=cells.stencil_begin(i); j<cells.stencil_end(i); j++){
+                    subcell = cells.stencil[j];
+                    img = cells.stencil_image[j];
+                    tx = cells.imagex[img] - x;
+                    ty = cells.imagey[img] - y;
+                    tz = cells.imagez[img] - z;
+                    for(first=cells.begin(subcell); first<cells.end(subcell); first+=DIST_BLOCK){
+                        n = min(DIST_BLOCK, cells.end(subcell)-first);
+                        m = block_within(&cells.posx[first], &cells.posy[first], &cells.posz[first], n,
+                            tx, ty, tz, cutsq, dsq, hit);
+                        for(int h=0; h<m; h++){
+                            mj = first + hit[h];
+                            //opposite images of the atom itself are kept once
+                            if ((mi > mj) || ((mi == mj) && (img <= cells.zero_image))) continue;
+                            tj = cells.index[mj];
+                            rcsq = (paircut) ? pair_cutoff_sq(ti, tj) : cutsq;
+                            if (dsq[hit[h]] >= rcsq) continue;
+                            if ((filter == 1) && (atoms.type[ti] != atoms.type[tj])){
+                                continue;
+                            }
+                            else if ((filter == 2) && (atoms.type[ti] == atoms.type[tj])){
+                                continue;
+                            }
+                            diffx = cells.posx[mj] + tx;
+                            diffy = cells.posy[mj] + ty;
+                            diffz = cells.posz[mj] + tz;
+                            row.push_back({mj, float(sqrt(dsq[hit[h]])), float(diffx), float(diffy), float(diffz)});
+                        }
+                    }
+                }
+                hl.add_row(mi, row);
+            }
+        }
+    });
+    for(int t=0; t<parts.size(); t++){
+        halfneighbors.append(parts[t]);
+    }
+    halfneighbors.count_degrees();
+    for(int ti=0; ti<nop; ti++){
+        if (halfneighbors.degree[ti] > 0) atoms.cutoff[ti] = neighbordistance;
+    }
+}
+
+vector<int> System::get_half_pair_histogram(double histlow, double histhigh, int histnum){
+    /*
+    Histogram of the distances of all pairs in the half list,
+    every pair is counted once.
+    */
+    double delta = (histhigh-histlow)/histnum;
+    vector<vector<int>> parts(nthreads, vector<int>(histnum, 0));
+    parallel_for(halfneighbors.nslots(), nthreads, [&](int sstart, int sstop, int tid){
+        vector<int> &hist = parts[tid];
+        double d;
+        for(int s=sstart; s<sstop; s++){
+            halfneighbors.for_row(s, [&](int t, long long b){
+                d = halfneighbors.dist[b];
+                if ((d >= histlow) && (d < histhigh)){
+                    hist[min(int((d-histlow)/delta), histnum-1)]++;
+                }
+            });
+        }
+    });
+    for(int t=1; t<parts.size(); t++){
+        for(int i=0; i<histnum; i++){
+            parts[0][i] += parts[t][i];
+        }
+    }
+    return parts[0];
+}
+
 void System::get_all_neighbors_normal(){
 
 
     //reset voronoi flag
     voronoiused = 0;
+    check_pair_types();
 
-    double d;
-    double diffx,diffy,diffz;
-    double r,theta,phi;
+    if (skin > 0){
+        get_neighbors_verlet();
+        return;
+    }
 
-    for (int ti=0; ti<nop; ti++){
-        for (int tj=ti; tj<nop; tj++){
-            if(ti==tj) { continue; }
+    //read from the neighbor index if it already reaches the cutoff
+    if (nindex.covers(neighbordistance, 0, nop, atoms.position_checksum(nop))){
+        get_neighbors_from_index();
+        return;
+    }
+
+    begin_neighbor_build();
+
+    //threads own blocks of host atoms, the pairs are merged in order
+    //every periodic image within the cutoff is a neighbor, an atom
+    //can also be a neighbor of its own images in a small box
+    vector<double> frac;
+    fractional_positions(frac);
+    vector<NeighborBuilder> parts(nthreads);
+    parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+        NeighborBuilder &nb = parts[tid];
+        vector<datom> imgs;
 
-            d = get_abs_distance(ti,tj,diffx,diffy,diffz);
-            if (d < neighbordistance){
-                if ((filter == 1) && (atoms[ti].type != atoms[tj].type)){
+        for (int ti=tstart; ti<tstop; ti++){
+            for (int tj=ti; tj<nop; tj++){
+
+                if ((filter == 1) && (atoms.type[ti] != atoms.type[tj])){
                     continue;
                 }
-                else if ((filter == 2) && (atoms[ti].type == atoms[tj].type)){
+                else if ((filter == 2) && (atoms.type[ti] == atoms.type[tj])){
                     continue;
                 }
-                //process_neighbor(ti, tj);
-                atoms[ti].neighbors[atoms[ti].n_neighbors] = tj;
-                atoms[ti].neighbordist[atoms[ti].n_neighbors] = d;
-                //weight is set to 1.0, unless manually reset
-                atoms[ti].neighborweight[atoms[ti].n_neighbors] = 1.00;
-                atoms[ti].n_diffx[atoms[ti].n_neighbors] = diffx;
-                atoms[ti].n_diffy[atoms[ti].n_neighbors] = diffy;
-                atoms[ti].n_diffz[atoms[ti].n_neighbors] = diffz;
-                convert_to_spherical_coordinates(diffx, diffy, diffz, r, phi, theta);
-                atoms[ti].n_r[atoms[ti].n_neighbors] = r;
-                atoms[ti].n_phi[atoms[ti].n_neighbors] = phi;
-                atoms[ti].n_theta[atoms[ti].n_neighbors] = theta;
-                atoms[ti].n_neighbors += 1;
-                atoms[ti].cutoff = neighbordistance;
-
-                atoms[tj].neighbors[atoms[tj].n_neighbors] = ti;
-                atoms[tj].neighbordist[atoms[tj].n_neighbors] = d;
-                //weight is set to 1.0, unless manually reset
-                atoms[tj].neighborweight[atoms[tj].n_neighbors] = 1.00;
-                atoms[tj].n_diffx[atoms[tj].n_neighbors] = -diffx;
-                atoms[tj].n_diffy[atoms[tj].n_neighbors] = -diffy;
-                atoms[tj].n_diffz[atoms[tj].n_neighbors] = -diffz;
-                convert_to_spherical_coordinates(-diffx, -diffy, -diffz, r, phi, theta);
-                atoms[tj].n_r[atoms[tj].n_neighbors] = r;
-                atoms[tj].n_phi[atoms[tj].n_neighbors] = phi;
-                atoms[tj].n_theta[atoms[tj].n_neighbors] = theta;
-                atoms[tj].n_neighbors +=1;
-                atoms[tj].cutoff = neighbordistance;
+                imgs.clear();
+                find_images(ti, tj, sqrt(pair_cutoff_sq(ti, tj)), frac, imgs);
+                for(int i=0; i<imgs.size(); i++){
+                    const datom &x = imgs[i];
+                    //weight is set to 1.0, unless manually reset
+                    nb.add(ti, tj, x.dist, x.dx, x.dy, x.dz);
+                    //the images of an atom come in pairs
+                    if (ti != tj){
+                        nb.add(tj, ti, x.dist, -x.dx, -x.dy, -x.dz);
+                    }
+                }
             }
         }
+    });
+    add_neighbor_parts(parts, neighbordistance);
+    end_neighbor_build();
 
-    }
 
+}
 
+void System::add_neighbor_parts(vector<NeighborBuilder> &parts, double cut){
+    /*
+    Merge pairs found by several threads into the builder and assign
+    the cutoff used to every atom that found a neighbor.
+    */
+    for(int t=0; t<parts.size(); t++){
+        for(int i=0; i<parts[t].bonds.size(); i++){
+            atoms.cutoff[parts[t].bonds[i].ti] = cut;
+        }
+    }
+    nbuilder.merge(parts);
 }
 
 void System::process_neighbor(int ti, int tj){
+    process_neighbor(ti, tj, nbuilder);
+}
+
+void System::process_neighbor(int ti, int tj, NeighborBuilder &nb){
     /*
     Calculate all info and add it to list
     ti - loc of host atom
@@ -1070,25 +2126,27 @@ void System::process_neighbor(int ti, int tj){
      */
 
     double d, diffx, diffy, diffz;
-    double r, phi, theta;
 
     d = get_abs_distance(ti, tj, diffx,diffy,diffz);
 
-    atoms[ti].neighbors[atoms[ti].n_neighbors] = tj;
-    atoms[ti].neighbordist[atoms[ti].n_neighbors] = d;
     //weight is set to 1.0, unless manually reset
-    atoms[ti].neighborweight[atoms[ti].n_neighbors] = 1.00;
-    atoms[ti].n_diffx[atoms[ti].n_neighbors] = diffx;
-    atoms[ti].n_diffy[atoms[ti].n_neighbors] = diffy;
-    atoms[ti].n_diffz[atoms[ti].n_neighbors] = diffz;
-    convert_to_spherical_coordinates(diffx, diffy, diffz, r, phi, theta);
-    atoms[ti].n_r[atoms[ti].n_neighbors] = r;
-    atoms[ti].n_phi[atoms[ti].n_neighbors] = phi;
-    atoms[ti].n_theta[atoms[ti].n_neighbors] = theta;
-    atoms[ti].n_neighbors += 1;
+    //the neighbor is added to the table in end_neighbor_build
+    nb.add(ti, tj, d, diffx, diffy, diffz);
 
 }
 
+void System::process_neighbor(int ti, const datom &x){
+    process_neighbor(ti, x, nbuilder);
+}
+
+void System::process_neighbor(int ti, const datom &x, NeighborBuilder &nb){
+    /*
+    Add a neighbor found as a candidate, the candidate carries
+    the vector to the periodic image that was found
+    */
+    nb.add(ti, x.index, x.dist, x.dx, x.dy, x.dz);
+}
+
 /*
 To increase the speed of the other methods, we need some functions using cells and
 otheriwse which adds atoms to the temp_neighbors list
@@ -1097,9 +2155,6 @@ void System::get_temp_neighbors_brute(vector<int> atomlist){
 
     //reset voronoi flag
 
-    double d;
-    double diffx,diffy,diffz;
-    int ti=0;
     bool halftime;
     if (atomlist.size()==0)
     {
@@ -1113,33 +2168,46 @@ void System::get_temp_neighbors_brute(vector<int> atomlist){
     else{
         halftime=false;
     }
-    for (vector<int>::iterator it = atomlist.begin();it != atomlist.end();it++){
-        ti = *it;
-        if(halftime){
-            for (int tj=ti; tj<nop; tj++){
-                if(ti==tj) { continue; }
-                d = get_abs_distance(ti,tj,diffx,diffy,diffz);
-                if (d <= neighbordistance){
-                    datom x = {d, tj};
-                    atoms[ti].temp_neighbors.emplace_back(x);
-                    datom y = {d, ti};
-                    atoms[tj].temp_neighbors.emplace_back(y);
+
+    //candidates of each thread are kept apart and merged in order
+    vector<double> frac;
+    fractional_positions(frac);
+    vector<vector<int>> hosts(nthreads);
+    vector<vector<datom>> cands(nthreads);
+    parallel_for(atomlist.size(), nthreads, [&](int istart, int istop, int tid){
+        int ti;
+        vector<datom> imgs;
+        for (int it=istart; it<istop; it++){
+            ti = atomlist[it];
+            imgs.clear();
+            if(halftime){
+                for (int tj=ti; tj<nop; tj++){
+                    find_images(ti, tj, neighbordistance, frac, imgs);
+                }
+                for (int i=0; i<imgs.size(); i++){
+                    datom x = imgs[i];
+                    hosts[tid].emplace_back(ti);
+                    cands[tid].emplace_back(x);
+                    //the images of an atom come in pairs
+                    if (x.index != ti){
+                        datom y = {x.dist, ti, -x.dx, -x.dy, -x.dz};
+                        hosts[tid].emplace_back(x.index);
+                        cands[tid].emplace_back(y);
+                    }
                 }
             }
-        }
-        else{
-            for (int tj=0; tj<nop; tj++){
-                if(ti==tj) { continue; }
-                d = get_abs_distance(ti,tj,diffx,diffy,diffz);
-                if (d <= neighbordistance){
-                    datom x = {d, tj};
-                    atoms[ti].temp_neighbors.emplace_back(x);
-                    //datom y = {d, ti};
-                    //atoms[tj].temp_neighbors.emplace_back(y);
+            else{
+                for (int tj=0; tj<nop; tj++){
+                    find_images(ti, tj, neighbordistance, frac, imgs);
+                }
+                for (int i=0; i<imgs.size(); i++){
+                    hosts[tid].emplace_back(ti);
+                    cands[tid].emplace_back(imgs[i]);
                 }
             }
         }
-    }
+    });
+    add_candidate_parts(hosts, cands);
 
 }
 
@@ -1152,14 +2220,7 @@ void System::get_temp_neighbors_cells(vector<int> atomlist){
     //first create cells
     set_up_cells();
 
-    int maincell, subcell;
-    int ti, tj;
-    int i;
-    double d;
-    double diffx,diffy,diffz;
     bool halftime;
-    vector<int> cellforatom;
-    cellforatom.resize(nop);
     if (atomlist.size()==0)
     {
         atomlist.resize(nop); 
@@ -1172,84 +2233,241 @@ void System::get_temp_neighbors_cells(vector<int> atomlist){
     else{
         halftime=false;
     }
-    for(int i=0; i<total_cells; i++){
-        for(int mi=0; mi<cells[i].members.size(); mi++)
+
+    //now loop to find distance, every thread takes a block
+    //of the atomlist and keeps its own candidates
+    vector<vector<int>> hosts(nthreads);
+    vector<vector<datom>> cands(nthreads);
+    parallel_for(atomlist.size(), nthreads, [&](int istart, int istop, int tid){
+        int ti, tj, mj, i, subcell, img, first, n, m;
+        double d;
+        double diffx,diffy,diffz;
+        double tx, ty, tz;
+        double cutsq = neighbordistance*neighbordistance;
+        double dsq[DIST_BLOCK];
+        int hit[DIST_BLOCK];
+        for (int it=istart; it<istop; it++){
+            ti = atomlist[it];
+            i = cells.cellof[ti];
+            for(int j=cells.stencil_begin(i); j<cells.stencil_end(i); j++){
+               //loop through members of j, shifted to the image
+               //the stencil entry refers to
+               subcell = cells.stencil[j];
+               img = cells.stencil_image[j];
+               tx = cells.imagex[img] - cells.posx[cells.slot[ti]];
+               ty = cells.imagey[img] - cells.posy[cells.slot[ti]];
+               tz = cells.imagez[img] - cells.posz[cells.slot[ti]];
+               for(first=cells.begin(subcell); first<cells.end(subcell); first+=DIST_BLOCK){
+                    n = min(DIST_BLOCK, cells.end(subcell)-first);
+                    m = block_within(&cells.posx[first], &cells.posy[first], &cells.posz[first], n,
+                        tx, ty, tz, cutsq, dsq, hit);
+                    for(int h=0; h<m; h++){
+                        //now we have mj -> members/compare with
+                        mj = first + hit[h];
+                        tj = cells.index[mj];
+                        //compare ti and tj and add, an atom and its own
+                        //images are each seen once from both sides
+                        if(halftime){
+                            if ((ti > tj) || ((ti == tj) && (img == cells.zero_image))) continue;
+                        }
+                        else{
+                            if ((ti == tj) && (img == cells.zero_image)) continue;
+                        }
+                        diffx = cells.posx[mj] + tx;
+                        diffy = cells.posy[mj] + ty;
+                        diffz = cells.posz[mj] + tz;
+                        d = sqrt(dsq[hit[h]]);
+                        datom x = {d, tj, diffx, diffy, diffz};
+                        hosts[tid].emplace_back(ti);
+                        cands[tid].emplace_back(x);
+                        if (halftime && (ti != tj)){
+                            datom y = {d, ti, -diffx, -diffy, -diffz};
+                            hosts[tid].emplace_back(tj);
+                            cands[tid].emplace_back(y);
+                        }
+                    }
+               }
+
+            }
+
+        }
+    });
+    add_candidate_parts(hosts, cands);
+
+}
+//order used for the k nearest neighbors, ties are broken by index
+//so that the result does not depend on the search order
+static bool knn_closer(const datom &a, const datom &b){
+    return (a.dist < b.dist) || ((a.dist == b.dist) && (a.index < b.index));
+}
+
+/*
+Find exactly the k nearest neighbors of each atom in atomlist and add them
+as candidates, sorted by distance. The search itself is find_k_nearest.
+*/
+void System::get_temp_neighbors_knn(int k, vector<int> atomlist){
+
+    if (atomlist.size()==0)
+    {
+        atomlist.resize(nop);
+        for (int i = 0; i < nop; ++i)
         {
-            ti = cells[i].members[mi];
-            cellforatom[ti]=i;
+            atomlist[i] = i;
         }
     }
 
-    //now loop to find distance
-    //for(int i=0; i<total_cells; i++){
-        //now go over the neighbor cells
-        //for each member in cell i
-        //for(int mi=0; mi<cells[i].members.size(); mi++){
-            //now go through the neighbors
-            //ti = cells[i].members[mi];
-        for (vector<int>::iterator it = atomlist.begin();it != atomlist.end();it++){
-            ti = *it;
-            i=cellforatom[ti];
-            for(int j=0 ; j<cells[i].neighbor_cells.size(); j++){
-               //loop through members of j
-               subcell = cells[i].neighbor_cells[j];
-               for(int mj=0; mj<cells[subcell].members.size(); mj++){
-                    //now we have mj -> members/compare with
-                    tj = cells[subcell].members[mj];
-                    //compare ti and tj and add
-                    if(halftime){
-                        if (ti < tj){
-                            d = get_abs_distance(ti,tj,diffx,diffy,diffz);
-                            if (d < neighbordistance){
-                                datom x = {d, tj};
-                                atoms[ti].temp_neighbors.emplace_back(x);
-                                datom y = {d, ti};
-                                atoms[tj].temp_neighbors.emplace_back(y);
+    vector<vector<int>> hosts(nthreads);
+    vector<vector<datom>> cands(nthreads);
+    find_k_nearest(k, atomlist, false, hosts, cands);
+    add_candidate_parts(hosts, cands);
+}
+
+/*
+Find exactly the k nearest neighbors of each atom in atomlist, sorted by
+distance, into hosts and cands of the thread that did the atom. The cells
+are searched in shells around the cell of the atom, keeping the k closest
+atoms seen so far in a max heap. After shell s, every atom closer than s
+times the cell thickness has been seen, so the search stops once that
+covers the k-th distance. Shells that go beyond the box continue into the
+periodic images, which are neighbors like any other atom. With ties, the
+atoms at the same distance as the k-th one are added after it as well.
+*/
+void System::find_k_nearest(int k, const vector<int> &atomlist, bool ties,
+    vector<vector<int>> &hosts, vector<vector<datom>> &cands){
+
+    //cells about half the expected distance of the k-th neighbor
+    double boxvol = abs(box[0][0]*(box[1][1]*box[2][2] - box[1][2]*box[2][1])
+                      - box[0][1]*(box[1][0]*box[2][2] - box[1][2]*box[2][0])
+                      + box[0][2]*(box[1][0]*box[2][1] - box[1][1]*box[2][0]));
+    double rguess = cbrt(3.0*k*boxvol/(4.0*PI*double(nop)));
+    neighbordistance = 0.5*rguess;
+    set_up_cells();
+
+    int n[3] = {cells.nx, cells.ny, cells.nz};
+
+    parallel_for(atomlist.size(), nthreads, [&](int istart, int istop, int tid){
+        int ti, tj, g, subcell, si, sj, sk, qi, qj, qk;
+        int ci[3];
+        double d, dsq, kthsq, covered, x, y, z, tx, ty, tz;
+        double diffx, diffy, diffz;
+        vector<datom> heap, tied;
+        heap.reserve(k+1);
+
+        //the shells go on through the periodic images, so there are
+        //always k neighbors unless no direction is periodic
+        covered = cells.width[0];
+        for(int a=1; a<3; a++){
+            covered = min(covered, cells.width[a]);
+        }
+
+        for (int it=istart; it<istop; it++){
+            ti = atomlist[it];
+            g = cells.grid[cells.cellof[ti]];
+            ci[0] = g/(n[1]*n[2]);
+            ci[1] = (g/n[2])%n[1];
+            ci[2] = g%n[2];
+            x = cells.posx[cells.slot[ti]];
+            y = cells.posy[cells.slot[ti]];
+            z = cells.posz[cells.slot[ti]];
+            heap.clear();
+            tied.clear();
+            kthsq = numeric_limits<double>::max();
+
+            for(int sh=0; ; sh++){
+                for(int dx=-sh; dx<=sh; dx++){
+                    for(int dy=-sh; dy<=sh; dy++){
+                        for(int dz=-sh; dz<=sh; dz++){
+                            //cells of earlier shells are done
+                            if ((abs(dx) < sh) && (abs(dy) < sh) && (abs(dz) < sh)){
+                                continue;
                             }
-                        }
-                    }
-                    else{
-                        if (ti != tj){
-                            d = get_abs_distance(ti,tj,diffx,diffy,diffz);
-                            if (d < neighbordistance){
-                                datom x = {d, tj};
-                                atoms[ti].temp_neighbors.emplace_back(x);
-                                //datom y = {d, ti};
-                                //atoms[tj].temp_neighbors.emplace_back(y);
+                            if (cells.outside(0, ci[0]+dx) || cells.outside(1, ci[1]+dy) || cells.outside(2, ci[2]+dz)){
+                                continue;
+                            }
+                            si = cells.wrap(0, ci[0]+dx, qi);
+                            sj = cells.wrap(1, ci[1]+dy, qj);
+                            sk = cells.wrap(2, ci[2]+dz, qk);
+                            subcell = cells.cell_index(si, sj, sk);
+                            tx = qi*lattice[0][0] + qj*lattice[1][0] + qk*lattice[2][0] - x;
+                            ty = qi*lattice[0][1] + qj*lattice[1][1] + qk*lattice[2][1] - y;
+                            tz = qi*lattice[0][2] + qj*lattice[1][2] + qk*lattice[2][2] - z;
+                            for(int mj=cells.begin(subcell); mj<cells.end(subcell); mj++){
+                                tj = cells.index[mj];
+                                if ((tj == ti) && (qi == 0) && (qj == 0) && (qk == 0)) continue;
+                                diffx = cells.posx[mj] + tx;
+                                diffy = cells.posy[mj] + ty;
+                                diffz = cells.posz[mj] + tz;
+                                dsq = diffx*diffx + diffy*diffy + diffz*diffz;
+                                //clearly beyond the k-th atom, the margin keeps
+                                //atoms that only compare after the square root
+                                if (dsq > kthsq) continue;
+                                d = sqrt(dsq);
+                                datom c = {d, tj, diffx, diffy, diffz};
+                                if (heap.size() < k){
+                                    heap.emplace_back(c);
+                                    push_heap(heap.begin(), heap.end(), knn_closer);
+                                }
+                                else if (knn_closer(c, heap.front())){
+                                    pop_heap(heap.begin(), heap.end(), knn_closer);
+                                    swap(heap.back(), c);
+                                    push_heap(heap.begin(), heap.end(), knn_closer);
+                                    //the dropped atom may still tie with the new k-th
+                                    if (ties && (c.dist == heap.front().dist)) tied.emplace_back(c);
+                                }
+                                else if (ties && (c.dist == heap.front().dist)){
+                                    tied.emplace_back(c);
+                                }
+                                if (heap.size() == k){
+                                    kthsq = (1.0 + 1e-12)*heap.front().dist*heap.front().dist;
+                                }
                             }
                         }
                     }
-               }
+                }
 
+                //every atom closer than sh cells around the atom is seen,
+                //ties at the k-th distance need it to be strictly closer
+                if ((heap.size() == k) && ((heap.front().dist < sh*covered) ||
+                    ((!ties) && (heap.front().dist <= sh*covered)))) break;
+                //or the shell holds the whole grid and there are no images
+                bool all = true;
+                for(int a=0; a<3; a++){
+                    all = all && (!periodic[a]) && (ci[a]-sh <= 0) && (ci[a]+sh >= n[a]-1);
+                }
+                if (all) break;
             }
 
+            sort_heap(heap.begin(), heap.end(), knn_closer);
+            if (ties && (heap.size() == k) && (tied.size() > 0)){
+                //earlier ties of a k-th atom that was replaced by a closer one are dropped
+                double dk = heap.back().dist;
+                tied.erase(remove_if(tied.begin(), tied.end(), [dk](const datom &a){ return a.dist != dk; }), tied.end());
+                sort(tied.begin(), tied.end(), knn_closer);
+                heap.insert(heap.end(), tied.begin(), tied.end());
+            }
+            for(int i=0; i<heap.size(); i++){
+                hosts[tid].emplace_back(ti);
+                cands[tid].emplace_back(heap[i]);
+            }
         }
-    //}
-
+    });
 }
+
 int System::get_all_neighbors_bynumber(double prefactor, int nns, int assign,vector<int> atomlist){
     /*
     A new neighbor algorithm that finds a specified number of 
     neighbors for each atom. But ONLY TEMP neighbors
+
+    The nns closest atoms are found exactly, including periodic images,
+    prefactor is no longer needed and only kept for compatibility.
+    They are read from the neighbor index, which is built for all atoms
+    if needed; a few atoms are searched on their own instead.
     */
 
     //reset voronoi flag
     voronoiused = 0;
-    
-
-    double d, dcut;
-    double diffx,diffy,diffz;
-    double r,theta,phi;
-    int m, maxneighs, finished;
-    finished = 1;
 
-    vector<int> nids;
-    vector<double> dists, sorted_dists;
-
-        //double prefactor = 1.21;
-    double summ;
-    double boxvol;
-    int ti=0;
+    bool allatoms = (atomlist.size()==0);
     if (atomlist.size()==0)
     {
         atomlist.resize(nop); 
@@ -1258,205 +2476,443 @@ int System::get_all_neighbors_bynumber(double prefactor, int nns, int assign,vec
             atomlist[i] = i; 
         }
     }
-    //some guesswork here
-    //find the box volumes
-    if (triclinic==1){
-        double a1, a2, a3, b1, b2, b3, c1, c2, c3;
-        //rot is the cell vectors transposed
-        a1 = rot[0][0];
-        a2 = rot[1][0];
-        a3 = rot[2][0];
-        b1 = rot[0][1];
-        b2 = rot[1][1];
-        b3 = rot[2][1];
-        c1 = rot[0][2];
-        c2 = rot[1][2];
-        c3 = rot[2][2];
-        boxvol = c1*(a2*b3-a3*b2) - c2*(a1*b3-b1*a3) + c3*(a1*b2-a2*b1);
+
+    if (allatoms || nindex.covers(0, nns, nop, atoms.position_checksum(nop))){
+        require_neighbor_index(0, nns);
+        vector<vector<int>> hosts(nthreads);
+        vector<vector<datom>> cands(nthreads);
+        parallel_for(atomlist.size(), nthreads, [&](int istart, int istop, int tid){
+            int ti;
+            for (int it=istart; it<istop; it++){
+                ti = atomlist[it];
+                for(int i=0; i<nns; i++){
+                    hosts[tid].emplace_back(ti);
+                    cands[tid].emplace_back(nindex.rows.at(ti, i));
+                }
+            }
+        });
+        add_candidate_parts(hosts, cands);
     }
     else{
-        boxvol = boxx*boxy*boxz;
+        get_temp_neighbors_knn(nns, atomlist);
     }
 
-    //now find the volume per particle
-    double guessvol = boxvol/float(nop);
+    begin_neighbor_build();
+    vector<NeighborBuilder> parts(nthreads);
+    atomic<int> failed(0);
+    parallel_for(atomlist.size(), nthreads, [&](int istart, int istop, int tid){
+        int ti;
+        for (int it=istart; (it<istop) && (!failed); it++){
+            ti = atomlist[it];
+            if (candidates.count(ti) < nns){
+                failed = 1;
+                break;
+            }
 
-    //guess the side of a cube that is occupied by an atom - this is a guess distance
-    double guessdist = cbrt(guessvol);
+            //candidates are already sorted by distance
 
-    //now add some safe padding - this is the prefactor which we will read in
-    guessdist = prefactor*guessdist;
-    neighbordistance = guessdist;
+            if(assign == 1){
+                //assign the neighbors
+                for(int i=0; i<nns; i++){
+                    process_neighbor(ti, candidates.at(ti, i), parts[tid]);
+                }
+            }
+        }
+    });
+    nbuilder.merge(parts);
+    end_neighbor_build();
+
+    return (failed) ? 0 : 1;
+}
 
-    if (usecells){
-        get_temp_neighbors_cells(atomlist);
+void System::set_atom_cutoff(double factor){
+    /*
+    Reassign atom cutoff
+    */
+    int nn;
+    double sum;
+    double avgdist;
+
+    for (int ti=0; ti<nop; ti++){
+        nn = neighbors.count(ti);
+        sum = 0;
+        for (int j=0; j<nn; j++){
+            sum += neighbors.dist[neighbors.begin(ti)+j];
+        }
+        avgdist = sum/(double(nn));
+        atoms.cutoff[ti] = factor*avgdist;
+    }
+}
+
+int System::get_neighbors_from_temp(int style){
+    /*
+    A new neighbor algorithm that finds a specified number of 
+    neighbors for each atom.
+    */
+
+    //reset neighbors
+    reset_main_neighbors();
+    begin_neighbor_build();
+
+    //number of candidates needed, the number which make up the first
+    //shell and the weights of their distances for the cutoff
+    int nreq, nfirst;
+    if (style == 12){
+        nreq = 12;
+        nfirst = 12;
+    }
+    else if (style == 14){
+        nreq = 14;
+        nfirst = 8;
     }
     else{
-        get_temp_neighbors_brute(atomlist);
+        end_neighbor_build();
+        return 1;
     }
-    for (vector<int>::iterator it = atomlist.begin();it != atomlist.end();it++){
-        ti = *it;
-        if (atoms[ti].temp_neighbors.size() < nns){
-            return 0;
+
+    vector<NeighborBuilder> parts(nthreads);
+    atomic<int> failed(0);
+    parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+        double lcut, ssum;
+        for (int ti=tstart; (ti<tstop) && (!failed); ti++){
+            if (candidates.count(ti) < nreq){
+                failed = 1;
+                break;
+            }
+            ssum = 0;
+            for(int i=0 ; i<nfirst; i++){
+                ssum += ((style == 14) ? 1.1547 : 1.0)*candidates.at(ti, i).dist;
+            }
+            for(int i=nfirst ; i<nreq; i++){
+                ssum += candidates.at(ti, i).dist;
+            }
+            //process sum
+            lcut = 1.2071*ssum/double(nreq);
+            //now assign neighbors based on this
+            for(int i=0 ; i<candidates.count(ti); i++){
+                if (candidates.at(ti, i).dist <= lcut)
+                    process_neighbor(ti, candidates.at(ti, i), parts[tid]);
+            }
+        }
+    });
+    nbuilder.merge(parts);
+    end_neighbor_build();
+
+
+    return (failed) ? 0 : 1;
+
+
+}
+
+
+void System::store_neighbor_info(){
+    /*
+    Method to assign neighbors and next nearest neighbors
+
+    The next nearest neighbors are read from the neighbor table
+    when an atom is requested.
+    */    
+    neighbor_info_stored = 1;
+}
+
+
+
+
+void System::find_candidates_within(int ti, double rmax, vector<datom> &cand){
+    /*
+    Add all atoms closer than rmax to atom ti to cand, unsorted, using the
+    cell list. If rmax is larger than the box, the search goes on into the
+    periodic images, along periodic directions.
+    */
+    int n[3] = {cells.nx, cells.ny, cells.nz};
+    int ci[3], reach[3];
+    int g, tj, subcell, si, sj, sk, qi, qj, qk;
+    double d, diffx, diffy, diffz, x, y, z, tx, ty, tz;
+
+    g = cells.grid[cells.cellof[ti]];
+    ci[0] = g/(n[1]*n[2]);
+    ci[1] = (g/n[2])%n[1];
+    ci[2] = g%n[2];
+    for(int a=0; a<3; a++){
+        reach[a] = (int)ceil(rmax/cells.width[a]);
+    }
+    x = cells.posx[cells.slot[ti]];
+    y = cells.posy[cells.slot[ti]];
+    z = cells.posz[cells.slot[ti]];
+
+    for(int dx=-reach[0]; dx<=reach[0]; dx++){
+        for(int dy=-reach[1]; dy<=reach[1]; dy++){
+            for(int dz=-reach[2]; dz<=reach[2]; dz++){
+                if (cells.outside(0, ci[0]+dx) || cells.outside(1, ci[1]+dy) || cells.outside(2, ci[2]+dz)){
+                    continue;
+                }
+                si = cells.wrap(0, ci[0]+dx, qi);
+                sj = cells.wrap(1, ci[1]+dy, qj);
+                sk = cells.wrap(2, ci[2]+dz, qk);
+                subcell = cells.cell_index(si, sj, sk);
+                tx = qi*lattice[0][0] + qj*lattice[1][0] + qk*lattice[2][0] - x;
+                ty = qi*lattice[0][1] + qj*lattice[1][1] + qk*lattice[2][1] - y;
+                tz = qi*lattice[0][2] + qj*lattice[1][2] + qk*lattice[2][2] - z;
+                for(int mj=cells.begin(subcell); mj<cells.end(subcell); mj++){
+                    tj = cells.index[mj];
+                    if ((tj == ti) && (qi == 0) && (qj == 0) && (qk == 0)) continue;
+                    diffx = cells.posx[mj] + tx;
+                    diffy = cells.posy[mj] + ty;
+                    diffz = cells.posz[mj] + tz;
+                    d = sqrt(diffx*diffx + diffy*diffy + diffz*diffz);
+                    if (d < rmax){
+                        datom c = {d, tj, diffx, diffy, diffz};
+                        cand.emplace_back(c);
+                    }
+                }
+            }
         }
+    }
+}
 
-        sort(atoms[ti].temp_neighbors.begin(), atoms[ti].temp_neighbors.end(), by_dist());
-
-        if(assign == 1){
-            //assign the neighbors
-            for(int i=0; i<nns; i++){
-                int tj = atoms[ti].temp_neighbors[i].index;
-                process_neighbor(ti, tj);
+void System::build_neighbor_index(double rmax, int k){
+    /*
+    Build the neighbor index with all atoms closer than rmax to every atom,
+    and at least the k closest ones. The search of an atom is widened until
+    it has found k atoms, so that every row is complete up to its reach.
+    If only k is asked for, the rows are the exact k nearest atoms and their
+    ties, with the k-th distance as reach.
+    */
+    if ((rmax <= 0) && (k > 0)){
+        vector<int> atomlist(nop);
+        for(int ti=0; ti<nop; ti++){
+            atomlist[ti] = ti;
+        }
+        vector<vector<int>> hosts(nthreads);
+        vector<vector<datom>> parts(nthreads);
+        find_k_nearest(k, atomlist, true, hosts, parts);
+
+        //threads take blocks of atoms in order, so the rows
+        //can be put one after the other
+        nindex.rows.reset(nop);
+        for(int t=0; t<hosts.size(); t++){
+            for(int i=0; i<hosts[t].size(); i++){
+                nindex.rows.offsets[hosts[t][i]+1]++;
             }
+            vector<int>().swap(hosts[t]);
         }
-
-        finished = 1;            
+        for(int ti=0; ti<nop; ti++){
+            nindex.rows.offsets[ti+1] += nindex.rows.offsets[ti];
+        }
+        for(int t=0; t<parts.size(); t++){
+            nindex.rows.items.insert(nindex.rows.items.end(), parts[t].begin(), parts[t].end());
+            vector<datom>().swap(parts[t]);
+        }
+        nindex.reach.assign(nop, 0.0);
+        for(int ti=0; ti<nop; ti++){
+            if (nindex.rows.count(ti) > 0)
+                nindex.reach[ti] = nindex.rows.at(ti, nindex.rows.count(ti)-1).dist;
+        }
+        nindex.nearest = true;
+    }
+    else{
+        build_neighbor_index_within(rmax, k);
+        nindex.nearest = false;
     }
 
-
-    return finished;
-
-
+    nindex.radius = (nop > 0) ? nindex.reach[0] : rmax;
+    nindex.k = (nop > 0) ? nindex.rows.count(0) : k;
+    for(int ti=1; ti<nop; ti++){
+        nindex.radius = min(nindex.radius, nindex.reach[ti]);
+        nindex.k = min(nindex.k, nindex.rows.count(ti));
+    }
+    nindex.checksum = atoms.position_checksum(nop);
+    nindex.valid = true;
 }
 
-void System::set_atom_cutoff(double factor){
+void System::build_neighbor_index_within(double rmax, int k){
     /*
-    Reassign atom cutoff
+    Rows of the neighbor index from searches within a radius, which starts
+    at rmax or the distance expected for k atoms and is widened by 1.5 for
+    an atom until it has found k.
     */
-    int nn;
-    double sum;
-    double avgdist;
+    double boxvol = abs(box[0][0]*(box[1][1]*box[2][2] - box[1][2]*box[2][1])
+                      - box[0][1]*(box[1][0]*box[2][2] - box[1][2]*box[2][0])
+                      + box[0][2]*(box[1][0]*box[2][1] - box[1][1]*box[2][0]));
+    double rguess = cbrt(3.0*max(k, 1)*boxvol/(4.0*PI*double(nop)));
+    neighbordistance = max(rmax, rguess);
+    set_up_cells();
 
-    for (int ti=0; ti<nop; ti++){
-        nn = atoms[ti].n_neighbors;
-        sum = 0;
-        for (int j=0; j<nn; j++){
-            sum += atoms[ti].neighbordist[j];
+    //threads take blocks of atoms in order, so the rows
+    //can be put one after the other
+    nindex.reach.assign(nop, 0.0);
+    nindex.rows.reset(nop);
+    //without periodic directions there are at most nop-1 atoms to find
+    bool bounded = !(periodic[0] || periodic[1] || periodic[2]);
+    vector<vector<datom>> parts(nthreads);
+    parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+        double r;
+        vector<datom> cand;
+        for (int ti=tstart; ti<tstop; ti++){
+            r = neighbordistance;
+            while (true){
+                cand.clear();
+                find_candidates_within(ti, r, cand);
+                if (cand.size() >= k) break;
+                if (bounded && (cand.size() >= nop-1)) break;
+                r = 1.5*r;
+            }
+            //ties are put in the same order as the k nearest search
+            sort(cand.begin(), cand.end(), knn_closer);
+            nindex.reach[ti] = r;
+            nindex.rows.offsets[ti+1] = cand.size();
+            parts[tid].insert(parts[tid].end(), cand.begin(), cand.end());
         }
-        avgdist = sum/(double(nn));
-        atoms[ti].cutoff = factor*avgdist;
+    });
+    for(int ti=0; ti<nop; ti++){
+        nindex.rows.offsets[ti+1] += nindex.rows.offsets[ti];
+    }
+    for(int t=0; t<parts.size(); t++){
+        nindex.rows.items.insert(nindex.rows.items.end(), parts[t].begin(), parts[t].end());
+        vector<datom>().swap(parts[t]);
     }
 }
 
-int System::get_neighbors_from_temp(int style){
+void System::require_neighbor_index(double rmax, int k){
     /*
-    A new neighbor algorithm that finds a specified number of 
-    neighbors for each atom.
+    Make sure the neighbor index reaches rmax and holds the k closest
+    atoms. If it has to be built again, it keeps covering what it
+    did before, so that it only grows within a frame. An index of the
+    k nearest atoms reaches at least as far with a larger k.
     */
-
-    int finished = 1;
-    //reset neighbors
-    reset_main_neighbors();
-
-    if (style == 12){
-        for (int ti=0; ti<nop; ti++){
-            if (atoms[ti].temp_neighbors.size() > 11){
-                double ssum = 0;
-                for(int i=0 ; i<12; i++){
-                    ssum += atoms[ti].temp_neighbors[i].dist;
-                }
-                //process sum
-                atoms[ti].lcutsmall = 1.2071*ssum/12;
-                //now assign neighbors based on this
-                for(int i=0 ; i<atoms[ti].temp_neighbors.size(); i++){
-                    int tj = atoms[ti].temp_neighbors[i].index;
-                    double dist = atoms[ti].temp_neighbors[i].dist;
-                    if (dist <= atoms[ti].lcutsmall)
-                        process_neighbor(ti, tj);
-                }
-                finished = 1;                                  
-            }
-            else{
-                return 0;
-            }
-        }
+    uint64_t sum = atoms.position_checksum(nop);
+    if (nindex.covers(rmax, k, nop, sum)) return;
+    if (nindex.holds(nop, sum)){
+        if ((rmax > 0) || (!nindex.nearest)) rmax = max(rmax, nindex.radius);
+        k = max(k, nindex.k);
     }
-    else if (style == 14){
-        for (int ti=0; ti<nop; ti++){
-            if (atoms[ti].temp_neighbors.size() > 13){
-                double ssum = 0;
-                for(int i=0 ; i<8; i++){
-                    ssum += 1.1547*atoms[ti].temp_neighbors[i].dist;
-                }
-                for(int i=8 ; i<14; i++){
-                    ssum += atoms[ti].temp_neighbors[i].dist;
+    build_neighbor_index(rmax, k);
+}
+
+void System::get_neighbors_from_index(){
+    /*
+    Cutoff neighbors read from the neighbor index, which has to reach
+    the cutoff. The rows are sorted, so each one is only read up to it.
+    */
+    begin_neighbor_build();
+    vector<NeighborBuilder> parts(nthreads);
+    parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+        int tj;
+        for (int ti=tstart; ti<tstop; ti++){
+            for(int i=0; i<nindex.rows.count(ti); i++){
+                const datom &x = nindex.rows.at(ti, i);
+                if (x.dist >= neighbordistance) break;
+                tj = x.index;
+                if (x.dist*x.dist >= pair_cutoff_sq(ti, tj)) continue;
+                if ((filter == 1) && (atoms.type[ti] != atoms.type[tj])){
+                    continue;
                 }
-                atoms[ti].lcutlarge = 1.2071*ssum/14;
-                //now assign neighbors based on this
-                for(int i=0 ; i<atoms[ti].temp_neighbors.size(); i++){
-                    int tj = atoms[ti].temp_neighbors[i].index;
-                    double dist = atoms[ti].temp_neighbors[i].dist;
-                    if (dist <= atoms[ti].lcutlarge)
-                        process_neighbor(ti, tj);
+                else if ((filter == 2) && (atoms.type[ti] == atoms.type[tj])){
+                    continue;
                 }
-                finished = 1;                                  
-            }
-            else{
-                return 0;
+                process_neighbor(ti, x, parts[tid]);
             }
         }
-    }
-
-
-    return finished;
-
-
+    });
+    add_neighbor_parts(parts, neighbordistance);
+    end_neighbor_build();
 }
 
-
-void System::store_neighbor_info(){
+void System::build_verlet_list(){
     /*
-    Method to assign neighbors and next nearest neighbors
-
-    */    
-    int nn;
-
-    for (int ti=0; ti<nop; ti++){
+    Build the Verlet list at the current positions from the neighbor
+    index, which is made to reach the cutoff and the skin.
+    */
+    double rc = neighbordistance;
+    require_neighbor_index(rc + skin, 0);
+    neighbordistance = rc;
+
+    verlet.rows = nindex.rows;
+    verlet.x0.assign(atoms.posx.begin(), atoms.posx.begin()+nop);
+    verlet.y0.assign(atoms.posy.begin(), atoms.posy.begin()+nop);
+    verlet.z0.assign(atoms.posz.begin(), atoms.posz.begin()+nop);
+    verlet.cutoff = rc;
+    verlet.skin = skin;
+    verlet.builds++;
+    verlet.valid = true;
+}
 
-        atoms[ti].next_neighbors.clear();
-        atoms[ti].next_neighbor_distances.clear();
-        atoms[ti].next_neighbor_counts.clear();
-        
-        atoms[ti].next_neighbors.resize(atoms[ti].n_neighbors);
-        atoms[ti].next_neighbor_distances.resize(atoms[ti].n_neighbors);
-        atoms[ti].next_neighbor_counts.resize(atoms[ti].n_neighbors);
+void System::get_neighbors_verlet(){
+    /*
+    Cutoff neighbors read from the Verlet list. The list is built again
+    if it was made for another cutoff or skin, or if an atom has moved
+    more than half the skin since. Displacements are taken to the nearest
+    image, so that atoms wrapped back into the box do not count as moved.
+    */
+    vector<double> ux(nop, 0.0), uy(nop, 0.0), uz(nop, 0.0);
+    bool rebuild = !verlet.holds(neighbordistance, skin, nop);
+
+    if (!rebuild){
+        vector<double> umax(nthreads, 0.0);
+        parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+            for (int ti=tstart; ti<tstop; ti++){
+                ux[ti] = atoms.posx[ti] - verlet.x0[ti];
+                uy[ti] = atoms.posy[ti] - verlet.y0[ti];
+                uz[ti] = atoms.posz[ti] - verlet.z0[ti];
+                umax[tid] = max(umax[tid], minimum_image(ux[ti], uy[ti], uz[ti]));
+            }
+        });
+        rebuild = (*max_element(umax.begin(), umax.end()) > 0.5*skin);
+    }
+    if (rebuild){
+        build_verlet_list();
+        fill(ux.begin(), ux.end(), 0.0);
+        fill(uy.begin(), uy.end(), 0.0);
+        fill(uz.begin(), uz.end(), 0.0);
+    }
 
-        for(int i=0; i<atoms[ti].n_neighbors; i++){
-            nn = atoms[ti].neighbors[i];
-            atoms[ti].next_neighbor_counts[i] = atoms[nn].n_neighbors;
-            for(int j=0; j<atoms[nn].n_neighbors; j++){
-                atoms[ti].next_neighbors[i].emplace_back(atoms[nn].neighbors[j]);
-                atoms[ti].next_neighbor_distances[i].emplace_back(atoms[nn].neighbordist[j]);
+    begin_neighbor_build();
+    vector<NeighborBuilder> parts(nthreads);
+    parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+        int tj;
+        double dsq;
+        datom x;
+        for (int ti=tstart; ti<tstop; ti++){
+            for(int i=0; i<verlet.rows.count(ti); i++){
+                x = verlet.rows.at(ti, i);
+                tj = x.index;
+                x.dx += ux[tj] - ux[ti];
+                x.dy += uy[tj] - uy[ti];
+                x.dz += uz[tj] - uz[ti];
+                dsq = x.dx*x.dx + x.dy*x.dy + x.dz*x.dz;
+                if (dsq >= pair_cutoff_sq(ti, tj)) continue;
+                if ((filter == 1) && (atoms.type[ti] != atoms.type[tj])){
+                    continue;
+                }
+                else if ((filter == 2) && (atoms.type[ti] == atoms.type[tj])){
+                    continue;
+                }
+                x.dist = sqrt(dsq);
+                process_neighbor(ti, x, parts[tid]);
             }
         }
-    }
+    });
+    add_neighbor_parts(parts, neighbordistance);
+    end_neighbor_build();
 }
 
-
-
-
 int System::get_all_neighbors_sann(double prefactor){
     /*
     A new adaptive algorithm. Similar to the old ones, we guess a basic distance with padding,
     and sort them up.
     After that, we use the algorithm by in J. Chem. Phys. 136, 234107 (2012) to find the list of
     neighbors.
+
+    Every atom is treated on its own, starting from its row of the neighbor
+    index. If the criterion is not met within the reach of the row, the
+    distance is increased for that atom alone and the candidates found are
+    only sorted as far as the criterion reads them. The search goes on into
+    the periodic images if needed, so the method always converges.
      */
 
     //reset voronoi flag
     voronoiused = 0;
 
-    double d, dcut;
-    double diffx,diffy,diffz;
-    double r,theta,phi;
-    int m, maxneighs, finished;
-    finished = 1;
-
-    vector<int> nids;
-    vector<double> dists, sorted_dists;
-
-    //double prefactor = 1.21;
-    double summ;
     double boxvol;
 
     //some guesswork here
@@ -1488,64 +2944,84 @@ int System::get_all_neighbors_sann(double prefactor){
 
     //now add some safe padding - this is the prefactor which we will read in
     guessdist = prefactor*guessdist;
-    neighbordistance = guessdist;
-
-    if (usecells){
-        get_temp_neighbors_cells();
-    }
-    else{
-        get_temp_neighbors_brute();
-    }
-
-    for (int ti=0; ti<nop; ti++){
-        if (atoms[ti].temp_neighbors.size() < 3){
-            return 0;
-        }
-
-        sort(atoms[ti].temp_neighbors.begin(), atoms[ti].temp_neighbors.end(), by_dist());
-
-        //start with initial routine
-        m = 3;
-        summ = 0;
-        for(int i=0 ; i<m; i++){
-            summ += atoms[ti].temp_neighbors[i].dist;
-            int tj = atoms[ti].temp_neighbors[i].index;
-            process_neighbor(ti, tj);
-        }
-
-        //find cutoff
-        dcut = summ/float(m-2);
-        maxneighs = atoms[ti].temp_neighbors.size();
+    require_neighbor_index(guessdist, 0);
 
-        while( (m < maxneighs) && (dcut >= atoms[ti].temp_neighbors[m].dist)){
-            //increase m
-            m = m+1;
+    //cells are used for any system size, the searches of single
+    //atoms may go beyond the nearest cells
+    neighbordistance = guessdist;
+    set_up_cells();
 
-            //here now we can add this to the list neighbors and process things
-            int tj = atoms[ti].temp_neighbors[m].index;
-            process_neighbor(ti, tj);
+    bool bounded = !(periodic[0] || periodic[1] || periodic[2]);
+    begin_neighbor_build();
+    vector<NeighborBuilder> parts(nthreads);
+    parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+        int m, count, nsorted;
+        double summ, dcut, rmax;
+        bool converged;
+        vector<datom> cand;
+
+        //sort the candidates up to position i, in steps so
+        //that only what the criterion needs is ordered
+        auto sort_upto = [&](int i){
+            if (i < nsorted) return;
+            int upto = min(count, max(i+1, max(2*nsorted, 16)));
+            partial_sort(cand.begin()+nsorted, cand.begin()+upto, cand.end(), knn_closer);
+            nsorted = upto;
+        };
+
+        for (int ti=tstart; ti<tstop; ti++){
+            //the row of the index is already sorted
+            cand.assign(nindex.rows.items.begin()+nindex.rows.offsets[ti],
+                nindex.rows.items.begin()+nindex.rows.offsets[ti+1]);
+            rmax = nindex.reach[ti];
+            nsorted = cand.size();
+            converged = false;
+            while (true){
+                count = cand.size();
+                dcut = 0;
+                m = count;
+
+                if (count >= 3){
+                    //start with initial routine
+                    sort_upto(2);
+                    m = 3;
+                    summ = cand[0].dist + cand[1].dist + cand[2].dist;
+                    dcut = summ/float(m-2);
+
+                    //add the next closest atom as long as it is within the cutoff
+                    while ((m < count)){
+                        sort_upto(m);
+                        if (cand[m].dist > dcut) break;
+                        summ += cand[m].dist;
+                        m = m+1;
+                        dcut = summ/float(m-2);
+                    }
 
-            //find new dcut
-            summ = summ + atoms[ti].temp_neighbors[m].dist;
-            dcut = summ/float(m-2);
-            atoms[ti].cutoff = dcut;
-        }
+                    //converged if the next atom is known to be beyond the cutoff;
+                    //atoms that were not searched are at least rmax away
+                    converged = (m < count) || (dcut < rmax);
+                }
+                //without periodic directions all atoms may have been seen
+                converged = converged || (bounded && (count >= nop-1));
+                if (converged) break;
+
+                //search again further out for this atom
+                rmax = max(1.5*rmax, 1.1*dcut);
+                cand.clear();
+                find_candidates_within(ti, rmax, cand);
+                nsorted = 0;
+            }
 
-        //find if there was an error
-        if (m==maxneighs){
-            finished = 0;
-            break;
-        }
-        else{
-            finished = 1;
+            atoms.cutoff[ti] = dcut;
+            for(int i=0; i<m; i++){
+                process_neighbor(ti, cand[i], parts[tid]);
+            }
         }
+    });
+    nbuilder.merge(parts);
+    end_neighbor_build();
 
-    }
-
-
-    return finished;
-
-
+    return 1;
 }
 
 
@@ -1555,7 +3031,7 @@ int System::get_all_neighbors_adaptive(double prefactor, int nlimit, double padd
     double d, dcut;
     double diffx,diffy,diffz;
     double r,theta,phi;
-    int m, maxneighs, finished;
+    int m, maxneighs;
 
     double summ;
     double boxvol;
@@ -1587,72 +3063,109 @@ int System::get_all_neighbors_adaptive(double prefactor, int nlimit, double padd
 
     //now add some safe padding - this is the prefactor which we will read in
     guessdist = prefactor*guessdist;
-    neighbordistance = guessdist;
 
-    //introduce cell lists here - instead of looping over all neighbors
-    //use cells
-
-    if (usecells){
-        get_temp_neighbors_cells();
-    }
-    else{
-        get_temp_neighbors_brute();
-    }
+    //the candidates are the atoms within the guess distance,
+    //read from the neighbor index
+    require_neighbor_index(guessdist, 0);
 
-    //end of callstructural competition
-    //subatoms would now be populated
     //now starts the main loop
-    for (int ti=0; ti<nop; ti++){
-        //check if its zero size
-        if (atoms[ti].temp_neighbors.size() < nlimit){
-            return 0;
-        }
+    begin_neighbor_build();
+    vector<NeighborBuilder> parts(nthreads);
+    atomic<int> failed(0);
+    parallel_for(nop, nthreads, [&](int tstart, int tstop, int tid){
+        double dcut, summ;
+        for (int ti=tstart; (ti<tstop) && (!failed); ti++){
+            //check if its zero size
+            if ((nindex.rows.count(ti) < nlimit) || (nindex.rows.at(ti, nlimit-1).dist >= guessdist)){
+                failed = 1;
+                break;
+            }
 
-        sort(atoms[ti].temp_neighbors.begin(), atoms[ti].temp_neighbors.end(), by_dist());
+            //candidates are already sorted by distance
 
-        summ = 0;
-        for(int i=0; i<nlimit; i++){
-            summ += atoms[ti].temp_neighbors[i].dist;
-        }
-        dcut = padding*(1.0/float(nlimit))*summ;
+            summ = 0;
+            for(int i=0; i<nlimit; i++){
+                summ += nindex.rows.at(ti, i).dist;
+            }
+            dcut = padding*(1.0/float(nlimit))*summ;
 
-        //now we are ready to loop over again, but over the lists
-        for(int j=0; j<atoms[ti].temp_neighbors.size(); j++){
-            int tj = atoms[ti].temp_neighbors[j].index;
-            if (atoms[ti].temp_neighbors[j].dist < dcut){
+            //now we are ready to loop over again, but over the lists
+            //of candidates within the guess distance
+            for(int j=0; j<nindex.rows.count(ti); j++){
+                const datom &c = nindex.rows.at(ti, j);
+                int tj = c.index;
+                if ((c.dist >= dcut) || (c.dist >= guessdist)) break;
 
-                if ((filter == 1) && (atoms[ti].type != atoms[tj].type)){
+                if ((filter == 1) && (atoms.type[ti] != atoms.type[tj])){
                     continue;
                 }
-                else if ((filter == 2) && (atoms[ti].type == atoms[tj].type)){
+                else if ((filter == 2) && (atoms.type[ti] == atoms.type[tj])){
                     continue;
                 }
-                d = get_abs_distance(ti,tj,diffx,diffy,diffz);
-                atoms[ti].neighbors[atoms[ti].n_neighbors] = tj;
-                atoms[ti].neighbordist[atoms[ti].n_neighbors] =d;
                 //weight is set to 1.0, unless manually reset
-                atoms[ti].neighborweight[atoms[ti].n_neighbors] = 1.00;
-                atoms[ti].n_diffx[atoms[ti].n_neighbors] = diffx;
-                atoms[ti].n_diffy[atoms[ti].n_neighbors] = diffy;
-                atoms[ti].n_diffz[atoms[ti].n_neighbors] = diffz;
-                convert_to_spherical_coordinates(diffx, diffy, diffz, r, phi, theta);
-                atoms[ti].n_r[atoms[ti].n_neighbors] = r;
-                atoms[ti].n_phi[atoms[ti].n_neighbors] = phi;
-                atoms[ti].n_theta[atoms[ti].n_neighbors] = theta;
-                atoms[ti].n_neighbors += 1;
-                atoms[ti].cutoff = dcut;
-
+                parts[tid].add(ti, tj, c.dist, c.dx, c.dy, c.dz);
+                atoms.cutoff[ti] = dcut;
             }
         }
+    });
+    nbuilder.merge(parts);
+    end_neighbor_build();
+
 
+    return (failed) ? 0 : 1;
+
+}
+
+void System::set_neighbordistance(double nn) { neighbordistance = nn; }
+
+void System::set_pair_cutoffs(vector<vector<double>> cuts){
+    /*
+    Set a cutoff for every pair of types, cuts[a-1][b-1] is used between
+    types a and b. The cutoff methods then search up to the largest one.
+    An empty matrix goes back to the single neighbordistance.
+    */
+    int n = cuts.size();
+    for(int a=0; a<n; a++){
+        if (cuts[a].size() != n)
+            throw invalid_argument("pair cutoffs should be a square matrix");
+        for(int b=0; b<n; b++){
+            if (cuts[a][b] != cuts[b][a])
+                throw invalid_argument("pair cutoffs should be symmetric");
+            if (cuts[a][b] < 0)
+                throw invalid_argument("pair cutoffs should not be negative");
+        }
     }
 
+    npairtypes = n;
+    pair_cutsq.assign(n*n, 0.0);
+    if (n == 0) return;
+    neighbordistance = 0;
+    for(int a=0; a<n; a++){
+        for(int b=0; b<n; b++){
+            pair_cutsq[n*a+b] = cuts[a][b]*cuts[a][b];
+            neighbordistance = max(neighbordistance, cuts[a][b]);
+        }
+    }
+}
 
-    return 1;
+void System::check_pair_types(){
+    if (npairtypes == 0) return;
+    for(int ti=0; ti<nop; ti++){
+        if ((atoms.type[ti] < 1) || (atoms.type[ti] > npairtypes))
+            throw invalid_argument("atom types should be between 1 and the size of the pair cutoffs");
+    }
+}
 
+//squared cutoff between two atoms, the pair cutoff of
+//their types if set, neighbordistance otherwise
+double System::pair_cutoff_sq(int ti, int tj){
+    if (npairtypes == 0) return neighbordistance*neighbordistance;
+    return pair_cutsq[npairtypes*(atoms.type[ti]-1) + atoms.type[tj]-1];
 }
 
-void System::set_neighbordistance(double nn) { neighbordistance = nn; }
+void System::set_nthreads(int n) { nthreads = (n > 0) ? n : default_nthreads(); }
+
+int System::get_nthreads() { return nthreads; }
 
 
 //---------------------------------------------------
@@ -1767,25 +3280,28 @@ void System::calculate_complexQLM_6(){
     double realti,imgti;
     double realYLM,imgYLM;
 
+    atoms.ensure_q(6);
+    neighbors.ensure_angles(nthreads);
+
     // nop = parameter.nop;
     for (int ti= 0;ti<nop;ti++){
 
-        nn = atoms[ti].n_neighbors;
+        nn = neighbors.count(ti);
         for (int mi = -6;mi < 7;mi++){
 
             realti = 0.0;
             imgti = 0.0;
-            for (int ci = 0;ci<nn;ci++){
+            for (int ci = neighbors.begin(ti);ci<neighbors.end(ti);ci++){
 
-                QLM(6,mi,atoms[ti].n_theta[ci],atoms[ti].n_phi[ci],realYLM, imgYLM);
-                realti += atoms[ti].neighborweight[ci]*realYLM;
-                imgti += atoms[ti].neighborweight[ci]*imgYLM;
+                QLM(6,mi,neighbors.theta[ci],neighbors.phi[ci],realYLM, imgYLM);
+                realti += neighbors.weight[ci]*realYLM;
+                imgti += neighbors.weight[ci]*imgYLM;
             }
 
             realti = realti/(double(nn));
             imgti = imgti/(double(nn));
-            atoms[ti].realq[4][mi+6] = realti;
-            atoms[ti].imgq[4][mi+6] = imgti;
+            atoms.realq[4][AtomStore::qlm_index(ti, 6, mi+6)] = realti;
+            atoms.imgq[4][AtomStore::qlm_index(ti, 6, mi+6)] = imgti;
         }
     }
 }
@@ -1798,23 +3314,43 @@ void System::GlobalBOO_Bond(vector <int> atomlist)
     bondvec.clear();
     bondpos.resize(0);
     bondvec.resize(0);
+    if (usehalf){
+        //every pair of the half list once, from the atom with
+        //the lower index as above
+        vector<char> inlist(nop, 0);
+        for (int i=0; i<atomlist.size(); i++) inlist[atomlist[i]] = 1;
+        for (int s=0; s<halfneighbors.nslots(); s++){
+            halfneighbors.for_row(s, [&](int t, long long b){
+                int ti = min(halfneighbors.order[s], halfneighbors.order[t]);
+                int tj = max(halfneighbors.order[s], halfneighbors.order[t]);
+                if ((ti == tj) || (!inlist[ti])) return;
+                if (atoms.condition[ti] != atoms.condition[tj]) return;
+                bondpos.push_back({(atoms.posx[ti] + atoms.posx[tj]) / 2,
+                    (atoms.posy[ti] + atoms.posy[tj]) / 2, (atoms.posz[ti] + atoms.posz[tj]) / 2});
+                bondvec.push_back({atoms.posx[ti] - atoms.posx[tj],
+                    atoms.posy[ti] - atoms.posy[tj], atoms.posz[ti] - atoms.posz[tj]});
+            });
+        }
+        return;
+    }
     for (vector<int>::iterator it = atomlist.begin(); it != atomlist.end(); it++) {
             ti = *it;
-            nn = atoms[ti].n_neighbors;
-        for (int ci = 0; ci < nn; ci++) {
-            if(atoms[ti].neighbors[ci]> ti){//对每对键只算一次
+            nn = neighbors.count(ti);
+        for (int ci = neighbors.begin(ti); ci < neighbors.end(ti); ci++) {
+            int tj = neighbors.index[ci];
+            if(tj > ti){//对每对键只算一次
             
-                if (atoms[ti].condition != atoms[atoms[ti].neighbors[ci]].condition) continue;
+                if (atoms.condition[ti] != atoms.condition[tj]) continue;
                 bondpostemp= vector<double>(3, 0);
                 bondvectemp = vector<double>(3, 0);
 
-                bondpostemp[0] = (atoms[ti].posx + atoms[atoms[ti].neighbors[ci]].posx) / 2;
-                bondpostemp[1] = (atoms[ti].posy + atoms[atoms[ti].neighbors[ci]].posy) / 2;
-                bondpostemp[2] = (atoms[ti].posz + atoms[atoms[ti].neighbors[ci]].posz) / 2;
+                bondpostemp[0] = (atoms.posx[ti] + atoms.posx[tj]) / 2;
+                bondpostemp[1] = (atoms.posy[ti] + atoms.posy[tj]) / 2;
+                bondpostemp[2] = (atoms.posz[ti] + atoms.posz[tj]) / 2;
 
-                bondvectemp[0] = (atoms[ti].posx - atoms[atoms[ti].neighbors[ci]].posx) ;
-                bondvectemp[1] = (atoms[ti].posy - atoms[atoms[ti].neighbors[ci]].posy) ;
-                bondvectemp[2] = (atoms[ti].posz - atoms[atoms[ti].neighbors[ci]].posz) ;
+                bondvectemp[0] = (atoms.posx[ti] - atoms.posx[tj]) ;
+                bondvectemp[1] = (atoms.posy[ti] - atoms.posy[tj]) ;
+                bondvectemp[2] = (atoms.posz[ti] - atoms.posz[tj]) ;
                 bondpos.emplace_back(bondpostemp);
                 bondvec.emplace_back(bondvectemp);
             }
@@ -1855,8 +3391,8 @@ void  System::GlobalBOO_Sum(vector <int>qs){
                 itheta = acos(bondvec[i][2] / d);//acos z/r
                 iphi= atan2(bondvec[i][1], bondvec[i][0]);//atan2(y,x)
                 QLM(q, mi, itheta, iphi, realYLM, imgYLM);
-                //realti += atoms[ti].neighborweight[ci] * realYLM;
-                //imgti += atoms[ti].neighborweight[ci] * imgYLM;
+                //realti += neighbors.weight[neighbors.begin(ti)+ci] * realYLM;
+                //imgti += neighbors.weight[neighbors.begin(ti)+ci] * imgYLM;
                 global_Qlm[0][tq][mi + q] += realYLM;
                 global_Qlm[1][tq][mi + q] += imgYLM;
                 weightsum += 1;
@@ -2136,19 +3672,23 @@ void System::calculate_w(vector <int> qs, vector <int> atomlist,bool averageon)
     int ti = 0;
     double wig;
     complex<double> Qlm1,Qlm2,Qlm3, Complexsum;
+    const double *rq, *iq;
     if (!averageon) {
+        for (int tq = 0; tq < qs.size(); tq++) atoms.ensure_w(qs[tq], false);
         for (vector<int>::iterator it = atomlist.begin(); it != atomlist.end(); it++) {
             ti = *it;
             for (int tq = 0; tq < qs.size(); tq++) {
                 q = qs[tq];
+                rq = &atoms.realq[q - 2][AtomStore::qlm_index(ti, q, 0)];
+                iq = &atoms.imgq[q - 2][AtomStore::qlm_index(ti, q, 0)];
                 Complexsum = 0;
                 for (int m1 = -q; m1 < q + 1; m1++) {
                     for (int m2 = m1; m2 < q + 1; m2++) {
                         int m3 = 0 - m1 - m2;
                         wig = WignerSymbols::wigner3j(q, q, q, m1, m2, m3);
-                        Qlm1 = atoms[ti].realq[q - 2][m1 + q] + atoms[ti].imgq[q - 2][m1 + q] * 1i;
-                        Qlm2 = atoms[ti].realq[q - 2][m2 + q] + atoms[ti].imgq[q - 2][m2 + q] * 1i;
-                        Qlm3 = atoms[ti].realq[q - 2][m3 + q] + atoms[ti].imgq[q - 2][m3 + q] * 1i;
+                        Qlm1 = rq[m1 + q] + iq[m1 + q] * 1i;
+                        Qlm2 = rq[m2 + q] + iq[m2 + q] * 1i;
+                        Qlm3 = rq[m3 + q] + iq[m3 + q] * 1i;
                         if (m2 == m1) {
                         Complexsum += wig * Qlm1 * Qlm2 * Qlm3;
                         }
@@ -2161,24 +3701,27 @@ void System::calculate_w(vector <int> qs, vector <int> atomlist,bool averageon)
                         
                     }
                 }
-                atoms[ti].w[q-2] = Complexsum.real();
-                atoms[ti].wnorm[q-2] = Complexsum.real() / pow(atoms[ti].q[q-2], 3) * pow(4 * PI / (2 * q + 1), 3.0 / 2.0);
+                atoms.w[q-2][ti] = Complexsum.real();
+                atoms.wnorm[q-2][ti] = Complexsum.real() / pow(atoms.q[q-2][ti], 3) * pow(4 * PI / (2 * q + 1), 3.0 / 2.0);
             }
         }
     }
     else {
+        for (int tq = 0; tq < qs.size(); tq++) atoms.ensure_w(qs[tq], true);
         for (vector<int>::iterator it = atomlist.begin(); it != atomlist.end(); it++) {
             ti = *it;
             for (int tq = 0; tq < qs.size(); tq++) {
                 q = qs[tq];
+                rq = &atoms.arealq[q - 2][AtomStore::qlm_index(ti, q, 0)];
+                iq = &atoms.aimgq[q - 2][AtomStore::qlm_index(ti, q, 0)];
                 Complexsum = 0;
                 for (int m1 = -q; m1 < q + 1; m1++) {
                     for (int m2 = m1; m2 < q + 1; m2++) {
                         int m3 = 0 - m1 - m2;
                                 wig = WignerSymbols::wigner3j(q, q, q, m1, m2, m3);
-                                Qlm1 = atoms[ti].arealq[q - 2][m1 + q] + atoms[ti].aimgq[q - 2][m1 + q] * 1i;
-                                Qlm2 = atoms[ti].arealq[q - 2][m2 + q] + atoms[ti].aimgq[q - 2][m2 + q] * 1i;
-                                Qlm3 = atoms[ti].arealq[q - 2][m3 + q] + atoms[ti].aimgq[q - 2][m3 + q] * 1i;
+                                Qlm1 = rq[m1 + q] + iq[m1 + q] * 1i;
+                                Qlm2 = rq[m2 + q] + iq[m2 + q] * 1i;
+                                Qlm3 = rq[m3 + q] + iq[m3 + q] * 1i;
                                 if (m2 == m1) {
                                     Complexsum += wig * Qlm1 * Qlm2 * Qlm3;
                                 }
@@ -2191,8 +3734,8 @@ void System::calculate_w(vector <int> qs, vector <int> atomlist,bool averageon)
                         
                     }
                 }
-                atoms[ti].aw[q - 2] = Complexsum.real();
-                atoms[ti].awnorm[q - 2] = Complexsum.real() / pow(atoms[ti].aq[q - 2], 3) * pow(4 * PI / (2 * q + 1), 3.0 / 2.0);
+                atoms.aw[q - 2][ti] = Complexsum.real();
+                atoms.awnorm[q - 2][ti] = Complexsum.real() / pow(atoms.aq[q - 2][ti], 3) * pow(4 * PI / (2 * q + 1), 3.0 / 2.0);
             }
         }
     }
@@ -2204,29 +3747,18 @@ void System::calculate_q(vector <int> qs,vector <int> atomlist){
     //set_reqd_qs(qs);
 
     //nn = number of neighbors
-    int nn;
+    int nn, tj;
     double realti,imgti;
     double realYLM,imgYLM;
     int q;
     double summ;
     int ti=0;
 
-    //first make space in atoms for the number of qs needed - assign with null values
-    /*
-    for(int ti=0;ti<nop;ti++){
-        for(int tj=0;tj<11;tj++){
-
-            atoms[ti].q[tj] = -1;
-            atoms[ti].aq[tj] = -1;
-            for(int tk=0;tk<25;tk++){
-                atoms[ti].realq[tj][tk] = 0;
-                atoms[ti].imgq[tj][tk] = 0;
-                atoms[ti].arealq[tj][tk] = 0;
-                atoms[ti].aimgq[tj][tk] = 0;
-            }
-        }
+    //first make space in the store for the qs needed - assigned with null values
+    for(int tq=0;tq<qs.size();tq++){
+        atoms.ensure_q(qs[tq]);
     }
-    */
+    neighbors.ensure_angles(nthreads);
 
     //note that the qvals will be in -2 pos
     //q2 will be in q0 pos and so on
@@ -2235,7 +3767,7 @@ void System::calculate_q(vector <int> qs,vector <int> atomlist){
     //for (int ti= 0;ti<nop;ti++){
     for (vector<int>::iterator it = atomlist.begin();it != atomlist.end();it++){
         ti = *it;
-        nn = atoms[ti].n_neighbors;
+        nn = neighbors.count(ti);
         //for(int tq=0;tq<lenqs;tq++){
         for(int tq=0;tq<qs.size();tq++){
             //find which q?
@@ -2246,12 +3778,13 @@ void System::calculate_q(vector <int> qs,vector <int> atomlist){
                 realti = 0.0;
                 imgti = 0.0;
                 weightsum = 0;
-                for (int ci = 0;ci<nn;ci++){
-                    if (atoms[ti].condition != atoms[atoms[ti].neighbors[ci]].condition) continue;
-                    QLM(q,mi,atoms[ti].n_theta[ci],atoms[ti].n_phi[ci],realYLM, imgYLM);
-                    realti += atoms[ti].neighborweight[ci]*realYLM;
-                    imgti += atoms[ti].neighborweight[ci]*imgYLM;
-                    weightsum += atoms[ti].neighborweight[ci];
+                for (int ci = neighbors.begin(ti);ci<neighbors.end(ti);ci++){
+                    tj = neighbors.index[ci];
+                    if (atoms.condition[ti] != atoms.condition[tj]) continue;
+                    QLM(q,mi,neighbors.theta[ci],neighbors.phi[ci],realYLM, imgYLM);
+                    realti += neighbors.weight[ci]*realYLM;
+                    imgti += neighbors.weight[ci]*imgYLM;
+                    weightsum += neighbors.weight[ci];
                 }
 
             //the weights are not normalised,
@@ -2261,15 +3794,15 @@ void System::calculate_q(vector <int> qs,vector <int> atomlist){
             }
 
 
-            atoms[ti].realq[q-2][mi+q] = realti;
-            atoms[ti].imgq[q-2][mi+q] = imgti;
+            atoms.realq[q-2][AtomStore::qlm_index(ti, q, mi+q)] = realti;
+            atoms.imgq[q-2][AtomStore::qlm_index(ti, q, mi+q)] = imgti;
 
             summ+= realti*realti + imgti*imgti;
             //summ+= realti;
             }
             //normalise summ
             summ = pow(((4.0*PI/(2*q+1)) * summ),0.5);
-            atoms[ti].q[q-2] = summ;
+            atoms.q[q-2][ti] = summ;
 
         }
 
@@ -2282,7 +3815,7 @@ void System::calculate_q(vector <int> qs,vector <int> atomlist){
 void System::calculate_aq(vector <int> qs,vector <int> atomlist){
 
     //nn = number of neighbors
-    int nn;
+    int nn, tj;
     double realti,imgti;
     //double realYLM,imgYLM;
     int q;
@@ -2293,27 +3826,33 @@ void System::calculate_aq(vector <int> qs,vector <int> atomlist){
     //if (!qsfound) { calculate_q(qs); }
     //note that the qvals will be in -2 pos
     //q2 will be in q0 pos and so on
+    for(int tq=0;tq<qs.size();tq++){
+        atoms.ensure_aq(qs[tq]);
+    }
 
     // nop = parameter.nop;
     //for (int ti= 0;ti<nop;ti++){
     for (vector<int>::iterator it = atomlist.begin();it != atomlist.end();it++){
         ti = *it;
 
-        nn = atoms[ti].n_neighbors;
+        nn = neighbors.count(ti);
 
         for(int tq=0;tq<qs.size();tq++){
             //find which q?
             q = qs[tq];
+            const vector<double> &rq = atoms.realq[q-2];
+            const vector<double> &iq = atoms.imgq[q-2];
             //cout<<q<<endl;
             summ = 0;
             for (int mi = 0;mi < 2*q+1;mi++){
-                realti = atoms[ti].realq[q-2][mi];
-                imgti = atoms[ti].imgq[q-2][mi];
+                realti = rq[AtomStore::qlm_index(ti, q, mi)];
+                imgti = iq[AtomStore::qlm_index(ti, q, mi)];
                 nns = 0;
-                for (int ci = 0;ci<nn;ci++){
-                    if (atoms[ti].condition != atoms[atoms[ti].neighbors[ci]].condition) continue; 
-                    realti += atoms[atoms[ti].neighbors[ci]].realq[q-2][mi];
-                    imgti += atoms[atoms[ti].neighbors[ci]].imgq[q-2][mi];
+                for (int ci = neighbors.begin(ti);ci<neighbors.end(ti);ci++){
+                    tj = neighbors.index[ci];
+                    if (atoms.condition[ti] != atoms.condition[tj]) continue; 
+                    realti += rq[AtomStore::qlm_index(tj, q, mi)];
+                    imgti += iq[AtomStore::qlm_index(tj, q, mi)];
                     nns += 1;
                 }
 
@@ -2323,14 +3862,14 @@ void System::calculate_aq(vector <int> qs,vector <int> atomlist){
             realti = realti/(double(nns+1));
             imgti = imgti/(double(nns+1));
 
-            atoms[ti].arealq[q-2][mi] = realti;
-            atoms[ti].aimgq[q-2][mi] = imgti;
+            atoms.arealq[q-2][AtomStore::qlm_index(ti, q, mi)] = realti;
+            atoms.aimgq[q-2][AtomStore::qlm_index(ti, q, mi)] = imgti;
 
             summ+= realti*realti + imgti*imgti;
             }
             //normalise summ
             summ = pow(((4.0*PI/(2*q+1)) * summ),0.5);
-            atoms[ti].aq[q-2] = summ;
+            atoms.aq[q-2][ti] = summ;
 
         }
 
@@ -2338,23 +3877,18 @@ void System::calculate_aq(vector <int> qs,vector <int> atomlist){
 }
 
 vector<double> System::gqvals(int qq){
-    vector<double> qres;
-    qres.reserve(real_nop);
-    for(int i=0;i<real_nop;i++){
-        qres.emplace_back(atoms[i].q[qq-2]);
+    //q values which are not calculated are returned as -1
+    if (atoms.q[qq-2].size() != nop){
+        return vector<double>(real_nop, -1.0);
     }
-
-    return qres;
+    return vector<double>(atoms.q[qq-2].begin(), atoms.q[qq-2].begin()+real_nop);
 }
 
 vector<double> System::gaqvals(int qq){
-    vector<double> qres;
-    qres.reserve(real_nop);
-    for(int i=0;i<real_nop;i++){
-        qres.emplace_back(atoms[i].aq[qq-2]);
+    if (atoms.aq[qq-2].size() != nop){
+        return vector<double>(real_nop, -1.0);
     }
-
-    return qres;
+    return vector<double>(atoms.aq[qq-2].begin(), atoms.aq[qq-2].begin()+real_nop);
 }
 
 void System::calculate_disorder(){
@@ -2365,20 +3899,23 @@ void System::calculate_disorder(){
     double realdotproduct,imgdotproduct;
     double connection;
     double dis;
+    const double *rqi, *iqi, *rqj, *iqj;
 
     for(int ti=0; ti<nop; ti++){
 
         sumSquareti = 0.0;
         realdotproduct = 0.0;
         imgdotproduct = 0.0;
+        rqi = &atoms.realq[solidq-2][AtomStore::qlm_index(ti, solidq, 0)];
+        iqi = &atoms.imgq[solidq-2][AtomStore::qlm_index(ti, solidq, 0)];
 
         for (int mi = 0;mi < 2*solidq+1 ;mi++){
-            sumSquareti += atoms[ti].realq[solidq-2][mi]*atoms[ti].realq[solidq-2][mi] + atoms[ti].imgq[solidq-2][mi] *atoms[ti].imgq[solidq-2][mi];
-            realdotproduct += atoms[ti].realq[solidq-2][mi]*atoms[ti].realq[solidq-2][mi];
-            imgdotproduct  += atoms[ti].imgq[solidq-2][mi] *atoms[ti].imgq[solidq-2][mi];
+            sumSquareti += rqi[mi]*rqi[mi] + iqi[mi] *iqi[mi];
+            realdotproduct += rqi[mi]*rqi[mi];
+            imgdotproduct  += iqi[mi] *iqi[mi];
         }
         connection = (realdotproduct+imgdotproduct)/(sqrt(sumSquareti)*sqrt(sumSquareti));
-        atoms[ti].sii = connection;
+        atoms.sii[ti] = connection;
 
     }
 
@@ -2391,18 +3928,22 @@ void System::calculate_disorder(){
         realdotproduct = 0.0;
         imgdotproduct = 0.0;
         dis = 0;
+        rqi = &atoms.realq[solidq-2][AtomStore::qlm_index(ti, solidq, 0)];
+        iqi = &atoms.imgq[solidq-2][AtomStore::qlm_index(ti, solidq, 0)];
 
-        for(int tj=0; tj<atoms[ti].n_neighbors; tj++){
+        for(int tj=0; tj<neighbors.count(ti); tj++){
+            rqj = &atoms.realq[solidq-2][AtomStore::qlm_index(tj, solidq, 0)];
+            iqj = &atoms.imgq[solidq-2][AtomStore::qlm_index(tj, solidq, 0)];
             for (int mi = 0;mi < 2*solidq+1 ;mi++){
-                sumSquareti += atoms[ti].realq[solidq-2][mi]*atoms[ti].realq[solidq-2][mi] + atoms[ti].imgq[solidq-2][mi] *atoms[ti].imgq[solidq-2][mi];
-                sumSquaretj += atoms[tj].realq[solidq-2][mi]*atoms[tj].realq[solidq-2][mi] + atoms[tj].imgq[solidq-2][mi] *atoms[tj].imgq[solidq-2][mi];
-                realdotproduct += atoms[ti].realq[solidq-2][mi]*atoms[tj].realq[solidq-2][mi];
-                imgdotproduct  += atoms[ti].imgq[solidq-2][mi] *atoms[tj].imgq[solidq-2][mi];
+                sumSquareti += rqi[mi]*rqi[mi] + iqi[mi] *iqi[mi];
+                sumSquaretj += rqj[mi]*rqj[mi] + iqj[mi] *iqj[mi];
+                realdotproduct += rqi[mi]*rqj[mi];
+                imgdotproduct  += iqi[mi] *iqj[mi];
             }
             connection = (realdotproduct+imgdotproduct)/(sqrt(sumSquaretj)*sqrt(sumSquareti));
-            dis += (atoms[ti].sii + atoms[tj].sii - 2*connection);
+            dis += (atoms.sii[ti] + atoms.sii[tj] - 2*connection);
         }
-        atoms[ti].disorder = dis/float(atoms[ti].n_neighbors);
+        atoms.disorder[ti] = dis/float(neighbors.count(ti));
 
     }
 }
@@ -2412,13 +3953,13 @@ void System::find_average_disorder(){
     int nn;
 
     for (int ti= 0;ti<nop;ti++){
-        nn = atoms[ti].n_neighbors;
-        vv = atoms[ti].disorder;
-        for (int ci = 0; ci<nn; ci++){
-            vv += atoms[atoms[ti].neighbors[ci]].disorder;
+        nn = neighbors.count(ti);
+        vv = atoms.disorder[ti];
+        for (int ci = neighbors.begin(ti); ci<neighbors.end(ti); ci++){
+            vv += atoms.disorder[neighbors.index[ci]];
         }
         vv = vv/(double(nn+1));
-        atoms[ti].avgdisorder = vv;
+        atoms.avgdisorder[ti] = vv;
     }
 }
 //-----------------------------------------------------
@@ -2435,12 +3976,18 @@ double System::get_number_from_bond(int ti,int tj){
     realdotproduct = 0.0;
     imgdotproduct = 0.0;
 
+    //the m components of an atom are contiguous in the store
+    const double *rqi = &atoms.realq[solidq-2][AtomStore::qlm_index(ti, solidq, 0)];
+    const double *iqi = &atoms.imgq[solidq-2][AtomStore::qlm_index(ti, solidq, 0)];
+    const double *rqj = &atoms.realq[solidq-2][AtomStore::qlm_index(tj, solidq, 0)];
+    const double *iqj = &atoms.imgq[solidq-2][AtomStore::qlm_index(tj, solidq, 0)];
+
     for (int mi = 0;mi < 2*solidq+1 ;mi++){
 
-        sumSquareti += atoms[ti].realq[solidq-2][mi]*atoms[ti].realq[solidq-2][mi] + atoms[ti].imgq[solidq-2][mi] *atoms[ti].imgq[solidq-2][mi];
-        sumSquaretj += atoms[tj].realq[solidq-2][mi]*atoms[tj].realq[solidq-2][mi] + atoms[tj].imgq[solidq-2][mi] *atoms[tj].imgq[solidq-2][mi];
-        realdotproduct += atoms[ti].realq[solidq-2][mi]*atoms[tj].realq[solidq-2][mi];
-        imgdotproduct  += atoms[ti].imgq[solidq-2][mi] *atoms[tj].imgq[solidq-2][mi];
+        sumSquareti += rqi[mi]*rqi[mi] + iqi[mi] *iqi[mi];
+        sumSquaretj += rqj[mi]*rqj[mi] + iqj[mi] *iqj[mi];
+        realdotproduct += rqi[mi]*rqj[mi];
+        imgdotproduct  += iqi[mi] *iqj[mi];
     }
 
     connection = (realdotproduct+imgdotproduct)/(sqrt(sumSquaretj)*sqrt(sumSquareti));
@@ -2476,24 +4023,54 @@ void System::calculate_frenkel_numbers(){
     int frenkelcons;
     double scalar;
 
+    if (usehalf){
+        //the bond is symmetric, so it counts for both atoms, an
+        //image of the atom itself stands for two neighbors
+        for (int ti= 0;ti<nop;ti++){
+            atoms.frenkelnumber[ti] = 0;
+            atoms.avq6q6[ti] = 0.0;
+        }
+        for (int s=0; s<halfneighbors.nslots(); s++){
+            int ti = halfneighbors.order[s];
+            halfneighbors.for_row(s, [&](int t, long long b){
+                int tj = halfneighbors.order[t];
+                double scalar = get_number_from_bond(ti, tj);
+                int solid = (comparecriteria == 0) ? (scalar > threshold) : (scalar < threshold);
+                int times = (ti == tj) ? 2 : 1;
+                atoms.frenkelnumber[ti] += times*solid;
+                atoms.avq6q6[ti] += times*scalar;
+                if (ti != tj){
+                    atoms.frenkelnumber[tj] += solid;
+                    atoms.avq6q6[tj] += scalar;
+                }
+            });
+        }
+        for (int ti= 0;ti<nop;ti++){
+            atoms.avq6q6[ti] /= halfneighbors.degree[ti];
+        }
+        return;
+    }
+
     for (int ti= 0;ti<nop;ti++){
 
         frenkelcons = 0;
-        atoms[ti].avq6q6 = 0.0;
-        for (int c = 0;c<atoms[ti].n_neighbors;c++){
+        atoms.avq6q6[ti] = 0.0;
+        for (int c = neighbors.begin(ti);c<neighbors.end(ti);c++){
 
-            scalar = get_number_from_bond(ti,atoms[ti].neighbors[c]);
-            atoms[ti].sij[c] = scalar;
-            if (comparecriteria == 0)
+            scalar = get_number_from_bond(ti,neighbors.index[c]);
+            neighbors.sij[c] = scalar;
+            if (comparecriteria == 0){
                 if (scalar > threshold) frenkelcons += 1;
-            else
+            }
+            else{
                 if (scalar < threshold) frenkelcons += 1;
+            }
             
-            atoms[ti].avq6q6 += scalar;
+            atoms.avq6q6[ti] += scalar;
         }
 
-        atoms[ti].frenkelnumber = frenkelcons;
-        atoms[ti].avq6q6 /= atoms[ti].n_neighbors;
+        atoms.frenkelnumber[ti] = frenkelcons;
+        atoms.avq6q6[ti] /= neighbors.count(ti);
 
     }
 }
@@ -2505,18 +4082,19 @@ void System::find_solid_atoms(){
     if (criteria == 0){
         for (int ti= 0;ti<nop;ti++){
           if (comparecriteria == 0)
-            atoms[ti].issolid = ( (atoms[ti].frenkelnumber > minfrenkel) && (atoms[ti].avq6q6 > avgthreshold) );
+            atoms.issolid[ti] = ( (atoms.frenkelnumber[ti] > minfrenkel) && (atoms.avq6q6[ti] > avgthreshold) );
           else
-            atoms[ti].issolid = ( (atoms[ti].frenkelnumber > minfrenkel) && (atoms[ti].avq6q6 < avgthreshold) );
+            atoms.issolid[ti] = ( (atoms.frenkelnumber[ti] > minfrenkel) && (atoms.avq6q6[ti] < avgthreshold) );
         }
     }
     else if (criteria == 1){
         for (int ti= 0;ti<nop;ti++){
-            tfrac = ((atoms[ti].frenkelnumber/double(atoms[ti].n_neighbors)) > minfrenkel);
+            int nn = (usehalf) ? halfneighbors.degree[ti] : neighbors.count(ti);
+            tfrac = ((atoms.frenkelnumber[ti]/double(nn)) > minfrenkel);
             if (comparecriteria == 0)
-                atoms[ti].issolid = (tfrac && (atoms[ti].avq6q6 > avgthreshold));
+                atoms.issolid[ti] = (tfrac && (atoms.avq6q6[ti] > avgthreshold));
             else
-                atoms[ti].issolid = (tfrac && (atoms[ti].avq6q6 < avgthreshold));
+                atoms.issolid[ti] = (tfrac && (atoms.avq6q6[ti] < avgthreshold));
         }
     }
 
@@ -2527,29 +4105,30 @@ void System::find_clusters(double clustercutoff){
         //Clustering methods should only run over real atoms
         if (clustercutoff != 0){
           for(int ti=0; ti<real_nop;ti++){
-              atoms[ti].cutoff = clustercutoff;
+              atoms.cutoff[ti] = clustercutoff;
           }
         }
         for(int ti=0; ti<real_nop;ti++){
-            atoms[ti].belongsto = -1;
+            atoms.belongsto[ti] = -1;
         }
 
         for (int ti= 0;ti<real_nop;ti++){
 
-            if (!atoms[ti].condition) continue;
-            if (atoms[ti].ghost) continue;
+            if (!atoms.condition[ti]) continue;
+            if (atoms.ghost[ti]) continue;
 
-            if (atoms[ti].belongsto==-1) {atoms[ti].belongsto = atoms[ti].id; }
-            for (int c = 0;c<atoms[ti].n_neighbors;c++){
+            if (atoms.belongsto[ti]==-1) {atoms.belongsto[ti] = atoms.id[ti]; }
+            for (int c = neighbors.begin(ti);c<neighbors.end(ti);c++){
 
-                if(!atoms[atoms[ti].neighbors[c]].condition) continue;
-                if(!(atoms[ti].neighbordist[atoms[ti].neighbors[c]] <= atoms[ti].cutoff)) continue;
-                if (atoms[atoms[ti].neighbors[c]].ghost) continue;
-                if (atoms[atoms[ti].neighbors[c]].belongsto==-1){
-                    atoms[atoms[ti].neighbors[c]].belongsto = atoms[ti].belongsto;
+                int tj = neighbors.index[c];
+                if(!atoms.condition[tj]) continue;
+                if(!(neighbors.dist[c] <= atoms.cutoff[ti])) continue;
+                if (atoms.ghost[tj]) continue;
+                if (atoms.belongsto[tj]==-1){
+                    atoms.belongsto[tj] = atoms.belongsto[ti];
                 }
                 else{
-                    atoms[ti].belongsto = atoms[atoms[ti].neighbors[c]].belongsto;
+                    atoms.belongsto[ti] = atoms.belongsto[tj];
                 }
             }
         }
@@ -2560,13 +4139,13 @@ void System::find_clusters(double clustercutoff){
 void System::harvest_cluster(const int ti, const int clusterindex){
 
     int neigh;
-    for(int i=0; i<atoms[ti].n_neighbors; i++){
-        neigh = atoms[ti].neighbors[i];
-        if (atoms[neigh].ghost) continue;
-        if(!atoms[neigh].condition) continue;
-        if(!(atoms[ti].neighbordist[i] <= atoms[ti].cutoff)) continue;
-        if (atoms[neigh].belongsto==-1){
-            atoms[neigh].belongsto = clusterindex;
+    for(int i=neighbors.begin(ti); i<neighbors.end(ti); i++){
+        neigh = neighbors.index[i];
+        if (atoms.ghost[neigh]) continue;
+        if(!atoms.condition[neigh]) continue;
+        if(!(neighbors.dist[i] <= atoms.cutoff[ti])) continue;
+        if (atoms.belongsto[neigh]==-1){
+            atoms.belongsto[neigh] = clusterindex;
             harvest_cluster(neigh, clusterindex);
         }
     }
@@ -2576,7 +4155,7 @@ void System::find_clusters_recursive(double clustercutoff){
 
   if (clustercutoff != 0){
     for(int ti=0; ti<nop;ti++){
-        atoms[ti].cutoff = clustercutoff;
+        atoms.cutoff[ti] = clustercutoff;
     }
   }
 
@@ -2585,15 +4164,20 @@ void System::find_clusters_recursive(double clustercutoff){
 
     //reset belongsto indices
     for(int ti=0; ti<real_nop;ti++){
-        atoms[ti].belongsto = -1;
+        atoms.belongsto[ti] = -1;
+    }
+
+    if (usehalf){
+        find_clusters_half();
+        return;
     }
 
     for (int ti= 0;ti<real_nop;ti++){
-        if (!atoms[ti].condition) continue;
-        if (atoms[ti].ghost) continue;
-        if (atoms[ti].belongsto==-1){
+        if (!atoms.condition[ti]) continue;
+        if (atoms.ghost[ti]) continue;
+        if (atoms.belongsto[ti]==-1){
             clusterindex += 1;
-            atoms[ti].belongsto = clusterindex;
+            atoms.belongsto[ti] = clusterindex;
             harvest_cluster(ti, clusterindex);
         }
 
@@ -2602,6 +4186,52 @@ void System::find_clusters_recursive(double clustercutoff){
 
 
 
+void System::find_clusters_half(){
+    /*
+    Clusters from the half list with a union find over the pairs. Two
+    atoms are linked if they are within the cutoff of either of them.
+    Clusters are numbered in order of their first atom, as in the
+    recursive search.
+    */
+    vector<int> parent(nop);
+    for(int ti=0; ti<nop; ti++) parent[ti] = ti;
+    auto root = [&](int ti){
+        while (parent[ti] != ti){
+            parent[ti] = parent[parent[ti]];
+            ti = parent[ti];
+        }
+        return ti;
+    };
+
+    for (int s=0; s<halfneighbors.nslots(); s++){
+        int ti = halfneighbors.order[s];
+        if ((ti >= real_nop) || (!atoms.condition[ti]) || (atoms.ghost[ti])) continue;
+        halfneighbors.for_row(s, [&](int t, long long b){
+            int tj = halfneighbors.order[t];
+            if ((tj >= real_nop) || (!atoms.condition[tj]) || (atoms.ghost[tj])) return;
+            double d = halfneighbors.dist[b];
+            if ((d <= atoms.cutoff[ti]) || (d <= atoms.cutoff[tj])){
+                int ri = root(ti);
+                int rj = root(tj);
+                if (ri != rj) parent[max(ri, rj)] = min(ri, rj);
+            }
+        });
+    }
+
+    vector<int> label(nop, -1);
+    int clusterindex = 0;
+    for (int ti= 0;ti<real_nop;ti++){
+        if (!atoms.condition[ti]) continue;
+        if (atoms.ghost[ti]) continue;
+        int r = root(ti);
+        if (label[r] == -1){
+            clusterindex += 1;
+            label[r] = clusterindex;
+        }
+        atoms.belongsto[ti] = label[r];
+    }
+}
+
 int System::largest_cluster(){
 
         int *freq = new int[nop];
@@ -2611,8 +4241,8 @@ int System::largest_cluster(){
 
         for (int ti= 0;ti<real_nop;ti++)
         {
-            if (atoms[ti].belongsto==-1) continue;
-            freq[atoms[ti].belongsto-1]++;
+            if (atoms.belongsto[ti]==-1) continue;
+            freq[atoms.belongsto[ti]-1]++;
         }
 
         int max=0;
@@ -2631,20 +4261,24 @@ int System::largest_cluster(){
 }
 
 void System::get_largest_cluster_atoms(){
+        if (usehalf){
+            get_largest_cluster_atoms_half();
+            return;
+        }
         for(int ti=0; ti<real_nop; ti++){
-            atoms[ti].issurface = 1;
-            atoms[ti].lcluster = 0;
+            atoms.issurface[ti] = 1;
+            atoms.lcluster[ti] = 0;
             //if its in same cluster as max cluster assign it as one
-            if(atoms[ti].belongsto == maxclusterid){
-                atoms[ti].lcluster = 1;
+            if(atoms.belongsto[ti] == maxclusterid){
+                atoms.lcluster[ti] = 1;
             }
            //if its solid- identfy if it has liquid
-            if(atoms[ti].issolid == 1){
-                atoms[ti].issurface = 0;
-                for(int tj=0; tj<atoms[ti].n_neighbors; tj++){
-                    if (atoms[atoms[ti].neighbors[tj]].ghost) continue;
-                    if(atoms[atoms[ti].neighbors[tj]].issolid == 0){
-                        atoms[ti].issurface = 1;
+            if(atoms.issolid[ti] == 1){
+                atoms.issurface[ti] = 0;
+                for(int tj=neighbors.begin(ti); tj<neighbors.end(ti); tj++){
+                    if (atoms.ghost[neighbors.index[tj]]) continue;
+                    if(atoms.issolid[neighbors.index[tj]] == 0){
+                        atoms.issurface[ti] = 1;
                         break;
                     }
                 }
@@ -2652,6 +4286,27 @@ void System::get_largest_cluster_atoms(){
         }
 }
 
+void System::get_largest_cluster_atoms_half(){
+        //a solid atom is at the surface if any neighbor is liquid,
+        //which is seen from both atoms of a pair
+        for(int ti=0; ti<real_nop; ti++){
+            atoms.lcluster[ti] = (atoms.belongsto[ti] == maxclusterid);
+            atoms.issurface[ti] = (atoms.issolid[ti] == 1) ? 0 : 1;
+        }
+        for (int s=0; s<halfneighbors.nslots(); s++){
+            int ti = halfneighbors.order[s];
+            halfneighbors.for_row(s, [&](int t, long long b){
+                int tj = halfneighbors.order[t];
+                if ((ti < real_nop) && (atoms.issolid[ti] == 1) && (!atoms.ghost[tj]) && (atoms.issolid[tj] == 0)){
+                    atoms.issurface[ti] = 1;
+                }
+                if ((tj < real_nop) && (atoms.issolid[tj] == 1) && (!atoms.ghost[ti]) && (atoms.issolid[ti] == 0)){
+                    atoms.issurface[tj] = 1;
+                }
+            });
+        }
+}
+
 void System::set_nucsize_parameters(double n1, double n2, double n3 ) { minfrenkel = n1; threshold = n2; avgthreshold = n3; }
 
 //-----------------------------------------------------
@@ -2677,7 +4332,7 @@ void System::get_all_neighbors_voronoi(){
     double rx,ry,rz,tsum, fa, x=0, y=0, z=0, vol;//原作者没有初始化xyz ，我看了一下代码将之初始化为0
     
     vector<int> neigh,f_vert, vert_nos;
-    vector<double> facearea, v, faceperimeters;
+    vector<double> facearea, v, faceperimeters, normals;
     voronoicell_neighbor c;
     vector< vector<double> > nweights;
     vector< vector<int> > nneighs;
@@ -2686,18 +4341,39 @@ void System::get_all_neighbors_voronoi(){
     double weightsum;
     vector <double> pos;
 
+    //along directions which are not periodic the container has walls,
+    //at the box or just beyond the outermost atom if that is further out
+    double lo[3] = {0.0, 0.0, 0.0};
+    double hi[3] = {boxx, boxy, boxz};
+    vector<vector<double>> rpos(nop);
+    for(int i=0; i<nop; i++){
+        pos = {atoms.posx[i], atoms.posy[i], atoms.posz[i]};
+        rpos[i] = remap_atom(pos);
+    }
+    for(int a=0; a<3; a++){
+        if (periodic[a]) continue;
+        double pad = 1E-6*(hi[a] - lo[a]);
+        for(int i=0; i<nop; i++){
+            lo[a] = min(lo[a], rpos[i][a] - pad);
+            hi[a] = max(hi[a], rpos[i][a] + pad);
+        }
+    }
+
     //pre_container pcon(boxdims[0][0],boxdims[1][1],boxdims[1][0],boxdims[1][1],boxdims[2][0],boxdims[2][1],true,true,true);
-    pre_container pcon(0.00, boxx, 0.00, boxy, 0.0, boxz, true, true, true);
+    pre_container pcon(lo[0], hi[0], lo[1], hi[1], lo[2], hi[2], periodic[0], periodic[1], periodic[2]);
     for(int i=0; i<nop; i++){
-        pos = atoms[i].gx();
-        pos = remap_atom(pos);
-        pcon.put(i, pos[0], pos[1], pos[2]);
+        pcon.put(i, rpos[i][0], rpos[i][1], rpos[i][2]);
     }
     pcon.guess_optimal(tnx,tny,tnz);
     //container con(boxdims[0][0],boxdims[1][1],boxdims[1][0],boxdims[1][1],boxdims[2][0],boxdims[2][1],tnx,tny,tnz,true,true,true, nop);
-    container con(0.00, boxx, 0.00, boxy, 0.0, boxz, tnx, tny, tnz, true, true, true, nop);
+    container con(lo[0], hi[0], lo[1], hi[1], lo[2], hi[2], tnx, tny, tnz, periodic[0], periodic[1], periodic[2], nop);
     pcon.setup(con);
 
+    AtomStore::ensure_column(atoms.vertex_vectors, nop);
+    AtomStore::ensure_column(atoms.vertex_numbers, nop);
+    AtomStore::ensure_column(atoms.vertex_positions, nop);
+    begin_neighbor_build();
+
     c_loop_all cl(con);
     if (cl.start()) do if(con.compute_cell(c,cl)) {
             ti=cl.pid();
@@ -2707,28 +4383,32 @@ void System::get_all_neighbors_voronoi(){
             c.face_vertices(vert_nos);
             c.vertices(x,y,z,v);
             c.face_perimeters(faceperimeters);
+            c.normals(normals);
 
             vol = c.volume();
             tsum = 0;
             vector <double> dummyweights;
             vector <int> dummyneighs;
 
-            //only loop over neighbors
+            //only loop over neighbors, faces on the walls
+            //of the container have negative ids
             weightsum = 0.0;
             for (int i=0; i<facearea.size(); i++){
+                if (neigh[i] < 0) continue;
                 weightsum += pow(facearea[i], alpha);
             }
 
 
             //assign to nvector
-            atoms[ti].volume = vol;
-            atoms[ti].vertex_vectors = v;
-            atoms[ti].vertex_numbers = vert_nos;
-            atoms[ti].cutoff = cbrt(3*vol/(4*3.141592653589793));
+            atoms.volume[ti] = vol;
+            atoms.vertex_vectors[ti] = v;
+            atoms.vertex_numbers[ti] = vert_nos;
+            atoms.cutoff[ti] = cbrt(3*vol/(4*3.141592653589793));
             
             //clean up and add vertex positions
             nverts = int(v.size())/3;
-            pos = atoms[ti].gx();
+            pos = {atoms.posx[ti], atoms.posy[ti], atoms.posz[ti]};
+            atoms.vertex_positions[ti].clear();
             for(int si=0; si<nverts; si++){
                 vector<double> temp;
                 int li=0;
@@ -2736,7 +4416,7 @@ void System::get_all_neighbors_voronoi(){
                     temp.emplace_back(v[vi]+pos[li]);
                     li++;
                 }
-                atoms[ti].vertex_positions.emplace_back(temp);
+                atoms.vertex_positions[ti].emplace_back(temp);
             }
 
             //assign to the atom
@@ -2747,34 +4427,39 @@ void System::get_all_neighbors_voronoi(){
             //for (int i=0; i<facearea.size(); i++){
             //    weightsum += facearea[i];
             //}
+            int fstart = 0;
             for (int tj=0; tj<neigh.size(); tj++){
-
+                //the face lies halfway to the neighbor, so twice the distance
+                //of the face plane along its normal is the vector to the image
+                //that made it. In a small box this need not be the nearest one.
+                int fv = 3*vert_nos[fstart+1];
+                double h = 2.0*(normals[3*tj]*v[fv] + normals[3*tj+1]*v[fv+1] + normals[3*tj+2]*v[fv+2]);
+                fstart += vert_nos[fstart] + 1;
+
+                if (neigh[tj] < 0){
+                    continue;
+                }
                 //if filter doesnt work continue
-                if ((filter == 1) && (atoms[ti].type != atoms[tj].type)){
+                if ((filter == 1) && (atoms.type[ti] != atoms.type[neigh[tj]])){
                     continue;
                 }
-                else if ((filter == 2) && (atoms[ti].type == atoms[tj].type)){
+                else if ((filter == 2) && (atoms.type[ti] == atoms.type[neigh[tj]])){
                     continue;
                 }
-                atoms[ti].neighbors[tj] = neigh[tj];
-                atoms[ti].n_neighbors += 1;
                 d = get_abs_distance(ti,neigh[tj],diffx,diffy,diffz);
-                atoms[ti].neighbordist[tj] = d;
-                //weight is set to 1.0, unless manually reset
-                atoms[ti].neighborweight[tj] = pow(facearea[tj], alpha)/weightsum;
-                atoms[ti].facevertices[tj] = f_vert[tj];
-                atoms[ti].faceperimeters[tj] = faceperimeters[tj];
-                atoms[ti].n_diffx[tj] = diffx;
-                atoms[ti].n_diffy[tj] = diffy;
-                atoms[ti].n_diffz[tj] = diffz;
-                convert_to_spherical_coordinates(diffx, diffy, diffz, r, phi, theta);
-                atoms[ti].n_r[tj] = r;
-                atoms[ti].n_phi[tj] = phi;
-                atoms[ti].n_theta[tj] = theta;
+                if (fabs(d - h) > 1E-6*h){
+                    diffx = h*normals[3*tj];
+                    diffy = h*normals[3*tj+1];
+                    diffz = h*normals[3*tj+2];
+                    d = h;
+                }
+                //weight is the normalised face area
+                nbuilder.add_face(ti, neigh[tj], d, diffx, diffy, diffz, pow(facearea[tj], alpha)/weightsum, f_vert[tj], faceperimeters[tj]);
 
             }
 
     } while (cl.inc());
+    end_neighbor_build();
 
 
     //now calculate the averged volume
@@ -2789,13 +4474,13 @@ void System::find_average_volume(){
     int nn;
 
     for (int ti= 0;ti<nop;ti++){
-        nn = atoms[ti].n_neighbors;
-        vv = atoms[ti].volume;
-        for (int ci = 0;ci<nn;ci++){
-            vv += atoms[atoms[ti].neighbors[ci]].volume;
+        nn = neighbors.count(ti);
+        vv = atoms.volume[ti];
+        for (int ci = neighbors.begin(ti);ci<neighbors.end(ti);ci++){
+            vv += atoms.volume[neighbors.index[ci]];
         }
         vv = vv/(double(nn+1));
-        atoms[ti].avgvolume = vv;
+        atoms.avgvolume[ti] = vv;
     }
 }
 
@@ -2811,24 +4496,32 @@ void System::get_diamond_neighbors(){
     latest identification.
     */
     reset_main_neighbors();
+    atoms.nn1.assign(4*nop, -1);
+    begin_neighbor_build();
     for (int ti=0; ti<nop; ti++){
         //cout<<"ti = "<<ti<<endl;
         //start loop
-        for(int j=0 ; j<4; j++){
-            int tj = atoms[ti].temp_neighbors[j].index;
+        for(int j=0 ; (j<4) && (j<candidates.count(ti)); j++){
+            int tj = candidates.at(ti, j).index;
             //cout<<"tj = "<<tj<<endl;
             //loop over the neighbors
-            atoms[ti].nn1[j] = tj;
-            for(int k=0 ; k<4; k++){
-                int tk = atoms[tj].temp_neighbors[k].index;
-                //cout<<"tk = "<<tk<<endl;
+            atoms.nn1[4*ti+j] = tj;
+            const datom &cj = candidates.at(ti, j);
+            for(int k=0 ; (k<4) && (k<candidates.count(tj)); k++){
+                const datom &ck = candidates.at(tj, k);
+                //the second neighbor is reached through the image of the first
+                double dx = cj.dx + ck.dx;
+                double dy = cj.dy + ck.dy;
+                double dz = cj.dz + ck.dz;
+                double d = sqrt(dx*dx + dy*dy + dz*dz);
                 //now make sure its not the same atom
-                if (ti == tk) continue;
+                if ((ck.index == ti) && (d < 1E-6)) continue;
                 //process the neighbors
-                process_neighbor(ti, tk);
+                nbuilder.add(ti, ck.index, d, dx, dy, dz);
             }
         }
     }
+    end_neighbor_build();
 }
 
 void System::get_cna_neighbors(int style){
@@ -2853,15 +4546,16 @@ void System::get_cna_neighbors(int style){
         ncount = 14;
     }
 
+    begin_neighbor_build();
     for (int ti=0; ti<nop; ti++){
-        atoms[ti].cutoff = factor*lattice_constant;
-        for(int i=0 ; i<ncount; i++){
-            int tj = atoms[ti].temp_neighbors[i].index;
-            //dist = atoms[ti].temp_neighbors[i].dist;
-            //if (dist <= atoms[ti].cutoff)
-            process_neighbor(ti, tj);
+        atoms.cutoff[ti] = factor*lattice_constant;
+        for(int i=0 ; (i<ncount) && (i<candidates.count(ti)); i++){
+            //dist = candidates.at(ti, i).dist;
+            //if (dist <= atoms.cutoff[ti])
+            process_neighbor(ti, candidates.at(ti, i));
         }
     }
+    end_neighbor_build();
 }
 
 void System::get_acna_neighbors(int style){
@@ -2878,148 +4572,169 @@ void System::get_acna_neighbors(int style){
 
     //reset neighbors
     reset_main_neighbors();
+    begin_neighbor_build();
 
     if (style == 1){ 
         for (int ti=0; ti<nop; ti++){
-            if (atoms[ti].temp_neighbors.size() > 11){
+            if (candidates.count(ti) > 11){
                 double ssum = 0;
                 for(int i=0 ; i<12; i++){
-                    ssum += atoms[ti].temp_neighbors[i].dist;
+                    ssum += candidates.at(ti, i).dist;
                 }
                 //process sum
-                atoms[ti].cutoff = 1.207*ssum/12.00;
+                atoms.cutoff[ti] = 1.207*ssum/12.00;
                 //now assign neighbors based on this
                 for(int i=0 ; i<12; i++){
-                    int tj = atoms[ti].temp_neighbors[i].index;
-                    dist = atoms[ti].temp_neighbors[i].dist;
-                    //if (dist <= atoms[ti].cutoff)
-                    process_neighbor(ti, tj);
+                    dist = candidates.at(ti, i).dist;
+                    //if (dist <= atoms.cutoff[ti])
+                    process_neighbor(ti, candidates.at(ti, i));
                 }                                 
             }
         }
     }
     else if (style == 2){
         for (int ti=0; ti<nop; ti++){
-            if (atoms[ti].temp_neighbors.size() > 13){
+            if (candidates.count(ti) > 13){
                 double ssum = 0;
                 for(int i=0 ; i<8; i++){
-                    ssum += 1.1547*atoms[ti].temp_neighbors[i].dist;
+                    ssum += 1.1547*candidates.at(ti, i).dist;
                 }
                 for(int i=8 ; i<14; i++){
-                    ssum += atoms[ti].temp_neighbors[i].dist;
+                    ssum += candidates.at(ti, i).dist;
                 }
-                atoms[ti].cutoff = 1.207*ssum/14.00;
+                atoms.cutoff[ti] = 1.207*ssum/14.00;
                 //now assign neighbors based on this
                 for(int i=0 ; i<14; i++){
-                    int tj = atoms[ti].temp_neighbors[i].index;
-                    dist = atoms[ti].temp_neighbors[i].dist;
-                    //if (dist <= atoms[ti].cutoff)
-                    process_neighbor(ti, tj);
+                    dist = candidates.at(ti, i).dist;
+                    //if (dist <= atoms.cutoff[ti])
+                    process_neighbor(ti, candidates.at(ti, i));
                 }                                 
             }
         }
     }
+    end_neighbor_build();
 }
 
-void System::get_common_neighbors(int ti){
+void System::get_common_neighbors(int ti, vector<vector<int>> &common){
     /*
-    Get common neighbors between an atom and its neighbors
+    Get common neighbors between an atom and its neighbors. common
+    holds the positions of the common neighbors in the list of ti,
+    so that the bond vectors pick the right periodic images.
     */
     int m, n;
     double d, dx, dy, dz;
+    int nstart = neighbors.begin(ti);
+    int ncount = neighbors.count(ti);
 
     //we have to rest a couple of things first
-    //cna vector
+    //cna values of the bonds of ti
     //also common array
-    atoms[ti].cna.clear();
-    atoms[ti].cna.resize(atoms[ti].n_neighbors);
-    atoms[ti].common.clear();
-    atoms[ti].common.resize(atoms[ti].n_neighbors);
-
-    for(int i=0; i<atoms[ti].n_neighbors; i++){
-        for(int j=0; j<4; j++){
-            atoms[ti].cna[i].emplace_back(0);
-        }
+    if (!neighbors.has_cna()){
+        neighbors.cna.assign(4*neighbors.nbonds(), 0);
     }
-    
+    for(int i=4*nstart; i<4*(nstart+ncount); i++){
+        neighbors.cna[i] = 0;
+    }
+    common.clear();
+    common.resize(ncount);
+
     //now start loop
-    for(int i=0; i<atoms[ti].n_neighbors-1; i++){
-        m = atoms[ti].neighbors[i];
-        for(int j=i+1; j<atoms[ti].n_neighbors; j++){
-            n = atoms[ti].neighbors[j];
-            d = get_abs_distance(m, n, dx, dy, dz);
-            if (d <= atoms[ti].cutoff){
-                atoms[ti].cna[i][0]++;
-                atoms[ti].common[i].emplace_back(n);
-                atoms[ti].cna[j][0]++;
-                atoms[ti].common[j].emplace_back(m);
+    for(int i=0; i<ncount-1; i++){
+        m = nstart+i;
+        for(int j=i+1; j<ncount; j++){
+            n = nstart+j;
+            dx = neighbors.diffx[n] - neighbors.diffx[m];
+            dy = neighbors.diffy[n] - neighbors.diffy[m];
+            dz = neighbors.diffz[n] - neighbors.diffz[m];
+            d = sqrt(dx*dx + dy*dy + dz*dz);
+            if (d <= atoms.cutoff[ti]){
+                neighbors.cna[4*(nstart+i)]++;
+                common[i].emplace_back(n);
+                neighbors.cna[4*(nstart+j)]++;
+                common[j].emplace_back(m);
             }
         }
     }
+
+    //the python side sees the common neighbors as atom indices
+    AtomStore::ensure_column(atoms.common, nop);
+    atoms.common[ti].resize(ncount);
+    for(int i=0; i<ncount; i++){
+        atoms.common[ti][i].resize(common[i].size());
+        for(int k=0; k<common[i].size(); k++){
+            atoms.common[ti][i][k] = neighbors.index[common[i][k]];
+        }
+    }
 }
 
 
-void System::get_common_bonds(int ti){
+void System::get_common_bonds(int ti, vector<vector<int>> &common){
     /*
     Last two steps for CNA analysis
     */
     int c1, c2, maxbonds, minbonds;
     double d, dx, dy, dz;
+    int nstart = neighbors.begin(ti);
+    int *cna;
+    vector<int> bonds;
 
-    //first we clear the bonds array
-    atoms[ti].bonds.clear();
-    atoms[ti].bonds.resize(atoms[ti].n_neighbors);
+    AtomStore::ensure_column(atoms.bonds, nop);
+    atoms.bonds[ti].resize(neighbors.count(ti));
 
     //start loop
-    for(int k=0; k<atoms[ti].n_neighbors; k++){
+    for(int k=0; k<neighbors.count(ti); k++){
+        cna = &neighbors.cna[4*(nstart+k)];
         //clear bonds first
-        for(int l=0; l<atoms[ti].cna[k][0]; l++){
-            atoms[ti].bonds[k].emplace_back(0);
-        }
+        bonds.assign(cna[0], 0);
         //now start proper loop
-        for(int l=0; l<atoms[ti].cna[k][0]-1; l++){
-            for(int m=l+1; m<atoms[ti].cna[k][0]; m++){
-                c1 = atoms[ti].common[k][l];
-                c2 = atoms[ti].common[k][m];
-                d = get_abs_distance(c1, c2, dx, dy, dz);
-                if(d <= atoms[ti].cutoff){
-                    atoms[ti].cna[k][1]++;
-                    atoms[ti].bonds[k][l]++;
-                    atoms[ti].bonds[k][m]++;
+        for(int l=0; l<cna[0]-1; l++){
+            for(int m=l+1; m<cna[0]; m++){
+                c1 = common[k][l];
+                c2 = common[k][m];
+                dx = neighbors.diffx[c2] - neighbors.diffx[c1];
+                dy = neighbors.diffy[c2] - neighbors.diffy[c1];
+                dz = neighbors.diffz[c2] - neighbors.diffz[c1];
+                d = sqrt(dx*dx + dy*dy + dz*dz);
+                if(d <= atoms.cutoff[ti]){
+                    cna[1]++;
+                    bonds[l]++;
+                    bonds[m]++;
                 }
             }
         }
         maxbonds = 0;
         minbonds = 8;
-        for(int l=0; l<atoms[ti].cna[k][0]; l++){
-            maxbonds = max(atoms[ti].bonds[k][l], maxbonds);
-            minbonds = min(atoms[ti].bonds[k][l], minbonds);
+        for(int l=0; l<cna[0]; l++){
+            maxbonds = max(bonds[l], maxbonds);
+            minbonds = min(bonds[l], minbonds);
         }
-        atoms[ti].cna[k][2] = maxbonds;
-        atoms[ti].cna[k][3] = minbonds;    
+        cna[2] = maxbonds;
+        cna[3] = minbonds;    
+        atoms.bonds[ti][k] = bonds;
     }
 }
 
 void System::identify_cn12(){
 
     int c1, c2, c3, c4;
+    vector<vector<int>> common;
     int nfcc, nhcp, nico;
 
     //now we start
     for(int ti=0; ti<nop; ti++){
-        if(atoms[ti].structure==0){
-            get_common_neighbors(ti);
-            get_common_bonds(ti);
+        if(atoms.structure[ti]==0){
+            get_common_neighbors(ti, common);
+            get_common_bonds(ti, common);
 
             //now assign structure if possible
             nfcc = 0;
             nhcp = 0;
             nico = 0;
-            for(int k=0; k<atoms[ti].n_neighbors; k++){
-                c1 = atoms[ti].cna[k][0];
-                c2 = atoms[ti].cna[k][1];
-                c3 = atoms[ti].cna[k][2];
-                c4 = atoms[ti].cna[k][3];
+            for(int k=0; k<neighbors.count(ti); k++){
+                c1 = neighbors.cna[4*(neighbors.begin(ti)+k)+0];
+                c2 = neighbors.cna[4*(neighbors.begin(ti)+k)+1];
+                c3 = neighbors.cna[4*(neighbors.begin(ti)+k)+2];
+                c4 = neighbors.cna[4*(neighbors.begin(ti)+k)+3];
 
                 if((c1==4) && (c2==2) && (c3==1) && (c4==1)){
                     nfcc++;
@@ -3033,13 +4748,13 @@ void System::identify_cn12(){
 
             }
             if(nfcc==12){
-                atoms[ti].structure = 1;
+                atoms.structure[ti] = 1;
             }
             else if((nfcc==6) && (nhcp==6)){
-                atoms[ti].structure = 2;   
+                atoms.structure[ti] = 2;   
             }
             else if (nico==12){
-                atoms[ti].structure = 4;   
+                atoms.structure[ti] = 4;   
             }
         }
     }
@@ -3048,21 +4763,22 @@ void System::identify_cn12(){
 void System::identify_cn14(){
     
     int c1, c2, c3, c4;
+    vector<vector<int>> common;
     int nbcc1, nbcc2;
 
     for(int ti=0; ti<nop; ti++){
-        if(atoms[ti].structure==0){
-            get_common_neighbors(ti);
-            get_common_bonds(ti);
+        if(atoms.structure[ti]==0){
+            get_common_neighbors(ti, common);
+            get_common_bonds(ti, common);
 
             //now assign structure if possible
             nbcc1 = 0;
             nbcc2 = 0;
-            for(int k=0; k<atoms[ti].n_neighbors; k++){
-                c1 = atoms[ti].cna[k][0];
-                c2 = atoms[ti].cna[k][1];
-                c3 = atoms[ti].cna[k][2];
-                c4 = atoms[ti].cna[k][3];
+            for(int k=0; k<neighbors.count(ti); k++){
+                c1 = neighbors.cna[4*(neighbors.begin(ti)+k)+0];
+                c2 = neighbors.cna[4*(neighbors.begin(ti)+k)+1];
+                c3 = neighbors.cna[4*(neighbors.begin(ti)+k)+2];
+                c4 = neighbors.cna[4*(neighbors.begin(ti)+k)+3];
 
                 if((c1==4) && (c2==4) && (c3==2) && (c4==2)){
                     nbcc1++;
@@ -3072,7 +4788,7 @@ void System::identify_cn14(){
                 }
             }
             if((nbcc1==6) && (nbcc2==8)){
-                atoms[ti].structure = 3;   
+                atoms.structure[ti] = 3;   
             }
         }
     }    
@@ -3099,13 +4815,13 @@ vector<int> System::identify_diamond_structure(){
 
 
     for(int i=0; i<nop; i++){
-        atoms[i].structure = 0;
+        atoms.structure[i] = 0;
     }
 
     identify_cndia();
     //gather results
     for(int ti=0; ti<real_nop; ti++){
-        analyis[atoms[ti].structure] += 1;
+        analyis[atoms.structure[ti]] += 1;
     }
 
     return analyis;
@@ -3130,13 +4846,13 @@ void System::identify_cndia(){
 
     //calculate cutoffs
     for (int ti=0; ti<nop; ti++){
-        if (atoms[ti].n_neighbors > 11){
+        if (neighbors.count(ti) > 11){
             double ssum = 0;
             for(int i=0 ; i<12; i++){
-                ssum += atoms[ti].neighbordist[i];
+                ssum += neighbors.dist[neighbors.begin(ti)+i];
             }
             //process sum
-            atoms[ti].cutoff = 1.207*ssum/12.00;
+            atoms.cutoff[ti] = 1.207*ssum/12.00;
             //now assign neighbors based on this
         }
     }
@@ -3147,24 +4863,25 @@ void System::identify_cndia(){
     int n;
     //now for each atom
     for(int ti=0; ti<nop; ti++){
-        if(atoms[ti].structure == 1){
-            atoms[ti].structure = 5;
+        if(atoms.structure[ti] == 1){
+            atoms.structure[ti] = 5;
         }
-        else if(atoms[ti].structure == 2){
-            atoms[ti].structure = 8;
+        else if(atoms.structure[ti] == 2){
+            atoms.structure[ti] = 8;
         }
     }
     //second pass
     for(int ti=0; ti<nop; ti++){
-        if ((atoms[ti].structure != 5) && (atoms[ti].structure != 8)){
+        if ((atoms.structure[ti] != 5) && (atoms.structure[ti] != 8)){
             for(int i=0; i<4; i++){
-                n = atoms[ti].nn1[i];
-                if(atoms[n].structure == 5){
-                    atoms[ti].structure = 6;
+                n = atoms.nn1[4*ti+i];
+                if (n < 0) continue;
+                if(atoms.structure[n] == 5){
+                    atoms.structure[ti] = 6;
                     break;
                 }
-                else if (atoms[n].structure == 8){
-                    atoms[ti].structure = 9;
+                else if (atoms.structure[n] == 8){
+                    atoms.structure[ti] = 9;
                     break;
                 }
             }
@@ -3172,15 +4889,15 @@ void System::identify_cndia(){
     }
 
     for(int ti=0; ti<nop; ti++){
-        if ((atoms[ti].structure != 5) && (atoms[ti].structure != 8) && (atoms[ti].structure != 6) && (atoms[ti].structure != 9)){
-            for(int i=0; i<atoms[ti].n_neighbors; i++){
-                n = atoms[ti].neighbors[i];
-                if(atoms[n].structure == 5){
-                    atoms[ti].structure = 7;
+        if ((atoms.structure[ti] != 5) && (atoms.structure[ti] != 8) && (atoms.structure[ti] != 6) && (atoms.structure[ti] != 9)){
+            for(int i=0; i<neighbors.count(ti); i++){
+                n = neighbors.index[neighbors.begin(ti)+i];
+                if(atoms.structure[n] == 5){
+                    atoms.structure[ti] = 7;
                     break;
                 }
-                else if (atoms[n].structure == 8){
-                    atoms[ti].structure = 10;
+                else if (atoms.structure[n] == 8){
+                    atoms.structure[ti] = 10;
                     break;
                 }
             }
@@ -3206,7 +4923,7 @@ vector<int> System::calculate_cna(int method){
 
     //assign structures to 0
     for(int i=0; i<nop; i++){
-        atoms[i].structure = 0;
+        atoms.structure[i] = 0;
     }
     
     //first get lump neighbors
@@ -3241,7 +4958,7 @@ vector<int> System::calculate_cna(int method){
 
     //gather results
     for(int ti=0; ti<real_nop; ti++){
-        analyis[atoms[ti].structure] += 1;
+        analyis[atoms.structure[ti]] += 1;
     }
 
     return analyis;
@@ -3261,11 +4978,11 @@ double System::switching_fn(double rij, double ra, int M, int N){
 void System::average_entropy(){
     double entsum;
     for(int i=0; i<nop; i++){
-        entsum = atoms[i].entropy;
-        for(int j=0; j<atoms[i].n_neighbors; j++){
-            entsum += atoms[atoms[i].neighbors[j]].entropy;
+        entsum = atoms.entropy[i];
+        for(int j=0; j<neighbors.count(i); j++){
+            entsum += atoms.entropy[neighbors.index[neighbors.begin(i)+j]];
         }
-        atoms[i].avg_entropy = entsum/(double(atoms[i].n_neighbors + 1));
+        atoms.avg_entropy[i] = entsum/(double(neighbors.count(i) + 1));
     }
 }
 
@@ -3280,32 +4997,76 @@ void System::average_entropy_switch(double ra, int M, int N){
         frijsum = 0.0;
         entfrijsum = 0.0;
 
-        for(int j=0; j<atoms[i].n_neighbors; j++){
-            frij = switching_fn(atoms[i].neighbordist[j], ra, M, N);
+        for(int j=0; j<neighbors.count(i); j++){
+            frij = switching_fn(neighbors.dist[neighbors.begin(i)+j], ra, M, N);
             frijsum += frij;
-            entfrijsum += atoms[atoms[i].neighbors[j]].entropy*frij;
+            entfrijsum += atoms.entropy[neighbors.index[neighbors.begin(i)+j]]*frij;
         }
 
-        atoms[i].avg_entropy = (entfrijsum + atoms[i].entropy)/(frijsum + 1.0);
+        atoms.avg_entropy[i] = (entfrijsum + atoms.entropy[i])/(frijsum + 1.0);
     }
 }
 
 
+double System::gmr(int ti, double r, double sigma, double rho)
+{
+        double g = 0.00;
+        double rij,r2;
+        double sigma2 = sigma*sigma;
+        double frho = 4.00*PI*rho*r*r;
+        double fsigma = sqrt(2.00*PI*sigma2);
+        double factor = (1.00/frho)*(1.00/fsigma);
+
+        for(int i=neighbors.begin(ti); i<neighbors.end(ti); i++)
+        {
+                rij = neighbors.dist[i];
+                r2 = (r-rij)*(r-rij);
+                g+=exp((-1.00*r2)/(2.00*sigma2));
+        }
+
+        return factor*g;
+}
+
+double System::entropy_integrand(int ti, double r, double sigma, double rho)
+{
+        double g = gmr(ti, r, sigma, rho);
+        return ((g*log(g)-g +1.00)*r*r);
+}
+
+double System::trapezoid_integration(int ti, double sigma, double rho, double rstart, double rstop, double h, double kb)
+{
+
+        int nsteps = (rstop - rstart)/h;
+        double summ;
+        double xstart, xend;
+        summ=0.00;
+        double rloop;
+        double integral;
+
+        xstart = entropy_integrand(ti, rstart, sigma, rho);
+
+        for(int j=1; j<nsteps-1; j++)
+        {
+
+                rloop = rstart + j*h;
+                summ += entropy_integrand(ti, rloop, sigma, rho);
+
+        }
+
+        xend = entropy_integrand(ti, rstart + nsteps*h, sigma, rho);
+        integral = (h/2.00)*(xstart + 2.00*summ + xend);
+        integral = -1.*rho*kb*integral;
+        return integral;
+}
+
 void System::entropy(double sigma, double rho, double rstart, double rstop, double h, double kb){
 
     for(int i=0; i<nop; i++){
         
-        atoms[i].sigma = sigma;
         if (rho == 0){
-            rho = atoms[i].n_neighbors/(4.1887902047863905*pow(atoms[i].cutoff,3));
+            rho = neighbors.count(i)/(4.1887902047863905*pow(atoms.cutoff[i],3));
         }
-        atoms[i].rho = rho;
-        atoms[i].rstart = rstart;
-        atoms[i].rstop = rstop;
-        atoms[i].h = h;
-        atoms[i].kb = kb;
-
-        atoms[i].trapezoid_integration();
+        atoms.entropy[i] = trapezoid_integration(i, sigma, rho, rstart, rstop, h, kb);
     }
 }
 
@@ -3321,12 +5082,12 @@ void System::calculate_centrosymmetry_atom(int ti, int nmax){
     vector<datom> temp;
     int count = 0;
 
-    for(int i=0; i<atoms[ti].n_neighbors-1; i++){
-        for(int j=i+1; j<atoms[ti].n_neighbors; j++){
+    for(int i=0; i<neighbors.count(ti)-1; i++){
+        for(int j=i+1; j<neighbors.count(ti); j++){
             //now get dist vectors
-            dx = atoms[ti].n_diffx[i] + atoms[ti].n_diffx[j];
-            dy = atoms[ti].n_diffy[i] + atoms[ti].n_diffy[j];
-            dz = atoms[ti].n_diffz[i] + atoms[ti].n_diffz[j];
+            dx = neighbors.diffx[neighbors.begin(ti)+i] + neighbors.diffx[neighbors.begin(ti)+j];
+            dy = neighbors.diffy[neighbors.begin(ti)+i] + neighbors.diffy[neighbors.begin(ti)+j];
+            dz = neighbors.diffz[neighbors.begin(ti)+i] + neighbors.diffz[neighbors.begin(ti)+j];
             weight = sqrt(dx*dx+dy*dy+dz*dz);
             datom x = {weight, count};
             temp.emplace_back(x);
@@ -3344,7 +5105,7 @@ void System::calculate_centrosymmetry_atom(int ti, int nmax){
         csym += temp[i].dist*temp[i].dist;
     }
 
-    atoms[ti].centrosymmetry = csym;
+    atoms.centrosymmetry[ti] = csym;
 }
 
 void System::calculate_centrosymmetry(int nmax){
@@ -3362,7 +5123,7 @@ vector<double> System::get_centrosymmetry(){
 
     vector<double> csm;
     for (int i=0; i<real_nop; i++){
-        csm.emplace_back(atoms[i].centrosymmetry);
+        csm.emplace_back(atoms.centrosymmetry[i]);
     }
     return csm;
 }
@@ -13,6 +13,11 @@
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include "atom.h"
+#include "atomstore.h"
+#include "neighborlist.h"
+#include "parallel.h"
+#include "distance.h"
+#include <atomic>
 #include <mutex> 
 #include <wignerSymbols.h>
 #include "fftw3.h"
@@ -21,12 +26,6 @@
 namespace py = pybind11;
 using namespace std;
 
-struct cell{
-  vector<int> members;
-  vector<int> neighbor_cells;
-};
-
-
 class System{
 
     public:
@@ -49,24 +48,51 @@ class System{
         double boxx, boxy, boxz;//the length of the 3 egdes
         double boxdims[3][2];
         double box[3][3];
+        //reduced basis of the box lattice and the inverse of the matrix
+        //with its vectors as columns, periodic images are taken along it
+        double lattice[3][3];
+        double latinv[3][3];
+        double heights[3];//perpendicular distance between opposite faces
+        //atoms are wrapped and have images only along periodic vectors
+        bool periodic[3];
+        void speriodic(vector<bool>);
+        vector<bool> gperiodic();
+        TriclinicBox tribox;
         void assign_triclinic_params(vector<vector<double>>, vector<vector<double>>);
         vector<vector<double>> get_triclinic_params();
         void sbox(vector<vector<double>>);
+        void reduce_lattice();
         vector<vector<double>> gbox();
         vector<double> remap_atom(vector<double>);
 
         //-----------------------------------------------------
         // Atom related methods
         //-----------------------------------------------------
-        vector<Atom> atoms;
+        //per atom values are kept in columns, Atom objects are only
+        //created when they are requested from python
+        AtomStore atoms;
         void assign_particles( vector<Atom>);
         void read_particle_file(string);    // TBDep
         void set_atoms( vector<Atom>);
+        void set_atoms_from_arrays(py::array_t<double, py::array::c_style | py::array::forcecast>,
+            py::array_t<int, py::array::c_style | py::array::forcecast>,
+            py::array_t<int, py::array::c_style | py::array::forcecast>, py::dict);
+        void update_positions(py::array_t<double, py::array::c_style | py::array::forcecast>);
+        void set_positions(py::array_t<double, py::array::c_style | py::array::forcecast>,
+            py::array_t<double, py::array::c_style | py::array::forcecast>,
+            py::array_t<double, py::array::c_style | py::array::forcecast>);
+        void set_custom_column(string, py::array);
+        vector<string> get_custom_keys();
+        CustomColumn& get_custom_column(string);
+        void set_condition_from_custom(string);
         vector<Atom> get_atoms();
         void add_atoms( vector<Atom>);
         vector<Atom> get_all_atoms();
         Atom gatom(int);
         void satom(Atom);
+        void gather_atom(int, Atom&);
+        void scatter_atom(int, Atom&);
+        void scatter_neighbors(vector<Atom>&);
 
 
         //----------------------------------------------------
@@ -74,12 +100,42 @@ class System{
         //----------------------------------------------------
         int filter;
         int usecells;
-        int nx, ny, nz;
-        int total_cells;
-        cell *cells;
+        //cells per cutoff length, 0 chooses from the density
+        int cellsplit;
+        CellList cells;
+        //use the half list instead of the neighbor table
+        int usehalf;
+        HalfNeighborList halfneighbors;
         double neighbordistance;
+        //squared cutoff of every pair of types, types start at 1
+        int npairtypes;
+        vector<double> pair_cutsq;
+        void set_pair_cutoffs(vector<vector<double>>);
+        void check_pair_types();
+        double pair_cutoff_sq(int, int);
+        NeighborList neighbors;
+        NeighborBuilder nbuilder;
+        CandidateList candidates;
+        NeighborIndex nindex;
+        //cutoff neighbors are read from the Verlet list if skin is above zero
+        double skin;
+        VerletList verlet;
+        void build_verlet_list();
+        void get_neighbors_verlet();
+        int neighbor_info_stored;
+        void begin_neighbor_build();
+        void end_neighbor_build();
+        void add_candidates(vector<int>&, vector<datom>&);
+        void add_candidate_parts(vector<vector<int>>&, vector<vector<datom>>&);
+        void add_neighbor_parts(vector<NeighborBuilder>&, double);
+        int nthreads;
+        void set_nthreads(int);
+        int get_nthreads();
         void get_all_neighbors_normal();
         void process_neighbor(int, int);
+        void process_neighbor(int, int, NeighborBuilder&);
+        void process_neighbor(int, const datom&);
+        void process_neighbor(int, const datom&, NeighborBuilder&);
         int get_all_neighbors_sann(double);
         int get_all_neighbors_bynumber(double, int, int,vector<int> atomlist = vector<int>());
         int get_neighbors_from_temp(int);
@@ -88,10 +144,21 @@ class System{
         void reset_all_neighbors(vector<int> atomlist = vector<int>());
         void reset_main_neighbors();        
         double get_abs_distance(int,int,double&,double&,double&);
+        double minimum_image(double&,double&,double&);
+        void fractional(double, double, double, double&, double&, double&);
+        void fractional_positions(vector<double>&);
+        void find_images(int, int, double, const vector<double>&, vector<datom>&);
+        OrthogonalBox orthogonal_box();
+        TriclinicBox triclinic_box();
+        //call f with the policy of the current box, a pair kernel
+        //written as a generic lambda is compiled once for each shape
+        template <typename F>
+        void with_box(F f){
+            if (triclinic == 1) f(triclinic_box());
+            else f(orthogonal_box());
+        }
         double get_abs_distance(Atom , Atom );
         vector<double> get_distance_vector(Atom , Atom);
-        //mutex pdfreslock;
-        mutex pdfthreadflaglock;
         void set_neighbordistance(double);
         vector<int> get_pairdistances(double cut,bool partial,int centertype,int secondtype,int histnum,double histlow,int threadnum);
         class pdfpara{
@@ -99,21 +166,14 @@ class System{
             vector<int> res;
             vector<vector<int>> resthread;
             double deltacut;
-            //double d_square,d;
-            //double diffx,diffy,diffz;
-            //int M[3]={0};
-            //int N[3]={0};
-            double Height[3]={0};
-            double iCrossj[3][3]={{0,0,0},{0,0,0},{0,0,0}};
-            double iCrossjnorm[3]={0};
-            double kdotiCrossj[3]={0};
-            int index[3][3]={{0,1,2},{1,2,0},{2,0,1}};// 计算叉乘的时候，以角标k i j 为顺序 按照index数组的顺序进行计算
             
             double histlow_square;
             double cut_square;
-            bool halftimes=false;
-            double pointHeight[3]={0};
-            double pdotiCrossj[3]={0};
+            //pairs are found with the cell list
+            bool usecells=false;
+            //the cutoff is beyond half the box, pairs are found with
+            //a cell list whose stencils reach over several images
+            bool longrange=false;
             double cut;
             bool partial;
             int centertype;
@@ -121,21 +181,40 @@ class System{
             int histnum;
             double histlow;
             int threadnum;
-            bool *threadflag;
+            //positions in the coordinates of the box policy
+            vector<double> u, v, w;
         };
-        static void pairditancethread(int atomsstart, int atomsfinish, int threadid, System* sys, pdfpara* s);
+        vector<vector<int>> get_pair_histograms(vector<double> cuts, vector<double> lows, vector<int> nbins, int threadnum);
+        vector<vector<double>> get_sine_transform(vector<vector<double>> f, double rlow, double dr, vector<double> q, int threadnum);
+        vector<vector<double>> get_structure_factors(vector<int> hist, int nbins, double histlow, double cut, vector<double> q, string window, string weighting, int threadnum);
+        //the pair loops of the pdf, count is called for every pair found
+        template <typename C>
+        void sweep_pairs(pdfpara &s, C &count);
+        template <typename C>
+        static void pairditancethread(int atomsstart, int atomsfinish, int threadid, System* sys, pdfpara* s, C &count);
+        template <typename C>
+        static void paircellthread(int cellstart, int cellfinish, int threadid, System* sys, pdfpara* s, CellList &cells, C &count);
         bool pdf_halftimes;
         vector<int> get_pairangle(double histlow,double histhigh,int histnum);
         double get_angle(int,int,int);
         //variables for a filter
         void susecells(int);
         int gusecells();
-        int cell_index(int, int, int);
+        void get_box_heights(double[3]);
         void set_up_cells();
-        vector<int> cell_periodic(int, int, int);
+        void set_up_cells(CellList&, double, int);
         void get_all_neighbors_cells();
+        void get_half_neighbors_cells();
+        vector<int> get_half_pair_histogram(double, double, int);
         void get_temp_neighbors_cells(vector<int> atomlist = vector<int>());
         void get_temp_neighbors_brute(vector<int> atomlist = vector<int>());
+        void get_temp_neighbors_knn(int, vector<int> atomlist = vector<int>());
+        void find_k_nearest(int, const vector<int>&, bool, vector<vector<int>>&, vector<vector<datom>>&);
+        void find_candidates_within(int, double, vector<datom>&);
+        void build_neighbor_index(double, int);
+        void build_neighbor_index_within(double, int);
+        void require_neighbor_index(double, int);
+        void get_neighbors_from_index();
         void store_neighbor_info();
         void set_atom_cutoff(double);
 
@@ -194,9 +273,11 @@ class System{
         void find_clusters(double);
         void harvest_cluster(const int, const int);
         void find_clusters_recursive(double);
+        void find_clusters_half();
         int largest_cluster();
         void set_nucsize_parameters(double,double,double);
         void get_largest_cluster_atoms();
+        void get_largest_cluster_atoms_half();
 
         //-----------------------------------------------------
         // Voronoi based methods
@@ -216,8 +297,8 @@ class System{
         void identify_cndia();
         void get_cna_neighbors(int);
         void get_acna_neighbors(int);
-        void get_common_neighbors(int);
-        void get_common_bonds(int);
+        void get_common_neighbors(int, vector<vector<int>>&);
+        void get_common_bonds(int, vector<vector<int>>&);
         void identify_cn12();
         void identify_cn14();
         vector<int> calculate_cna(int);
@@ -228,6 +309,9 @@ class System{
         double switching_fn(double, double, int, int);
         void average_entropy();
         void average_entropy_switch(double, int, int);
+        double gmr(int, double, double, double);
+        double entropy_integrand(int, double, double, double);
+        double trapezoid_integration(int, double, double, double, double, double, double);
         void entropy(double, double, double, double, double, double);
         void calculate_centrosymmetry_atom(int, int);
         void calculate_centrosymmetry(int);
@@ -20,6 +20,39 @@ public:
   using System::System;
 };
 
+//wrap the first n values of a column of the system as a read only numpy
+//array without copying. The base of the array keeps the python system object
+//alive as long as the array is. Every view holds a lease on its columns
+//as well, see view_base.
+template <typename T>
+static py::array column_view(vector<T> &col, int n, py::handle base){
+    py::array_t<T> arr({n}, {sizeof(T)}, col.data(), base);
+    arr.attr("setflags")(py::arg("write") = false);
+    return arr;
+}
+
+//base of a view on the atom or neighbor columns, while it is alive the
+//AtomStore or NeighborList does not move the viewed columns and throws instead
+struct ViewLease{
+    py::object owner;
+    shared_ptr<int> lease;
+};
+
+static py::capsule view_base(py::object owner, shared_ptr<int> &lease){
+    return py::capsule(new ViewLease{owner, lease}, [](void *p){
+        delete static_cast<ViewLease*>(p);
+    });
+}
+
+static vector<double>& qcolumn(System &sys, int qq, bool averaged){
+    if ((qq < 2) || (qq > 12))
+        throw invalid_argument("q value should be between 2-12");
+    vector<double> &col = averaged ? sys.atoms.aq[qq-2] : sys.atoms.q[qq-2];
+    if (col.size() != sys.nop)
+        throw invalid_argument("q value has not been calculated");
+    return col;
+}
+
 
 PYBIND11_MODULE(csystem, m) {
     py::options options;
@@ -45,6 +78,7 @@ PYBIND11_MODULE(csystem, m) {
         .def("assign_triclinic_params",&System::assign_triclinic_params)
         .def("get_triclinic_params",&System::get_triclinic_params)
         .def_readwrite("triclinic", &System::triclinic)
+        .def_property("periodic", &System::gperiodic, &System::speriodic)
         .def("remap_atom", &System::remap_atom)
 
         //-----------------------------------------------------
@@ -53,31 +87,86 @@ PYBIND11_MODULE(csystem, m) {
         .def("get_atoms", &System::get_atoms)
         .def("get_all_atoms", &System::get_all_atoms)
         .def("set_atoms", &System::set_atoms)
+        .def("cset_atoms_arrays", &System::set_atoms_from_arrays)
+        .def("update_positions", &System::update_positions)
+        .def("set_positions", &System::set_positions)
+        .def("cset_custom", &System::set_custom_column)
+        .def("custom_keys", &System::get_custom_keys)
+        .def("cget_custom", [](py::object self, string key) -> py::object {
+            System &sys = self.cast<System&>();
+            CustomColumn &col = sys.get_custom_column(key);
+            if (col.kind == CustomColumn::INT)
+                return column_view(col.ivals, sys.real_nop, view_base(self, sys.atoms.customviews));
+            else if (col.kind == CustomColumn::DOUBLE)
+                return column_view(col.dvals, sys.real_nop, view_base(self, sys.atoms.customviews));
+            py::list vals;
+            for(int ti=0; ti<sys.real_nop; ti++){
+                vals.append(py::cast(col.value(ti)));
+            }
+            return vals;
+        })
+        .def("cset_condition_custom", &System::set_condition_from_custom)
         .def("cadd_atoms", &System::add_atoms)
         //.def_readwrite("atoms", &System::atoms)
         .def("cget_atom",  &System::gatom)
         .def("cset_atom", &System::satom)
+        .def("view_positions", [](py::object self){
+            System &sys = self.cast<System&>();
+            py::capsule base = view_base(self, sys.atoms.columnviews);
+            return py::make_tuple(column_view(sys.atoms.posx, sys.real_nop, base),
+                                  column_view(sys.atoms.posy, sys.real_nop, base),
+                                  column_view(sys.atoms.posz, sys.real_nop, base));
+        })
+        .def("view_types", [](py::object self){
+            System &sys = self.cast<System&>();
+            return column_view(sys.atoms.type, sys.real_nop, view_base(self, sys.atoms.columnviews));
+        })
+        .def("view_ids", [](py::object self){
+            System &sys = self.cast<System&>();
+            return column_view(sys.atoms.id, sys.real_nop, view_base(self, sys.atoms.columnviews));
+        })
 
         //----------------------------------------------------
         // Neighbor methods
         //----------------------------------------------------
         .def_readwrite("usecells", &System::usecells)
+        .def_readwrite("cellsplit", &System::cellsplit)
+        .def_readwrite("skin", &System::skin)
+        .def_property_readonly("verlet_builds", [](System &sys){ return sys.verlet.builds; })
+        .def_readwrite("usehalf", &System::usehalf)
         .def_readwrite("filter", &System::filter)
         .def("get_absdistance", (double (System::*) (Atom, Atom))  &System::get_abs_distance)
         .def("get_absdistance_vector", &System::get_distance_vector)
         .def("get_all_neighbors_cells",&System::get_all_neighbors_cells)
         .def("get_all_neighbors_normal",&System::get_all_neighbors_normal)
+        .def("get_half_neighbors_cells",&System::get_half_neighbors_cells)
+        .def("get_half_pair_histogram",&System::get_half_pair_histogram)
         .def("get_all_neighbors_bynumber",&System::get_all_neighbors_bynumber)
         .def("get_all_neighbors_sann",&System::get_all_neighbors_sann)
         .def("get_all_neighbors_adaptive",&System::get_all_neighbors_adaptive)
         .def("get_all_neighbors_voronoi",&System::get_all_neighbors_voronoi)
         .def("set_neighbordistance", &System::set_neighbordistance)
+        .def("set_pair_cutoffs", &System::set_pair_cutoffs)
+        .def_property("nthreads", &System::get_nthreads, &System::set_nthreads)
         .def("reset_allneighbors", &System::reset_all_neighbors)
         .def("get_pairdistances",&System::get_pairdistances)
+        .def("get_pair_histograms",&System::get_pair_histograms)
+        .def("get_sine_transform",&System::get_sine_transform)
+        .def("get_structure_factors",&System::get_structure_factors)
         .def_readwrite("pdf_halftimes", &System::pdf_halftimes)
         .def("get_pairangle",&System::get_pairangle)
         .def("get_angle",&System::get_angle)
         .def("store_neighbor_info",&System::store_neighbor_info)
+        .def("view_neighbors", [](py::object self){
+            System &sys = self.cast<System&>();
+            NeighborList &nl = sys.neighbors;
+            if (nl.offsets.size() != sys.nop+1) nl.reset(sys.nop);
+            int nb = nl.offsets[sys.real_nop];
+            py::capsule base = view_base(self, nl.views);
+            return py::make_tuple(column_view(nl.offsets, sys.real_nop+1, base),
+                                  column_view(nl.index, nb, base),
+                                  column_view(nl.dist, nb, base));
+        })
         .def("cset_atom_cutoff",&System::set_atom_cutoff)
 
         //---------------------------------------------------
@@ -90,6 +179,10 @@ PYBIND11_MODULE(csystem, m) {
         .def("ccalculate_w", &System::calculate_w)
         .def("ccalculate_disorder",&System::calculate_disorder)
         .def("ccalculate_avg_disorder",&System::find_average_disorder)
+        .def("view_qvals", [](py::object self, int qq, bool averaged){
+            System &sys = self.cast<System&>();
+            return column_view(qcolumn(sys, qq, averaged), sys.real_nop, view_base(self, sys.atoms.qviews));
+        }, py::arg("q"), py::arg("averaged") = false)
         //---------------------------------------------------
         // Methods for BOO_Global_statics
         //---------------------------------------------------
@@ -118,12 +211,20 @@ PYBIND11_MODULE(csystem, m) {
         .def("find_largest_cluster",&System::largest_cluster)
         .def("get_largest_cluster_atoms",&System::get_largest_cluster_atoms)
         .def("find_solid_atoms",&System::find_solid_atoms)
+        .def("view_cluster", [](py::object self){
+            System &sys = self.cast<System&>();
+            return column_view(sys.atoms.belongsto, sys.real_nop, view_base(self, sys.atoms.columnviews));
+        })
 
         //-----------------------------------------------------
         // Voronoi based methods
         //-----------------------------------------------------
         .def_readwrite("voroexp", &System::alpha)
         .def("find_average_volume",&System::find_average_volume)
+        .def("view_volume", [](py::object self, bool averaged){
+            System &sys = self.cast<System&>();
+            return column_view(averaged ? sys.atoms.avgvolume : sys.atoms.volume, sys.real_nop, view_base(self, sys.atoms.columnviews));
+        }, py::arg("averaged") = false)
 
         //-------------------------------------------------------
         // CNA parameters
@@ -132,6 +233,10 @@ PYBIND11_MODULE(csystem, m) {
         .def("ccalculate_cna",&System::calculate_cna)
         .def("get_diamond_neighbors",&System::get_diamond_neighbors)
         .def("cidentify_diamond_structure",&System::identify_diamond_structure)
+        .def("view_structure", [](py::object self){
+            System &sys = self.cast<System&>();
+            return column_view(sys.atoms.structure, sys.real_nop, view_base(self, sys.atoms.columnviews));
+        })
 
         //-------------------------------------------------------
         // Other order parameters
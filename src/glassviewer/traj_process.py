@@ -18,6 +18,7 @@ import io
 import os
 import warnings
 from ase.io import write, read
+from ase.io.formats import UnknownFileTypeError
 import glassviewer.formats.ase as ptase
 import glassviewer.formats.lammps as ptlammps
 import glassviewer.formats.mdtraj as ptmdtraj
@@ -65,13 +66,64 @@ def read_file(filename, format="lammps-dump",
         try:
             #try to use ASE backend
             aseobject = read(filename, format=format)
-            atoms, box = ptase.read_snap(aseobject)
-            warnings.info("Using ase backend to read file")
-        except:
-            raise TypeError("format recieved an unknown option %s"%format)
+        except (UnknownFileTypeError, ValueError) as e:
+            raise TypeError("format recieved an unknown option %s"%format) from e
+        atoms, box = ptase.read_snap(aseobject)
+        warnings.warn("Using ase backend to read file")
 
     return atoms, box       
 
+def read_arrays(filename, format="lammps-dump",
+    compressed = False, customkeys=None):
+    """
+    Read input file into arrays without creating `Atom` objects
+
+    Parameters
+    ----------
+    filename : string
+        name of the input file.
+
+    format : {'lammps-dump', 'poscar', 'ase', 'mdtraj'}
+        format of the input file, in case of `ase` the ASE Atoms object
+
+    compressed : bool, optional
+        If True, force to read a `gz` compressed format, default False.
+
+    customkeys : list
+        A list containing names of headers of extra data that needs to be read in from the
+        input file.
+
+    Returns
+    -------
+    data : dict
+        dict with the keys `positions`, `types`, `ids` and `custom`
+
+    box : list of list of floats
+        the box vectors
+    """
+
+    if customkeys == None:
+        customkeys = []
+
+    if format=='lammps-dump':
+        data, box, is_triclinic = ptlammps.read_arrays(filename, compressed=compressed, customkeys=customkeys)
+    elif format == 'ase':
+        data, box = ptase.read_arrays(filename)
+    elif format == 'mdtraj':
+        data, box = ptmdtraj.read_arrays(filename)
+    elif format == 'poscar':
+        data, box = ptvasp.read_arrays(filename, compressed=compressed)
+    else:
+        try:
+            #try to use ASE backend
+            aseobject = read(filename, format=format)
+        except (UnknownFileTypeError, ValueError) as e:
+            raise TypeError("format recieved an unknown option %s"%format) from e
+        data, box = ptase.read_arrays(aseobject)
+        warnings.warn("Using ase backend to read file")
+
+    return data, box
+
 def write_file(sys, outfile, format="lammps-dump", compressed = False, 
     customkeys=None, customvals=None, timestep=0, species=None):
     """
@@ -126,12 +178,12 @@ def write_file(sys, outfile, format="lammps-dump", compressed = False,
 
     else:
         #try a write using ase
+        aseobject = ptase.convert_snap(sys, species=species)
         try:
-            aseobject = ptase.convert_snap(sys, species=species)
             write(outfile, aseobject, format=format)
-            warnings.info("Using ase backend to write file")
-        except:
-            raise TypeError("format recieved an unknown option %s"%format)
+        except (UnknownFileTypeError, ValueError) as e:
+            raise TypeError("format recieved an unknown option %s"%format) from e
+        warnings.warn("Using ase backend to write file")
 
 
 def split_trajectory(infile, format='lammps-dump', compressed=False,makedir=True):